@@ -0,0 +1,180 @@
+#include "src/Relaxation.h"
+#include "src/Precision.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace FluidSimulation
+{
+	/// Every sweep has to read the right hand side and read / write the
+	/// solution once, neighbours are assumed to come from cache
+	static const double ACCESSES_PER_CELL_SWEEP = 3.0;
+
+	struct BenchmarkOptions
+	{
+		std::vector<uint> numberCells;
+		uint numberSweeps = 20;
+		uint numberRepetitions = 3;
+		uint numberFields = 1;
+		uint numberThreads = std::thread::hardware_concurrency();
+		boundaryType boundary = PERIODIC;
+		std::string precision = "float";
+	};
+
+	static void printUsage(const char * program)
+	{
+		std::cout << "Usage: " << program << " [options]" << std::endl;
+		std::cout << "  --cells N          grid size, may be repeated (default 1024 and 4096)" << std::endl;
+		std::cout << "  --sweeps N         relaxation sweeps per solve (default 20)" << std::endl;
+		std::cout << "  --repeat N         solves per measurement, the fastest one is kept (default 3)" << std::endl;
+		std::cout << "  --fields N         fields relaxed together as one batch (default 1)" << std::endl;
+		std::cout << "  --threads N        worker threads for the red-black sweeps" << std::endl;
+		std::cout << "  --boundary TYPE    periodic | dirichlet (default periodic)" << std::endl;
+		std::cout << "  --precision TYPE   float | double | fp16 | bf16 field storage (default float)" << std::endl;
+	}
+
+	static bool parseOptions(int argc, char ** argv, BenchmarkOptions & options)
+	{
+		for (int n = 1; n < argc; n++)
+		{
+			std::string argument = argv[n];
+			bool hasValue = (n + 1) < argc;
+
+			if (argument == "--cells" && hasValue)
+			{
+				options.numberCells.push_back((uint)std::strtoul(argv[++n], nullptr, 10));
+				if (options.numberCells.back() < 4) return false;
+			}
+			else if (argument == "--sweeps" && hasValue)
+			{
+				options.numberSweeps = (uint)std::strtoul(argv[++n], nullptr, 10);
+			}
+			else if (argument == "--repeat" && hasValue)
+			{
+				options.numberRepetitions = std::max((uint)std::strtoul(argv[++n], nullptr, 10), uint(1));
+			}
+			else if (argument == "--fields" && hasValue)
+			{
+				options.numberFields = std::max((uint)std::strtoul(argv[++n], nullptr, 10), uint(1));
+			}
+			else if (argument == "--threads" && hasValue)
+			{
+				options.numberThreads = (uint)std::strtoul(argv[++n], nullptr, 10);
+			}
+			else if (argument == "--boundary" && hasValue)
+			{
+				std::string boundary = argv[++n];
+				if (boundary == "periodic") options.boundary = PERIODIC;
+				else if (boundary == "dirichlet") options.boundary = DIRICHLET;
+				else return false;
+			}
+			else if (argument == "--precision" && hasValue)
+			{
+				options.precision = argv[++n];
+				if (options.precision != "float" && options.precision != "double" &&
+					options.precision != "fp16" && options.precision != "bf16") return false;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		if (options.numberCells.empty())
+		{
+			options.numberCells.push_back(1024);
+			options.numberCells.push_back(4096);
+		}
+		return true;
+	}
+
+	template <typename T>
+	static void benchmarkRelaxation(uint n, relaxationType relaxation, const char * name, const BenchmarkOptions & options, ThreadPool & threadPool)
+	{
+		typedef std::chrono::steady_clock clock;
+
+		std::size_t size = (std::size_t(n) + 2) * (std::size_t(n) + 2);
+		uint numFields = options.numberFields;
+		std::vector<std::vector<T>> xFields(numFields, std::vector<T>(size));
+		std::vector<std::vector<T>> bFields(numFields, std::vector<T>(size));
+		std::vector<T *> x(numFields);
+		std::vector<const T *> b(numFields);
+		for (uint f = 0; f < numFields; f++)
+		{
+			for (std::size_t k = 0; k < size; k++)
+			{
+				bFields[f][k] = T(float(std::rand()) / float(RAND_MAX) - 0.5f);
+			}
+			x[f] = xFields[f].data();
+			b[f] = bFields[f].data();
+		}
+
+		double bestSeconds = 0.0;
+		for (uint r = 0; r < options.numberRepetitions; r++)
+		{
+			for (uint f = 0; f < numFields; f++)
+			{
+				std::fill(xFields[f].begin(), xFields[f].end(), T(0.0f));
+			}
+
+			auto start = clock::now();
+			relax(relaxation, x.data(), b.data(), numFields, n, n, Compute<T>(1.0), Compute<T>(4.0), options.numberSweeps, options.boundary, threadPool);
+			double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+			if (r == 0 || seconds < bestSeconds) bestSeconds = seconds;
+		}
+
+		double cellSweeps = double(numFields) * double(n) * double(n) * double(options.numberSweeps);
+		std::cout << std::setw(6) << n << "  " << std::left << std::setw(14) << name << std::right
+			<< std::setw(10) << std::fixed << std::setprecision(2) << 1.0e3 * bestSeconds << " ms"
+			<< std::setw(10) << 1.0e-6 * cellSweeps / bestSeconds << " Mcells/s"
+			<< std::setw(9) << 1.0e-9 * ACCESSES_PER_CELL_SWEEP * sizeof(T) * cellSweeps / bestSeconds << " GB/s" << std::endl;
+	}
+
+	template <typename T>
+	static void benchmarkPrecision(uint n, const BenchmarkOptions & options, ThreadPool & threadPool)
+	{
+		benchmarkRelaxation<T>(n, LEXICOGRAPHIC, "lexicographic", options, threadPool);
+		benchmarkRelaxation<T>(n, TILED, "tiled", options, threadPool);
+		benchmarkRelaxation<T>(n, RED_BLACK, "red-black", options, threadPool);
+	}
+}
+
+/// Throughput of the Gauss-Seidel relaxation modes of Fluid::linearSolver,
+/// bandwidth is the compulsory traffic of an untiled sweep over the time
+int main(int argc, char ** argv)
+{
+	using namespace FluidSimulation;
+
+	BenchmarkOptions options;
+	for (int n = 1; n < argc; n++)
+	{
+		if (std::strcmp(argv[n], "--help") == 0) { printUsage(argv[0]); return EXIT_SUCCESS; }
+	}
+
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ThreadPool threadPool(options.numberThreads);
+	std::cout << "precision " << options.precision << ", sweeps " << options.numberSweeps << ", fields " << options.numberFields << ", tile depth " << RELAXATION_TILE_DEPTH
+		<< ", threads " << threadPool.getNumThreads() << std::endl;
+
+	for (uint n : options.numberCells)
+	{
+		if (options.precision == "double") benchmarkPrecision<double>(n, options, threadPool);
+		else if (options.precision == "fp16") benchmarkPrecision<float16>(n, options, threadPool);
+		else if (options.precision == "bf16") benchmarkPrecision<bfloat16>(n, options, threadPool);
+		else benchmarkPrecision<float>(n, options, threadPool);
+	}
+
+	return EXIT_SUCCESS;
+}
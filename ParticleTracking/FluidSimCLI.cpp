@@ -0,0 +1,744 @@
+#include "src/Fluid.h"
+#include "src/AdaptiveFluid.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+
+namespace FluidSimulation
+{
+	enum precisionType
+	{
+		PRECISION_FLOAT = 0,
+		PRECISION_DOUBLE,
+		PRECISION_FLOAT16,
+		PRECISION_BFLOAT16
+	};
+
+	struct CommandLineOptions
+	{
+		uint numberCellsX = 64;
+		uint numberCellsY = 64;
+		uint numberSteps = 100;
+		boundaryType boundary = PERIODIC;
+		double timeStep = TIME_INTEGRATION_INCREMENT_FLUID;
+		timeSteppingType timeStepping = TIME_STEPPING_FIXED;
+		double cflNumber = CFL_NUMBER;
+		bool obstacle = false;
+		SolidGeometry solids;
+		relaxationType relaxation = LEXICOGRAPHIC;
+		uint numberThreads = std::thread::hardware_concurrency();
+		pressureSolverType pressureSolver = PRESSURE_GAUSS_SEIDEL;
+		cycleType cycle = V_CYCLE;
+		preconditionerType preconditioner = PRECONDITIONER_MIC;
+		double tolerance = 0.0;
+		double relaxationTolerance = 0.0;
+		uint minSweeps = 1;
+		uint maxSweeps = RELAXATION_SWEEPS;
+		pressureGuessType pressureGuess = PRESSURE_GUESS_ZERO;
+		diffusionSolverType diffusionSolver = DIFFUSION_GAUSS_SEIDEL;
+		double diffusion = 0.0;
+		double viscosity = 0.0;
+		uint numScalars = 1;
+		advectionKernelType advectionKernel = detectAdvectionKernel();
+		advectionSchemeType advectionScheme = ADVECTION_SEMI_LAGRANGIAN;
+		backtraceType backtrace = BACKTRACE_EULER;
+		interpolationType interpolation = INTERPOLATION_LINEAR;
+		precisionType precision = PRECISION_FLOAT;
+		bool hugePages = false;
+		double activityThreshold = 0.0;
+		uint amrLevels = 0;
+		double amrVorticity = AMR_REFINE_VORTICITY;
+		double amrDensity = AMR_REFINE_DENSITY;
+	};
+
+	static void printOption(const char * option, const std::string & description)
+	{
+		std::cout << "  " << std::left << std::setw(26) << option << description << std::endl;
+	}
+
+	static void printUsage(const char * program)
+	{
+		std::cout << "Usage: " << program << " [options]" << std::endl;
+		printOption("--cells N", "cells per side, at least " + std::to_string(NUM_CELLS_MIN) + " (default 64)");
+		printOption("--cells-x N", "cells along x, the shorter side has unit length");
+		printOption("--cells-y N", "cells along y");
+		printOption("--steps N", "number of time steps (default 100)");
+		printOption("--boundary TYPE", "periodic | dirichlet (default periodic)");
+		printOption("--dt DT", "fluid time step, the frame time when adaptive (default 0.1)");
+		printOption("--adaptive", "substep every frame at the CFL limit");
+		printOption("--cfl C", "cells the fastest cell may move per substep (default 5)");
+		printOption("--obstacle", "enable the square obstacle in the centre");
+		printOption("--solid-box X0 Y0 X1 Y1", "add a solid box, the shorter side has unit length");
+		printOption("--solid-circle X Y R", "add a solid disc");
+		printOption("--solid-image FILE", "solids from a pbm / pgm image over the domain, dark is solid");
+		printOption("--relaxation TYPE", "lexicographic | red-black | tiled (default lexicographic)");
+		printOption("--threads N", "worker threads (default " + std::to_string(std::thread::hardware_concurrency()) + ")");
+		printOption("--pressure TYPE", "gauss-seidel | multigrid | cg | spectral (default gauss-seidel)");
+		printOption("--pressure-guess TYPE", "zero | previous | extrapolate (default zero)");
+		printOption("--diffusion-solver TYPE", "gauss-seidel | spectral | adi (default gauss-seidel)");
+		printOption("--diffusion D", "density diffusion coefficient (default 0)");
+		printOption("--viscosity V", "kinematic viscosity of the velocity (default 0)");
+		printOption("--scalars K", "passive scalar channels, density included (default 1)");
+		printOption("--cycle TYPE", "v | w multigrid cycle (default v)");
+		printOption("--precon TYPE", "none | jacobi | mic conjugate gradient preconditioner (default mic)");
+		printOption("--tolerance TOL", "relative residual reduction of multigrid / cg (default 1e-4)");
+		printOption("--relax-tolerance TOL", "stop gauss-seidel pressure and diffusion at this relative residual");
+		printOption("--relax-sweeps MIN MAX", "sweep bounds of gauss-seidel pressure and diffusion (default 1 20)");
+		printOption("--simd TYPE", "scalar | avx2 | avx512 advection kernel (default widest supported)");
+		printOption("--scheme TYPE", "semi-lagrangian | maccormack | bfecc advection (default semi-lagrangian)");
+		printOption("--backtrace TYPE", "euler | rk2 | rk3 (default euler)");
+		printOption("--interpolation TYPE", "linear | cubic, cubic is monotone (default linear)");
+		printOption("--precision TYPE", "float | double | fp16 | bf16 field storage (default float)");
+		printOption("--huge-pages", "back the fields with transparent huge pages");
+		printOption("--sparse-tiles THRESHOLD", "skip the tiles where the fields stay below the threshold");
+		printOption("--amr LEVELS", "quadtree refinement with LEVELS levels over the base grid");
+		printOption("--amr-refine W D", "vorticity and density jumps per cell refining a block (default 0.02 0.1)");
+		printOption("--help", "show this message");
+	}
+
+	/// First option the quadtree solver has no counterpart for, nullptr
+	/// when all of them are left at their defaults
+	static const char * unsupportedAdaptiveOption(const CommandLineOptions & options)
+	{
+		CommandLineOptions defaults;
+		if (options.obstacle) return "--obstacle";
+		if (!options.solids.empty()) return "--solid-*";
+		if (options.relaxation != defaults.relaxation) return "--relaxation";
+		if (options.pressureSolver != defaults.pressureSolver) return "--pressure";
+		if (options.pressureGuess != defaults.pressureGuess) return "--pressure-guess";
+		if (options.diffusionSolver != defaults.diffusionSolver) return "--diffusion-solver";
+		if (options.numScalars != defaults.numScalars) return "--scalars";
+		if (options.cycle != defaults.cycle) return "--cycle";
+		if (options.preconditioner != defaults.preconditioner) return "--precon";
+		if (options.tolerance != defaults.tolerance) return "--tolerance";
+		if (options.relaxationTolerance != defaults.relaxationTolerance) return "--relax-tolerance";
+		if (options.minSweeps != defaults.minSweeps || options.maxSweeps != defaults.maxSweeps) return "--relax-sweeps";
+		if (options.advectionKernel != defaults.advectionKernel) return "--simd";
+		if (options.advectionScheme != defaults.advectionScheme) return "--scheme";
+		if (options.backtrace != defaults.backtrace) return "--backtrace";
+		if (options.interpolation != defaults.interpolation) return "--interpolation";
+		if (options.hugePages) return "--huge-pages";
+		if (options.activityThreshold > 0.0) return "--sparse-tiles";
+		return nullptr;
+	}
+
+	static bool parseOptions(int argc, char ** argv, CommandLineOptions & options)
+	{
+		for (int n = 1; n < argc; n++)
+		{
+			std::string argument = argv[n];
+			bool hasValue = (n + 1) < argc;
+
+			if (argument == "--cells" && hasValue)
+			{
+				options.numberCellsX = (uint)std::strtoul(argv[++n], nullptr, 10);
+				options.numberCellsY = options.numberCellsX;
+			}
+			else if (argument == "--cells-x" && hasValue)
+			{
+				options.numberCellsX = (uint)std::strtoul(argv[++n], nullptr, 10);
+			}
+			else if (argument == "--cells-y" && hasValue)
+			{
+				options.numberCellsY = (uint)std::strtoul(argv[++n], nullptr, 10);
+			}
+			else if (argument == "--steps" && hasValue)
+			{
+				options.numberSteps = (uint)std::strtoul(argv[++n], nullptr, 10);
+			}
+			else if (argument == "--boundary" && hasValue)
+			{
+				std::string boundary = argv[++n];
+				if (boundary == "periodic") options.boundary = PERIODIC;
+				else if (boundary == "dirichlet") options.boundary = DIRICHLET;
+				else return false;
+			}
+			else if (argument == "--dt" && hasValue)
+			{
+				options.timeStep = std::strtod(argv[++n], nullptr);
+				if (!(options.timeStep > 0.0)) return false;
+			}
+			else if (argument == "--adaptive")
+			{
+				options.timeStepping = TIME_STEPPING_ADAPTIVE;
+			}
+			else if (argument == "--cfl" && hasValue)
+			{
+				options.cflNumber = std::strtod(argv[++n], nullptr);
+				if (!(options.cflNumber > 0.0)) return false;
+			}
+			else if (argument == "--obstacle")
+			{
+				options.obstacle = true;
+			}
+			else if (argument == "--solid-box" && (n + 4) < argc)
+			{
+				double x0 = std::strtod(argv[++n], nullptr);
+				double y0 = std::strtod(argv[++n], nullptr);
+				double x1 = std::strtod(argv[++n], nullptr);
+				double y1 = std::strtod(argv[++n], nullptr);
+				options.solids.addBox(x0, y0, x1, y1);
+			}
+			else if (argument == "--solid-circle" && (n + 3) < argc)
+			{
+				double x = std::strtod(argv[++n], nullptr);
+				double y = std::strtod(argv[++n], nullptr);
+				double radius = std::strtod(argv[++n], nullptr);
+				if (!(radius > 0.0)) return false;
+				options.solids.addCircle(x, y, radius);
+			}
+			else if (argument == "--solid-image" && hasValue)
+			{
+				std::string path = argv[++n];
+				if (!options.solids.loadImage(path))
+				{
+					std::cout << "error: cannot read the image " << path << std::endl;
+					return false;
+				}
+			}
+			else if (argument == "--relaxation" && hasValue)
+			{
+				std::string relaxation = argv[++n];
+				if (relaxation == "lexicographic") options.relaxation = LEXICOGRAPHIC;
+				else if (relaxation == "red-black") options.relaxation = RED_BLACK;
+				else if (relaxation == "tiled") options.relaxation = TILED;
+				else return false;
+			}
+			else if (argument == "--huge-pages")
+			{
+				options.hugePages = true;
+			}
+			else if (argument == "--sparse-tiles" && hasValue)
+			{
+				options.activityThreshold = std::strtod(argv[++n], nullptr);
+				if (!(options.activityThreshold > 0.0)) return false;
+			}
+			else if (argument == "--amr" && hasValue)
+			{
+				options.amrLevels = (uint)std::strtoul(argv[++n], nullptr, 10);
+				if (options.amrLevels < 1 || options.amrLevels > QUADTREE_MAX_LEVELS) return false;
+			}
+			else if (argument == "--amr-refine" && (n + 2) < argc)
+			{
+				options.amrVorticity = std::strtod(argv[++n], nullptr);
+				options.amrDensity = std::strtod(argv[++n], nullptr);
+				if (!(options.amrVorticity > 0.0) || !(options.amrDensity > 0.0)) return false;
+			}
+			else if (argument == "--threads" && hasValue)
+			{
+				options.numberThreads = (uint)std::strtoul(argv[++n], nullptr, 10);
+			}
+			else if (argument == "--pressure" && hasValue)
+			{
+				std::string pressure = argv[++n];
+				if (pressure == "gauss-seidel") options.pressureSolver = PRESSURE_GAUSS_SEIDEL;
+				else if (pressure == "multigrid") options.pressureSolver = PRESSURE_MULTIGRID;
+				else if (pressure == "cg") options.pressureSolver = PRESSURE_CONJUGATE_GRADIENT;
+				else if (pressure == "spectral") options.pressureSolver = PRESSURE_SPECTRAL;
+				else return false;
+			}
+			else if (argument == "--pressure-guess" && hasValue)
+			{
+				std::string guess = argv[++n];
+				if (guess == "zero") options.pressureGuess = PRESSURE_GUESS_ZERO;
+				else if (guess == "previous") options.pressureGuess = PRESSURE_GUESS_PREVIOUS;
+				else if (guess == "extrapolate") options.pressureGuess = PRESSURE_GUESS_EXTRAPOLATED;
+				else return false;
+			}
+			else if (argument == "--diffusion" && hasValue)
+			{
+				options.diffusion = std::strtod(argv[++n], nullptr);
+				if (options.diffusion < 0.0) return false;
+			}
+			else if (argument == "--viscosity" && hasValue)
+			{
+				options.viscosity = std::strtod(argv[++n], nullptr);
+				if (options.viscosity < 0.0) return false;
+			}
+			else if (argument == "--scalars" && hasValue)
+			{
+				options.numScalars = (uint)std::strtoul(argv[++n], nullptr, 10);
+				if (options.numScalars < 1 || options.numScalars > MAX_SCALAR_CHANNELS) return false;
+			}
+			else if (argument == "--diffusion-solver" && hasValue)
+			{
+				std::string diffusion = argv[++n];
+				if (diffusion == "gauss-seidel") options.diffusionSolver = DIFFUSION_GAUSS_SEIDEL;
+				else if (diffusion == "spectral") options.diffusionSolver = DIFFUSION_SPECTRAL;
+				else if (diffusion == "adi") options.diffusionSolver = DIFFUSION_ADI;
+				else return false;
+			}
+			else if (argument == "--precision" && hasValue)
+			{
+				std::string precision = argv[++n];
+				if (precision == "float") options.precision = PRECISION_FLOAT;
+				else if (precision == "double") options.precision = PRECISION_DOUBLE;
+				else if (precision == "fp16") options.precision = PRECISION_FLOAT16;
+				else if (precision == "bf16") options.precision = PRECISION_BFLOAT16;
+				else return false;
+			}
+			else if (argument == "--simd" && hasValue)
+			{
+				std::string kernel = argv[++n];
+				if (kernel == "scalar") options.advectionKernel = ADVECTION_SCALAR;
+				else if (kernel == "avx2") options.advectionKernel = ADVECTION_AVX2;
+				else if (kernel == "avx512") options.advectionKernel = ADVECTION_AVX512;
+				else return false;
+			}
+			else if (argument == "--scheme" && hasValue)
+			{
+				std::string scheme = argv[++n];
+				if (scheme == "semi-lagrangian") options.advectionScheme = ADVECTION_SEMI_LAGRANGIAN;
+				else if (scheme == "maccormack") options.advectionScheme = ADVECTION_MACCORMACK;
+				else if (scheme == "bfecc") options.advectionScheme = ADVECTION_BFECC;
+				else return false;
+			}
+			else if (argument == "--backtrace" && hasValue)
+			{
+				std::string backtrace = argv[++n];
+				if (backtrace == "euler") options.backtrace = BACKTRACE_EULER;
+				else if (backtrace == "rk2") options.backtrace = BACKTRACE_RK2;
+				else if (backtrace == "rk3") options.backtrace = BACKTRACE_RK3;
+				else return false;
+			}
+			else if (argument == "--interpolation" && hasValue)
+			{
+				std::string interpolation = argv[++n];
+				if (interpolation == "linear") options.interpolation = INTERPOLATION_LINEAR;
+				else if (interpolation == "cubic") options.interpolation = INTERPOLATION_CUBIC;
+				else return false;
+			}
+			else if (argument == "--cycle" && hasValue)
+			{
+				std::string cycle = argv[++n];
+				if (cycle == "v") options.cycle = V_CYCLE;
+				else if (cycle == "w") options.cycle = W_CYCLE;
+				else return false;
+			}
+			else if (argument == "--precon" && hasValue)
+			{
+				std::string preconditioner = argv[++n];
+				if (preconditioner == "none") options.preconditioner = PRECONDITIONER_NONE;
+				else if (preconditioner == "jacobi") options.preconditioner = PRECONDITIONER_JACOBI;
+				else if (preconditioner == "mic") options.preconditioner = PRECONDITIONER_MIC;
+				else return false;
+			}
+			else if (argument == "--tolerance" && hasValue)
+			{
+				options.tolerance = std::strtod(argv[++n], nullptr);
+				if (!(options.tolerance > 0.0)) return false;
+			}
+			else if (argument == "--relax-tolerance" && hasValue)
+			{
+				options.relaxationTolerance = std::strtod(argv[++n], nullptr);
+				if (!(options.relaxationTolerance > 0.0)) return false;
+			}
+			else if (argument == "--relax-sweeps" && (n + 2) < argc)
+			{
+				options.minSweeps = (uint)std::strtoul(argv[++n], nullptr, 10);
+				options.maxSweeps = (uint)std::strtoul(argv[++n], nullptr, 10);
+				if (options.maxSweeps == 0 || options.minSweeps > options.maxSweeps) return false;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		if (options.amrLevels > 0)
+		{
+			const char * unsupported = unsupportedAdaptiveOption(options);
+			if (unsupported)
+			{
+				std::cout << "error: " << unsupported << " is not supported with --amr" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static std::string diffusionSolverName(diffusionSolverType diffusionSolver)
+	{
+		if (diffusionSolver == DIFFUSION_SPECTRAL) return "spectral";
+		if (diffusionSolver == DIFFUSION_ADI) return "adi";
+		return "gauss-seidel";
+	}
+
+	static std::string pressureGuessName(pressureGuessType guess)
+	{
+		if (guess == PRESSURE_GUESS_ZERO) return "zero";
+		if (guess == PRESSURE_GUESS_EXTRAPOLATED) return "extrapolated";
+		return "previous";
+	}
+
+	static std::string pressureSolverName(const CommandLineOptions & options)
+	{
+		switch (options.pressureSolver)
+		{
+		case PRESSURE_MULTIGRID:
+			return (options.cycle == W_CYCLE) ? "multigrid W-cycle" : "multigrid V-cycle";
+
+		case PRESSURE_CONJUGATE_GRADIENT:
+			if (options.preconditioner == PRECONDITIONER_MIC) return "conjugate gradient, MIC(0)";
+			if (options.preconditioner == PRECONDITIONER_JACOBI) return "conjugate gradient, jacobi";
+			return "conjugate gradient";
+
+		case PRESSURE_SPECTRAL:
+			return "spectral";
+
+		default:
+		case PRESSURE_GAUSS_SEIDEL:
+			return "gauss-seidel";
+		}
+	}
+
+	static std::string relaxationName(relaxationType relaxation)
+	{
+		switch (relaxation)
+		{
+		case RED_BLACK:
+			return "red-black";
+
+		case TILED:
+			return "tiled";
+
+		default:
+		case LEXICOGRAPHIC:
+			return "lexicographic";
+		}
+	}
+
+	static std::string advectionKernelName(advectionKernelType kernel)
+	{
+		switch (kernel)
+		{
+		case ADVECTION_AVX512:
+			return "avx512";
+
+		case ADVECTION_AVX2:
+			return "avx2";
+
+		default:
+		case ADVECTION_SCALAR:
+			return "scalar";
+		}
+	}
+
+	static std::string advectionSchemeName(const CommandLineOptions & options)
+	{
+		std::string name = "semi-lagrangian";
+		if (options.advectionScheme == ADVECTION_MACCORMACK) name = "maccormack";
+		if (options.advectionScheme == ADVECTION_BFECC) name = "bfecc";
+
+		if (options.backtrace == BACKTRACE_RK2) name += ", rk2";
+		else if (options.backtrace == BACKTRACE_RK3) name += ", rk3";
+		else name += ", euler";
+
+		name += (options.interpolation == INTERPOLATION_CUBIC) ? ", cubic" : ", linear";
+		return name;
+	}
+
+	static std::string precisionName(precisionType precision)
+	{
+		switch (precision)
+		{
+		case PRECISION_DOUBLE:
+			return "double";
+
+		case PRECISION_FLOAT16:
+			return "fp16 storage, float compute";
+
+		case PRECISION_BFLOAT16:
+			return "bf16 storage, float compute";
+
+		default:
+		case PRECISION_FLOAT:
+			return "float";
+		}
+	}
+
+	/// The channels after the density start as gaussian blobs on a circle
+	/// around the centre
+	template <typename T>
+	static void seedScalars(Fluid<T> & fluid)
+	{
+		typedef typename Fluid<T>::scalar scalar;
+		uint numCellsX = fluid.getNumCellsX();
+		uint numCellsY = fluid.getNumCellsY();
+		scalar spacing = fluid.getSpacingCells();
+		for (uint k = 1; k < fluid.getNumScalars(); k++)
+		{
+			scalar angle = scalar(2.0 * M_PI) * scalar(k) / scalar(fluid.getNumScalars());
+			scalar centreX = scalar(0.5) * numCellsX * spacing + scalar(0.25) * std::cos(angle);
+			scalar centreY = scalar(0.5) * numCellsY * spacing + scalar(0.25) * std::sin(angle);
+			for (uint j = 1; j <= numCellsY; j++)
+			{
+				for (uint i = 1; i <= numCellsX; i++)
+				{
+					scalar dx = (i - scalar(0.5)) * spacing - centreX;
+					scalar dy = (j - scalar(0.5)) * spacing - centreY;
+					fluid.addScalar(k, i, j, std::exp(-(dx * dx + dy * dy) / scalar(0.005)));
+				}
+			}
+		}
+	}
+
+	template <typename T>
+	static int runSimulation(const CommandLineOptions & options)
+	{
+		typedef std::chrono::steady_clock clock;
+		typedef typename Fluid<T>::scalar scalar;
+
+		Fluid<T> fluid;
+		fluid.setBoundaryType(options.boundary);
+		fluid.setTimeStep(scalar(options.timeStep));
+		fluid.setTimeStepping(options.timeStepping);
+		fluid.setCflNumber(scalar(options.cflNumber));
+		fluid.setObstacle(options.obstacle);
+		fluid.setSolidGeometry(options.solids);
+		fluid.setRelaxationType(options.relaxation);
+		fluid.setNumThreads(options.numberThreads);
+		fluid.setHugePages(options.hugePages);
+		if (options.activityThreshold > 0.0)
+		{
+			fluid.setSparseTiles(true);
+			fluid.setActivityThreshold(scalar(options.activityThreshold));
+		}
+		fluid.setPressureSolver(options.pressureSolver);
+		fluid.setPressureGuess(options.pressureGuess);
+		fluid.setDiffusionSolver(options.diffusionSolver);
+		fluid.setDiffusion(scalar(options.diffusion));
+		fluid.setViscosity(scalar(options.viscosity));
+		fluid.setNumScalars(options.numScalars);
+		fluid.setAdvectionKernel(options.advectionKernel);
+		fluid.setAdvectionScheme(options.advectionScheme);
+		fluid.setBacktrace(options.backtrace);
+		fluid.setInterpolation(options.interpolation);
+		fluid.getMultigrid().setCycleType(options.cycle);
+		fluid.getConjugateGradient().setPreconditioner(options.preconditioner);
+		if (options.tolerance > 0.0)
+		{
+			fluid.getMultigrid().setTolerance(scalar(options.tolerance));
+			fluid.getConjugateGradient().setTolerance(scalar(options.tolerance));
+		}
+		for (RelaxationCriterion * criterion : { &fluid.getPressureRelaxation(), &fluid.getDiffusionRelaxation() })
+		{
+			criterion->minSweeps = options.minSweeps;
+			criterion->maxSweeps = options.maxSweeps;
+			criterion->tolerance = options.relaxationTolerance;
+		}
+
+		auto initStart = clock::now();
+		fluid.setGridSize(options.numberCellsX, options.numberCellsY);
+		seedScalars(fluid);
+		auto initEnd = clock::now();
+
+		uint numCellsX = fluid.getNumCellsX();
+		uint numCellsY = fluid.getNumCellsY();
+		if (numCellsX != options.numberCellsX || numCellsY != options.numberCellsY)
+		{
+			std::cout << "warning: grid size clamped to " << numCellsX << " x " << numCellsY << std::endl;
+		}
+
+		std::cout << "cells      : " << numCellsX << " x " << numCellsY << std::endl;
+		std::cout << "steps      : " << options.numberSteps << std::endl;
+		std::cout << "boundary   : " << ((options.boundary == PERIODIC) ? "periodic" : "dirichlet") << std::endl;
+		std::cout << "dt         : " << fluid.getTimeIntegrationStep();
+		if (options.timeStepping == TIME_STEPPING_ADAPTIVE) std::cout << " per frame, adaptive cfl " << fluid.getCflNumber();
+		std::cout << std::endl;
+		std::cout << "precision  : " << precisionName(options.precision) << std::endl;
+		std::cout << "relaxation : " << relaxationName(options.relaxation) << std::endl;
+		std::cout << "threads    : " << fluid.getNumThreads() << std::endl;
+		std::cout << "pressure   : " << pressureSolverName(options);
+		if (fluid.getActivePressureSolver() != options.pressureSolver) std::cout << ", falls back to gauss-seidel";
+		if (fluid.getActivePressureSolver() != PRESSURE_SPECTRAL) std::cout << ", " << pressureGuessName(fluid.pressureSolveToTolerance() ? options.pressureGuess : PRESSURE_GUESS_ZERO) << " guess";
+		std::cout << std::endl;
+		std::cout << "advection  : " << advectionKernelName(options.advectionKernel) << std::endl;
+		std::cout << "scheme     : " << advectionSchemeName(options) << std::endl;
+		if (fluid.getNumScalars() > 1) std::cout << "scalars    : " << fluid.getNumScalars() << " channels" << std::endl;
+		std::cout << "diffusion  : " << diffusionSolverName(options.diffusionSolver);
+		bool diffusionActive = (options.diffusionSolver == DIFFUSION_SPECTRAL) ? fluid.isSpectralDiffusionActive() : fluid.isAdiDiffusionActive();
+		if (options.diffusionSolver != DIFFUSION_GAUSS_SEIDEL && !diffusionActive) std::cout << ", falls back to gauss-seidel";
+		std::cout << std::endl;
+		if (fluid.getSolidMask().hasSolids())
+		{
+			std::cout << "solids     : " << fluid.getSolidMask().getNumSolidCells() << " cells" << std::endl;
+		}
+
+		double velocityActive = 0.0;
+		double densityActive = 0.0;
+		uint pressureIterations = 0;
+		uint diffusionIterations = 0;
+		uint unconvergedSteps = 0;
+		uint numberSubsteps = 0;
+		uint maxSubsteps = 0;
+		auto runStart = clock::now();
+		for (uint step = 0; step < options.numberSteps; step++)
+		{
+			fluid.update();
+			pressureIterations += fluid.getPressureStatistics().iterations;
+			diffusionIterations += fluid.getDiffusionStatistics().iterations;
+			if (!fluid.getPressureStatistics().converged || !fluid.getDiffusionStatistics().converged) unconvergedSteps++;
+			numberSubsteps += fluid.getNumSubsteps();
+			maxSubsteps = std::max(maxSubsteps, fluid.getNumSubsteps());
+			velocityActive += fluid.getVelocityActivity().getActiveFraction();
+			densityActive += fluid.getDensityActivity().getActiveFraction();
+		}
+		auto runEnd = clock::now();
+
+		double initSeconds = std::chrono::duration<double>(initEnd - initStart).count();
+		double runSeconds = std::chrono::duration<double>(runEnd - runStart).count();
+		double stepMilliseconds = (options.numberSteps > 0) ? (1.0e3 * runSeconds / options.numberSteps) : 0.0;
+		double cellUpdates = double(numCellsX) * double(numCellsY) * double(options.numberSteps);
+		double cellsPerSecond = (runSeconds > 0.0) ? (cellUpdates / runSeconds) : 0.0;
+
+		std::cout << "init       : " << 1.0e3 * initSeconds << " ms" << std::endl;
+		std::cout << "total      : " << 1.0e3 * runSeconds << " ms" << std::endl;
+		std::cout << "per step   : " << stepMilliseconds << " ms" << std::endl;
+		std::cout << "throughput : " << 1.0e-6 * cellsPerSecond << " Mcells/s" << std::endl;
+		std::cout << "speed      : [" << fluid.getMinSpeed() << ", " << fluid.getMaxSpeed() << "]" << std::endl;
+		std::cout << "density    : [" << fluid.getMinDensity() << ", " << fluid.getMaxDensity() << "]" << std::endl;
+		for (uint k = 1; k < fluid.getNumScalars(); k++)
+		{
+			ValueRange<scalar> range = fluid.getScalarRange(k);
+			std::cout << "scalar " << k << "   : [" << range.minimum << ", " << range.maximum << "]" << std::endl;
+		}
+
+		const SolverStatistics & pressureStatistics = fluid.getPressureStatistics();
+		double meanIterations = (options.numberSteps > 0) ? (double(pressureIterations) / options.numberSteps) : 0.0;
+		double meanSubsteps = (options.numberSteps > 0) ? (double(numberSubsteps) / options.numberSteps) : 0.0;
+		std::cout << "substeps   : " << meanSubsteps << " per step, max " << maxSubsteps << std::endl;
+		if (fluid.isUsingSparseTiles() && options.numberSteps > 0)
+		{
+			std::cout << "active     : " << 100.0 * velocityActive / options.numberSteps << " % velocity, "
+				<< 100.0 * densityActive / options.numberSteps << " % density tiles" << std::endl;
+		}
+		std::cout << "p iters    : " << meanIterations << " per step" << std::endl;
+		std::cout << "p residual : " << pressureStatistics.residual << " (relative " << pressureStatistics.relativeResidual() << ")" << std::endl;
+
+		SolverStatistics diffusionStatistics = fluid.getDiffusionStatistics();
+		double meanSweeps = (options.numberSteps > 0) ? (double(diffusionIterations) / options.numberSteps) : 0.0;
+		std::cout << "d iters    : " << meanSweeps << " per step" << std::endl;
+		std::cout << "d residual : " << diffusionStatistics.residual << " (relative " << diffusionStatistics.relativeResidual() << ")" << std::endl;
+		if (unconvergedSteps > 0) std::cout << "warning: " << unconvergedSteps << " steps ended a solve at its iteration limit above the tolerance" << std::endl;
+		std::cout << "divergence : " << fluid.computeDivergenceNorm() << std::endl;
+		if (options.boundary == PERIODIC && !fluid.getSolidMask().hasSolids() && options.diffusion == 0.0 && options.viscosity == 0.0)
+		{
+			std::cout << "tg error   : " << fluid.computeTaylorGreenError() << std::endl;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	/// Same run on the quadtree, parseOptions rejects the options of Fluid's
+	/// other solvers and solids
+	template <typename T>
+	static int runAdaptiveSimulation(const CommandLineOptions & options)
+	{
+		typedef std::chrono::steady_clock clock;
+		typedef typename AdaptiveFluid<T>::scalar scalar;
+
+		AdaptiveFluid<T> fluid;
+		fluid.setBoundaryType(options.boundary);
+		fluid.setTimeStep(scalar(options.timeStep));
+		fluid.setTimeStepping(options.timeStepping);
+		fluid.setCflNumber(scalar(options.cflNumber));
+		fluid.setNumThreads(options.numberThreads);
+		fluid.setDiffusion(scalar(options.diffusion));
+		fluid.setViscosity(scalar(options.viscosity));
+		fluid.setNumLevels(options.amrLevels);
+		fluid.setRefinementThresholds(scalar(options.amrVorticity), scalar(options.amrDensity));
+
+		auto initStart = clock::now();
+		fluid.setGridSize(options.numberCellsX, options.numberCellsY);
+		auto initEnd = clock::now();
+
+		std::cout << "base cells : " << fluid.getBaseCellsX() << " x " << fluid.getBaseCellsY() << std::endl;
+		std::cout << "levels     : " << fluid.getNumLevels() << ", blocks of " << QUADTREE_BLOCK_SIZE << " x " << QUADTREE_BLOCK_SIZE << std::endl;
+		std::cout << "steps      : " << options.numberSteps << std::endl;
+		std::cout << "boundary   : " << ((options.boundary == PERIODIC) ? "periodic" : "dirichlet") << std::endl;
+		std::cout << "precision  : " << precisionName(options.precision) << std::endl;
+		std::cout << "threads    : " << fluid.getNumThreads() << std::endl;
+
+		double leafCells = 0.0;
+		uint pressureIterations = 0;
+		uint unconvergedSteps = 0;
+		auto runStart = clock::now();
+		for (uint step = 0; step < options.numberSteps; step++)
+		{
+			fluid.update();
+			pressureIterations += fluid.getPressureStatistics().iterations;
+			if (!fluid.getPressureStatistics().converged) unconvergedSteps++;
+			leafCells += double(fluid.getNumLeafCells());
+		}
+		auto runEnd = clock::now();
+
+		double initSeconds = std::chrono::duration<double>(initEnd - initStart).count();
+		double runSeconds = std::chrono::duration<double>(runEnd - runStart).count();
+		double stepMilliseconds = (options.numberSteps > 0) ? (1.0e3 * runSeconds / options.numberSteps) : 0.0;
+		double cellsPerSecond = (runSeconds > 0.0) ? (leafCells / runSeconds) : 0.0;
+
+		std::cout << "init       : " << 1.0e3 * initSeconds << " ms" << std::endl;
+		std::cout << "total      : " << 1.0e3 * runSeconds << " ms" << std::endl;
+		std::cout << "per step   : " << stepMilliseconds << " ms" << std::endl;
+		std::cout << "throughput : " << 1.0e-6 * cellsPerSecond << " Mcells/s" << std::endl;
+		std::cout << "leaves     :";
+		for (uint level = 0; level < fluid.getNumLevels(); level++) std::cout << " " << fluid.getTree().getNumLeaves(level);
+		std::cout << " blocks per level" << std::endl;
+		std::cout << "leaf cells : " << fluid.getNumLeafCells() << " of " << fluid.getNumUniformCells() << " uniform" << std::endl;
+		std::cout << "speed      : [" << fluid.getMinSpeed() << ", " << fluid.getMaxSpeed() << "]" << std::endl;
+		std::cout << "density    : [" << fluid.getMinDensity() << ", " << fluid.getMaxDensity() << "]" << std::endl;
+
+		const SolverStatistics & pressureStatistics = fluid.getPressureStatistics();
+		double meanIterations = (options.numberSteps > 0) ? (double(pressureIterations) / options.numberSteps) : 0.0;
+		std::cout << "p cycles   : " << meanIterations << " per step" << std::endl;
+		std::cout << "p residual : " << pressureStatistics.residual << " (relative " << pressureStatistics.relativeResidual() << ")" << std::endl;
+		if (unconvergedSteps > 0) std::cout << "warning: " << unconvergedSteps << " steps ended the pressure solve at its cycle limit above the tolerance" << std::endl;
+		std::cout << "divergence : " << fluid.computeDivergenceNorm() << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	template <typename T>
+	static int run(const CommandLineOptions & options)
+	{
+		return (options.amrLevels > 0) ? runAdaptiveSimulation<T>(options) : runSimulation<T>(options);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	using namespace FluidSimulation;
+
+	CommandLineOptions options;
+	for (int n = 1; n < argc; n++)
+	{
+		if (std::strcmp(argv[n], "--help") == 0) { printUsage(argv[0]); return EXIT_SUCCESS; }
+	}
+
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	switch (options.precision)
+	{
+	case PRECISION_DOUBLE:
+		return run<double>(options);
+
+	case PRECISION_FLOAT16:
+		return run<float16>(options);
+
+	case PRECISION_BFLOAT16:
+		return run<bfloat16>(options);
+
+	default:
+	case PRECISION_FLOAT:
+		return run<float>(options);
+	}
+}
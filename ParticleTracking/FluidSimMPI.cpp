@@ -0,0 +1,306 @@
+#include "src/DistributedFluid.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+namespace FluidSimulation
+{
+	enum precisionType
+	{
+		PRECISION_FLOAT = 0,
+		PRECISION_DOUBLE,
+		PRECISION_FLOAT16,
+		PRECISION_BFLOAT16
+	};
+
+	struct CommandLineOptions
+	{
+		uint numberCellsX = 64;
+		uint numberCellsY = 64;
+		uint numberSteps = 100;
+		boundaryType boundary = PERIODIC;
+		double timeStep = TIME_INTEGRATION_INCREMENT_FLUID;
+		timeSteppingType timeStepping = TIME_STEPPING_FIXED;
+		double cflNumber = CFL_NUMBER;
+		bool obstacle = false;
+		double diffusion = 0.0;
+		double viscosity = 0.0;
+		uint haloWidth = DECOMPOSITION_HALO_WIDTH;
+		precisionType precision = PRECISION_FLOAT;
+	};
+
+	static void printOption(const char * option, const std::string & description)
+	{
+		std::cout << "  " << std::left << std::setw(26) << option << description << std::endl;
+	}
+
+	static void printUsage(const char * program)
+	{
+		std::cout << "Usage: mpirun -np RANKS " << program << " [options]" << std::endl;
+		printOption("--cells N", "cells per side, at least " + std::to_string(NUM_CELLS_MIN) + " (default 64)");
+		printOption("--cells-x N", "cells along x, the shorter side has unit length");
+		printOption("--cells-y N", "cells along y");
+		printOption("--steps N", "number of time steps (default 100)");
+		printOption("--boundary TYPE", "periodic | dirichlet (default periodic)");
+		printOption("--dt DT", "fluid time step, the frame time when adaptive (default 0.1)");
+		printOption("--adaptive", "substep every frame at the CFL limit");
+		printOption("--cfl C", "cells the fastest cell may move per substep (default 5)");
+		printOption("--obstacle", "zero the square in the centre after every step, not the solid of fluidsim-cli");
+		printOption("--diffusion D", "density diffusion coefficient (default 0)");
+		printOption("--viscosity V", "kinematic viscosity of the velocity (default 0)");
+		printOption("--halo N", "halo width, backtraces reach N - 1 cells (default " + std::to_string(DECOMPOSITION_HALO_WIDTH) + ")");
+		printOption("--precision TYPE", "float | double | fp16 | bf16 field storage (default float)");
+		printOption("--help", "show this message");
+	}
+
+	static bool parseOptions(int argc, char ** argv, CommandLineOptions & options)
+	{
+		for (int n = 1; n < argc; n++)
+		{
+			std::string argument = argv[n];
+			bool hasValue = (n + 1) < argc;
+
+			if (argument == "--cells" && hasValue)
+			{
+				options.numberCellsX = (uint)std::strtoul(argv[++n], nullptr, 10);
+				options.numberCellsY = options.numberCellsX;
+			}
+			else if (argument == "--cells-x" && hasValue)
+			{
+				options.numberCellsX = (uint)std::strtoul(argv[++n], nullptr, 10);
+			}
+			else if (argument == "--cells-y" && hasValue)
+			{
+				options.numberCellsY = (uint)std::strtoul(argv[++n], nullptr, 10);
+			}
+			else if (argument == "--steps" && hasValue)
+			{
+				options.numberSteps = (uint)std::strtoul(argv[++n], nullptr, 10);
+			}
+			else if (argument == "--boundary" && hasValue)
+			{
+				std::string boundary = argv[++n];
+				if (boundary == "periodic") options.boundary = PERIODIC;
+				else if (boundary == "dirichlet") options.boundary = DIRICHLET;
+				else return false;
+			}
+			else if (argument == "--dt" && hasValue)
+			{
+				options.timeStep = std::strtod(argv[++n], nullptr);
+				if (!(options.timeStep > 0.0)) return false;
+			}
+			else if (argument == "--adaptive")
+			{
+				options.timeStepping = TIME_STEPPING_ADAPTIVE;
+			}
+			else if (argument == "--cfl" && hasValue)
+			{
+				options.cflNumber = std::strtod(argv[++n], nullptr);
+				if (!(options.cflNumber > 0.0)) return false;
+			}
+			else if (argument == "--obstacle")
+			{
+				options.obstacle = true;
+			}
+			else if (argument == "--diffusion" && hasValue)
+			{
+				options.diffusion = std::strtod(argv[++n], nullptr);
+				if (options.diffusion < 0.0) return false;
+			}
+			else if (argument == "--viscosity" && hasValue)
+			{
+				options.viscosity = std::strtod(argv[++n], nullptr);
+				if (options.viscosity < 0.0) return false;
+			}
+			else if (argument == "--halo" && hasValue)
+			{
+				options.haloWidth = (uint)std::strtoul(argv[++n], nullptr, 10);
+				if (options.haloWidth < 2) return false;
+			}
+			else if (argument == "--precision" && hasValue)
+			{
+				std::string precision = argv[++n];
+				if (precision == "float") options.precision = PRECISION_FLOAT;
+				else if (precision == "double") options.precision = PRECISION_DOUBLE;
+				else if (precision == "fp16") options.precision = PRECISION_FLOAT16;
+				else if (precision == "bf16") options.precision = PRECISION_BFLOAT16;
+				else return false;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static std::string precisionName(precisionType precision)
+	{
+		switch (precision)
+		{
+		case PRECISION_DOUBLE:
+			return "double";
+
+		case PRECISION_FLOAT16:
+			return "fp16 storage, float compute";
+
+		case PRECISION_BFLOAT16:
+			return "bf16 storage, float compute";
+
+		default:
+		case PRECISION_FLOAT:
+			return "float";
+		}
+	}
+
+	/// Every rank runs the same loop, only rank 0 prints. Timings are the
+	/// slowest rank's.
+	template <typename T>
+	static int runSimulation(const CommandLineOptions & options)
+	{
+		typedef typename DistributedFluid<T>::scalar scalar;
+
+		DistributedFluid<T> fluid;
+		fluid.setBoundaryType(options.boundary);
+		fluid.setTimeStep(scalar(options.timeStep));
+		fluid.setTimeStepping(options.timeStepping);
+		fluid.setCflNumber(scalar(options.cflNumber));
+		fluid.setObstacle(options.obstacle);
+		fluid.setDiffusion(scalar(options.diffusion));
+		fluid.setViscosity(scalar(options.viscosity));
+		fluid.setHaloWidth(options.haloWidth);
+
+		const Decomposition & decomposition = fluid.getDecomposition();
+		bool root = (decomposition.getRank() == 0);
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		double initStart = MPI_Wtime();
+		if (!fluid.setGridSize(options.numberCellsX, options.numberCellsY))
+		{
+			if (root) std::cout << "error: " << options.numberCellsX << " x " << options.numberCellsY << " cells cannot be split in "
+				<< decomposition.getNumRanks() << " blocks of at least " << fluid.getHaloWidth() << " cells per side" << std::endl;
+			return EXIT_FAILURE;
+		}
+		double initSeconds = decomposition.reduceMax(MPI_Wtime() - initStart);
+
+		uint numCellsX = fluid.getNumCellsX();
+		uint numCellsY = fluid.getNumCellsY();
+		if (root)
+		{
+			if (numCellsX != options.numberCellsX || numCellsY != options.numberCellsY)
+			{
+				std::cout << "warning: grid size clamped to " << numCellsX << " x " << numCellsY << std::endl;
+			}
+
+			std::cout << "cells      : " << numCellsX << " x " << numCellsY << std::endl;
+			std::cout << "ranks      : " << decomposition.getNumRanks() << " as " << decomposition.getNumBlocksX() << " x " << decomposition.getNumBlocksY()
+				<< " blocks, halo " << fluid.getHaloWidth() << std::endl;
+			std::cout << "steps      : " << options.numberSteps << std::endl;
+			std::cout << "boundary   : " << ((options.boundary == PERIODIC) ? "periodic" : "dirichlet") << std::endl;
+			std::cout << "dt         : " << fluid.getTimeIntegrationStep();
+			if (options.timeStepping == TIME_STEPPING_ADAPTIVE) std::cout << " per frame, adaptive cfl " << fluid.getCflNumber();
+			std::cout << std::endl;
+			std::cout << "precision  : " << precisionName(options.precision) << std::endl;
+			if (options.obstacle) std::cout << "obstacle   : zeroed after every step" << std::endl;
+		}
+
+		uint numberSubsteps = 0;
+		uint maxSubsteps = 0;
+		MPI_Barrier(MPI_COMM_WORLD);
+		double runStart = MPI_Wtime();
+		for (uint step = 0; step < options.numberSteps; step++)
+		{
+			fluid.update();
+			numberSubsteps += fluid.getNumSubsteps();
+			maxSubsteps = std::max(maxSubsteps, fluid.getNumSubsteps());
+		}
+		double runSeconds = decomposition.reduceMax(MPI_Wtime() - runStart);
+		double exchangeSeconds = decomposition.reduceMax(decomposition.getExchangeSeconds());
+
+		double divergence = fluid.computeDivergenceNorm();
+		bool taylorGreen = (options.boundary == PERIODIC && !options.obstacle && options.diffusion == 0.0 && options.viscosity == 0.0);
+		double taylorGreenError = taylorGreen ? fluid.computeTaylorGreenError() : 0.0;
+		if (!root) return EXIT_SUCCESS;
+
+		double stepMilliseconds = (options.numberSteps > 0) ? (1.0e3 * runSeconds / options.numberSteps) : 0.0;
+		double cellUpdates = double(numCellsX) * double(numCellsY) * double(options.numberSteps);
+		double cellsPerSecond = (runSeconds > 0.0) ? (cellUpdates / runSeconds) : 0.0;
+
+		std::cout << "init       : " << 1.0e3 * initSeconds << " ms" << std::endl;
+		std::cout << "total      : " << 1.0e3 * runSeconds << " ms" << std::endl;
+		std::cout << "exchange   : " << 1.0e3 * exchangeSeconds << " ms" << std::endl;
+		std::cout << "per step   : " << stepMilliseconds << " ms" << std::endl;
+		std::cout << "throughput : " << 1.0e-6 * cellsPerSecond << " Mcells/s" << std::endl;
+		std::cout << "speed      : [" << fluid.getMinSpeed() << ", " << fluid.getMaxSpeed() << "]" << std::endl;
+		std::cout << "density    : [" << fluid.getMinDensity() << ", " << fluid.getMaxDensity() << "]" << std::endl;
+
+		const SolverStatistics & pressureStatistics = fluid.getPressureStatistics();
+		double meanSubsteps = (options.numberSteps > 0) ? (double(numberSubsteps) / options.numberSteps) : 0.0;
+		std::cout << "substeps   : " << meanSubsteps << " per step, max " << maxSubsteps << std::endl;
+		std::cout << "p iters    : " << pressureStatistics.iterations << " per step" << std::endl;
+		std::cout << "p residual : " << pressureStatistics.residual << " (relative " << pressureStatistics.relativeResidual() << ")" << std::endl;
+		std::cout << "divergence : " << divergence << std::endl;
+		if (taylorGreen)
+		{
+			std::cout << "tg error   : " << taylorGreenError << std::endl;
+		}
+
+		return EXIT_SUCCESS;
+	}
+}
+
+/// Domain decomposed counterpart of fluidsim-cli, e.g.
+///     mpirun -np 4 fluidsim-mpi --cells 1024
+int main(int argc, char ** argv)
+{
+	using namespace FluidSimulation;
+
+	MPI_Init(&argc, &argv);
+	int rank = 0;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	CommandLineOptions options;
+	for (int n = 1; n < argc; n++)
+	{
+		if (std::strcmp(argv[n], "--help") == 0)
+		{
+			if (rank == 0) printUsage(argv[0]);
+			MPI_Finalize();
+			return EXIT_SUCCESS;
+		}
+	}
+
+	if (!parseOptions(argc, argv, options))
+	{
+		if (rank == 0) printUsage(argv[0]);
+		MPI_Finalize();
+		return EXIT_FAILURE;
+	}
+
+	int result = EXIT_SUCCESS;
+	switch (options.precision)
+	{
+	case PRECISION_DOUBLE:
+		result = runSimulation<double>(options);
+		break;
+
+	case PRECISION_FLOAT16:
+		result = runSimulation<float16>(options);
+		break;
+
+	case PRECISION_BFLOAT16:
+		result = runSimulation<bfloat16>(options);
+		break;
+
+	default:
+	case PRECISION_FLOAT:
+		result = runSimulation<float>(options);
+		break;
+	}
+
+	MPI_Finalize();
+	return result;
+}
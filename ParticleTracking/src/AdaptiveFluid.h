@@ -0,0 +1,746 @@
+#pragma once
+#include "AnalyticalSolutions.h"
+#include "BoundaryConditions.h"
+#include "Fluid.h"
+#include "Multigrid.h"
+#include "Quadtree.h"
+#include "SolverStatistics.h"
+#include "ThreadPool.h"
+#include "TimeIntegrator.h"
+#include "Utilities.h"
+#include <mutex>
+#include <vector>
+
+#define AMR_LEVELS 3
+#define AMR_REFINE_VORTICITY 0.02
+#define AMR_REFINE_DENSITY 0.1
+#define AMR_COARSEN_FRACTION 0.25
+#define AMR_REGRID_INTERVAL 4
+#define AMR_PRESSURE_CYCLES 10
+#define AMR_PRESSURE_SWEEPS 4
+#define AMR_PRESSURE_TOLERANCE 1.0e-4
+
+namespace FluidSimulation
+{
+	/// Stable fluids on a block structured quadtree. The base grid is split
+	/// in QUADTREE_BLOCK_SIZE blocks and every block may be split in four
+	/// finer ones, up to the number of levels. Blocks are refined where the
+	/// velocity jump across a cell from the vorticity, |w| h, or the density
+	/// jump, |grad d| h, exceeds its threshold, and merged back once all four
+	/// children stay below AMR_COARSEN_FRACTION of it.
+	///
+	/// The steps are those of Fluid with semi-Lagrangian advection and
+	/// implicit diffusion, run on the leaves: ghost cells come from the
+	/// leaves around, interpolated from coarser ones and averaged from finer
+	/// ones, and backtraces sample whichever leaf holds the departure point.
+	/// The pressure is solved on the composite grid of the leaves by
+	/// correction cycles: the residual of the leaves is restricted to the
+	/// base grid, solved there with multigrid, the correction is
+	/// interpolated back and smoothed by Gauss-Seidel sweeps on the leaves.
+	///
+	/// The base grid is rounded up to whole blocks. Solids and the other
+	/// solvers of Fluid are not available on the tree.
+	template <typename T>
+	class AdaptiveFluid
+		: public TimeIntegrator<Compute<T>>
+		, public BoundaryConditions
+	{
+	public:
+		typedef T storage;
+		typedef Compute<T> scalar;
+
+		AdaptiveFluid()
+		{
+			this->setTimeIncrement(scalar(TIME_INTEGRATION_INCREMENT_FLUID));
+			this->setTimeStep(scalar(TIME_INTEGRATION_INCREMENT_FLUID));
+		}
+
+		/// Same substepping as Fluid::update, the CFL limit is in cells of the
+		/// finest level in use
+		void update()
+		{
+			if (m_timeStepping == TIME_STEPPING_FIXED)
+			{
+				advance(this->m_timeStep);
+				m_numSubsteps = 1;
+				return;
+			}
+
+			scalar remaining = this->m_timeStep;
+			scalar minimumStep = remaining / scalar(MAX_SUBSTEPS);
+			m_numSubsteps = 0;
+			while (remaining > scalar(0.0))
+			{
+				scalar dt = std::max(computeStableTimeStep(), minimumStep);
+				if (dt > remaining - scalar(0.5) * minimumStep) dt = remaining;
+
+				advance(dt);
+				remaining -= dt;
+				m_numSubsteps++;
+			}
+		}
+
+		scalar computeStableTimeStep()
+		{
+			scalar maxSpeed = getMaxSpeed();
+			if (!(maxSpeed > scalar(0.0))) return std::numeric_limits<scalar>::max();
+			return m_cflNumber * spacing(finestLevel()) / maxSpeed;
+		}
+
+		void advance(scalar dt)
+		{
+			/// Diffusion from the current fields into the old ones, advection back,
+			/// the velocity with the viscosity and the density with the diffusion
+			QuadtreeField<T> * viscousNew[] = { &m_u0, &m_v0 };
+			QuadtreeField<T> * viscousOld[] = { &m_u1, &m_v1 };
+			diffuse(viscousNew, viscousOld, 2, m_viscosity, dt);
+			QuadtreeField<T> * diffusedNew[] = { &m_d0 };
+			QuadtreeField<T> * diffusedOld[] = { &m_d1 };
+			diffuse(diffusedNew, diffusedOld, 1, m_diffusion, dt);
+
+			QuadtreeField<T> * velocityNew[] = { &m_u1, &m_v1 };
+			QuadtreeField<T> * velocityOld[] = { &m_u0, &m_v0 };
+			advect(velocityNew, velocityOld, 2, m_u0, m_v0, dt);
+			project();
+
+			QuadtreeField<T> * densityNew[] = { &m_d1 };
+			QuadtreeField<T> * densityOld[] = { &m_d0 };
+			advect(densityNew, densityOld, 1, m_u1, m_v1, dt);
+
+			m_rangesValid = false;
+			if (m_regridInterval > 0 && ++m_stepsSinceRegrid >= m_regridInterval)
+			{
+				regrid();
+				m_stepsSinceRegrid = 0;
+			}
+		}
+
+		/// Base grid in cells, rounded up to whole blocks
+		void setGridSize(uint numberCellsX, uint numberCellsY)
+		{
+			m_blocksX = (std::max(numberCellsX, uint(NUM_CELLS_MIN)) + QUADTREE_BLOCK_SIZE - 1) / QUADTREE_BLOCK_SIZE;
+			m_blocksY = (std::max(numberCellsY, uint(NUM_CELLS_MIN)) + QUADTREE_BLOCK_SIZE - 1) / QUADTREE_BLOCK_SIZE;
+			init();
+		}
+
+		/// Starts from the base grid, refines where the initial condition
+		/// asks for it level by level and samples it again on the leaves
+		void init()
+		{
+			m_tree.resize(m_blocksX, m_blocksY, m_numLevels);
+			uint nx = m_blocksX * QUADTREE_BLOCK_SIZE;
+			uint ny = m_blocksY * QUADTREE_BLOCK_SIZE;
+			m_multigrid.resize(nx, ny);
+			m_baseCorrection.assign((std::size_t(nx) + 2) * (std::size_t(ny) + 2), scalar(0.0));
+			m_baseResidual.assign(m_baseCorrection.size(), scalar(0.0));
+			m_multigrid.setMaxCycles(2);
+
+			resizeFields();
+			initialCondition();
+			for (uint l = 1; l < m_tree.getNumLevels(); l++)
+			{
+				regrid();
+				initialCondition();
+			}
+			m_stepsSinceRegrid = 0;
+			m_rangesValid = false;
+		}
+
+		/// Levels of the tree including the base grid, applied at the next init
+		void setNumLevels(uint numLevels)
+		{
+			m_numLevels = std::max(uint(1), std::min(numLevels, uint(QUADTREE_MAX_LEVELS)));
+		}
+
+		uint getNumLevels() const
+		{
+			return m_tree.getNumLevels();
+		}
+
+		void setRefinementThresholds(scalar vorticity, scalar density)
+		{
+			m_refineVorticity = vorticity;
+			m_refineDensity = density;
+		}
+
+		/// Steps between two regrids, 0 keeps the tree of the initial condition
+		void setRegridInterval(uint interval)
+		{
+			m_regridInterval = interval;
+		}
+
+		void setDiffusion(scalar diffusion)
+		{
+			m_diffusion = glm::clamp(diffusion, scalar(0.0), scalar(1.0));
+		}
+
+		void setViscosity(scalar viscosity)
+		{
+			m_viscosity = glm::clamp(viscosity, scalar(0.0), scalar(1.0));
+		}
+
+		void setNumThreads(uint numThreads)
+		{
+			m_threadPool.resize(numThreads);
+		}
+
+		uint getNumThreads() const
+		{
+			return m_threadPool.getNumThreads();
+		}
+
+		void setTimeStepping(timeSteppingType timeStepping)
+		{
+			m_timeStepping = timeStepping;
+		}
+
+		void setCflNumber(scalar cflNumber)
+		{
+			m_cflNumber = cflNumber;
+		}
+
+		scalar getCflNumber() const
+		{
+			return m_cflNumber;
+		}
+
+		uint getNumSubsteps() const
+		{
+			return m_numSubsteps;
+		}
+
+		const Quadtree & getTree() const
+		{
+			return m_tree;
+		}
+
+		uint getBaseCellsX() const
+		{
+			return m_blocksX * QUADTREE_BLOCK_SIZE;
+		}
+
+		uint getBaseCellsY() const
+		{
+			return m_blocksY * QUADTREE_BLOCK_SIZE;
+		}
+
+		/// Cells of the leaves, the work of one step
+		std::size_t getNumLeafCells() const
+		{
+			return m_tree.getLeaves().size() * QUADTREE_BLOCK_SIZE * QUADTREE_BLOCK_SIZE;
+		}
+
+		/// Cells a uniform grid at the finest level in use would take
+		std::size_t getNumUniformCells() const
+		{
+			std::size_t scale = std::size_t(1) << finestLevel();
+			return std::size_t(getBaseCellsX()) * getBaseCellsY() * scale * scale;
+		}
+
+		/// Cycles and residual of the last pressure solve, the residual in
+		/// the units of the pressure equation of Fluid on every level
+		const SolverStatistics & getPressureStatistics() const
+		{
+			return m_pressureStatistics;
+		}
+
+		scalar getMaxSpeed()
+		{
+			updateRanges();
+			return m_speedRange.maximum;
+		}
+
+		scalar getMinSpeed()
+		{
+			updateRanges();
+			return m_speedRange.minimum;
+		}
+
+		scalar getMaxDensity()
+		{
+			updateRanges();
+			return m_densityRange.maximum;
+		}
+
+		scalar getMinDensity()
+		{
+			updateRanges();
+			return m_densityRange.minimum;
+		}
+
+		/// Rms of the central difference divergence over the leaf cells
+		double computeDivergenceNorm()
+		{
+			fillGhostCells(m_u1);
+			fillGhostCells(m_v1);
+			double sumSquares = 0.0;
+			std::size_t numCells = 0;
+			for (int leaf : m_tree.getLeaves())
+			{
+				const T * u = m_u1.block(leaf);
+				const T * v = m_v1.block(leaf);
+				scalar invSpacing = scalar(1.0) / spacing(m_tree.getNode(leaf).level);
+				forEachCell([&](std::size_t cter)
+				{
+					scalar divergence = scalar(0.5) * invSpacing * (scalar(u[cter + 1]) - scalar(u[cter - 1]) + scalar(v[cter + QUADTREE_BLOCK_STRIDE]) - scalar(v[cter - QUADTREE_BLOCK_STRIDE]));
+					sumSquares += double(divergence) * double(divergence);
+					numCells++;
+				});
+			}
+			return std::sqrt(sumSquares / double(std::max(numCells, std::size_t(1))));
+		}
+
+	protected:
+		/// Cell size of a level, the shorter side of the base grid has unit length
+		scalar spacing(uint level) const
+		{
+			return scalar(1.0) / (scalar(std::min(getBaseCellsX(), getBaseCellsY())) * scalar(1u << level));
+		}
+
+		uint finestLevel() const
+		{
+			const std::vector<int> & leaves = m_tree.getLeaves();
+			return leaves.empty() ? 0 : m_tree.getNode(leaves.back()).level;
+		}
+
+		template <typename Function>
+		static void forEachCell(const Function & function)
+		{
+			for (uint j = 1; j <= QUADTREE_BLOCK_SIZE; j++)
+			{
+				for (uint i = 1; i <= QUADTREE_BLOCK_SIZE; i++)
+				{
+					function(std::size_t(i) + std::size_t(j) * QUADTREE_BLOCK_STRIDE);
+				}
+			}
+		}
+
+		/// The leaves are split across the threads
+		template <typename Function>
+		void forEachLeaf(const Function & function)
+		{
+			const std::vector<int> & leaves = m_tree.getLeaves();
+			m_threadPool.parallelFor(0, uint(leaves.size()), [&](uint begin, uint end)
+			{
+				for (uint n = begin; n < end; n++) function(leaves[n]);
+			});
+		}
+
+		template <typename S>
+		void fillGhostCells(QuadtreeField<S> & field)
+		{
+			forEachLeaf([&](int leaf) { fillQuadtreeGhostCells(m_tree, field, leaf, m_boundary); });
+		}
+
+		void resizeFields()
+		{
+			std::size_t capacity = m_tree.getCapacity();
+			QuadtreeField<T> * fields[] = { &m_u0, &m_v0, &m_d0, &m_u1, &m_v1, &m_d1 };
+			for (QuadtreeField<T> * field : fields) field->resize(capacity);
+			m_pressure.resize(capacity);
+			m_divergence.resize(capacity);
+			m_residual.resize(capacity);
+		}
+
+		/// Taylor-Green vortex at the centres of the leaf cells
+		void initialCondition()
+		{
+			forEachLeaf([this](int leaf)
+			{
+				const QuadtreeNode & node = m_tree.getNode(leaf);
+				scalar h = spacing(node.level);
+				for (uint j = 1; j <= QUADTREE_BLOCK_SIZE; j++)
+				{
+					scalar y = (node.by * QUADTREE_BLOCK_SIZE + j - scalar(0.5)) * h;
+					for (uint i = 1; i <= QUADTREE_BLOCK_SIZE; i++)
+					{
+						scalar x = (node.bx * QUADTREE_BLOCK_SIZE + i - scalar(0.5)) * h;
+						std::size_t cter = std::size_t(i) + std::size_t(j) * QUADTREE_BLOCK_STRIDE;
+						m_u1.block(leaf)[cter] = T(TaylorGreenVortexVelocityU(scalar(0.0), x, y));
+						m_v1.block(leaf)[cter] = T(TaylorGreenVortexVelocityV(scalar(0.0), x, y));
+						m_d1.block(leaf)[cter] = T(TaylorGreenVortexDensity(scalar(0.0), x, y));
+						m_pressure.block(leaf)[cter] = scalar(0.0);
+					}
+				}
+			});
+			m_rangesValid = false;
+		}
+
+		/// Implicit diffusion with the coefficient coefficient dt / h^2 of every
+		/// level, Gauss-Seidel inside the leaves and ghost cells refreshed
+		/// between the sweeps
+		void diffuse(QuadtreeField<T> * const * xNew, QuadtreeField<T> * const * xOld, uint numFields, scalar coefficient, scalar dt)
+		{
+			forEachLeaf([&](int leaf)
+			{
+				for (uint f = 0; f < numFields; f++)
+				{
+					std::copy(xOld[f]->block(leaf), xOld[f]->block(leaf) + QUADTREE_BLOCK_VALUES, xNew[f]->block(leaf));
+				}
+			});
+			if (!(coefficient > scalar(0.0))) return;
+
+			uint relaxationSteps = 20;
+			for (uint s = 0; s < relaxationSteps; s++)
+			{
+				for (uint f = 0; f < numFields; f++) fillGhostCells(*xNew[f]);
+				forEachLeaf([&](int leaf)
+				{
+					scalar h = spacing(m_tree.getNode(leaf).level);
+					scalar a = coefficient * dt / (h * h);
+					scalar invc = scalar(1.0) / (scalar(1.0) + scalar(4.0) * a);
+					for (uint f = 0; f < numFields; f++)
+					{
+						T * x = xNew[f]->block(leaf);
+						const T * b = xOld[f]->block(leaf);
+						forEachCell([&](std::size_t cter)
+						{
+							scalar neighbours = scalar(x[cter - 1]) + scalar(x[cter + 1]) + scalar(x[cter - QUADTREE_BLOCK_STRIDE]) + scalar(x[cter + QUADTREE_BLOCK_STRIDE]);
+							x[cter] = T((scalar(b[cter]) + a * neighbours) * invc);
+						});
+					}
+				});
+			}
+			for (uint f = 0; f < numFields; f++) fillGhostCells(*xNew[f]);
+		}
+
+		/// Semi-Lagrangian with Euler backtraces, the departure point of a
+		/// cell is located once and sampled for all the fields
+		void advect(QuadtreeField<T> * const * xNew, QuadtreeField<T> * const * xOld, uint numFields, QuadtreeField<T> & u, QuadtreeField<T> & v, scalar dt)
+		{
+			for (uint f = 0; f < numFields; f++) fillGhostCells(*xOld[f]);
+
+			double width = getBaseCellsX();
+			double height = getBaseCellsY();
+			forEachLeaf([&](int leaf)
+			{
+				const QuadtreeNode & node = m_tree.getNode(leaf);
+				double scale = 1.0 / double(1u << node.level);
+
+				/// Displacement in cells of level 0
+				double dt0 = double(dt) / double(spacing(0));
+				for (uint j = 1; j <= QUADTREE_BLOCK_SIZE; j++)
+				{
+					for (uint i = 1; i <= QUADTREE_BLOCK_SIZE; i++)
+					{
+						std::size_t cter = std::size_t(i) + std::size_t(j) * QUADTREE_BLOCK_STRIDE;
+						double x = (node.bx * QUADTREE_BLOCK_SIZE + i - 0.5) * scale - dt0 * double(scalar(u.block(leaf)[cter]));
+						double y = (node.by * QUADTREE_BLOCK_SIZE + j - 0.5) * scale - dt0 * double(scalar(v.block(leaf)[cter]));
+						if (m_boundary == PERIODIC)
+						{
+							x -= width * std::floor(x / width);
+							y -= height * std::floor(y / height);
+						}
+						else
+						{
+							x = std::min(std::max(x, 0.0), width);
+							y = std::min(std::max(y, 0.0), height);
+						}
+
+						int source = m_tree.locate(x, y);
+						for (uint f = 0; f < numFields; f++)
+						{
+							xNew[f]->block(leaf)[cter] = T(sampleQuadtreeLeaf(m_tree, *xOld[f], source, x, y));
+						}
+					}
+				}
+			});
+		}
+
+		/// Removes the divergence of the velocity of the leaves, the
+		/// stencils of every leaf use the spacing of its level
+		void project()
+		{
+			fillGhostCells(m_u1);
+			fillGhostCells(m_v1);
+			forEachLeaf([this](int leaf)
+			{
+				const T * u = m_u1.block(leaf);
+				const T * v = m_v1.block(leaf);
+				scalar * divergence = m_divergence.block(leaf);
+				scalar * pressure = m_pressure.block(leaf);
+				scalar invSpacing = scalar(1.0) / spacing(m_tree.getNode(leaf).level);
+				forEachCell([&](std::size_t cter)
+				{
+					divergence[cter] = scalar(0.5) * invSpacing * (scalar(u[cter + 1]) - scalar(u[cter - 1]) + scalar(v[cter + QUADTREE_BLOCK_STRIDE]) - scalar(v[cter - QUADTREE_BLOCK_STRIDE]));
+					pressure[cter] = scalar(0.0);
+				});
+			});
+
+			solvePressure();
+
+			forEachLeaf([this](int leaf)
+			{
+				T * u = m_u1.block(leaf);
+				T * v = m_v1.block(leaf);
+				const scalar * pressure = m_pressure.block(leaf);
+				scalar invSpacing = scalar(1.0) / spacing(m_tree.getNode(leaf).level);
+				forEachCell([&](std::size_t cter)
+				{
+					u[cter] = T(scalar(u[cter]) - scalar(0.5) * invSpacing * (pressure[cter + 1] - pressure[cter - 1]));
+					v[cter] = T(scalar(v[cter]) - scalar(0.5) * invSpacing * (pressure[cter + QUADTREE_BLOCK_STRIDE] - pressure[cter - QUADTREE_BLOCK_STRIDE]));
+				});
+			});
+			m_rangesValid = false;
+		}
+
+		/// Laplacian of the pressure equals the divergence on the composite
+		/// grid. Every cycle restricts the residual to the base grid, solves
+		/// for the correction with multigrid, interpolates it to the leaves
+		/// and smooths with Gauss-Seidel sweeps on the leaves.
+		void solvePressure()
+		{
+			fillGhostCells(m_pressure);
+			m_pressureStatistics = SolverStatistics();
+			m_pressureStatistics.initialResidual = computePressureResidual();
+			m_pressureStatistics.residual = m_pressureStatistics.initialResidual;
+
+			uint nx = getBaseCellsX();
+			uint ny = getBaseCellsY();
+			std::size_t stride = std::size_t(nx) + 2;
+			scalar h0 = spacing(0);
+			while (m_pressureStatistics.iterations < AMR_PRESSURE_CYCLES &&
+				m_pressureStatistics.residual > AMR_PRESSURE_TOLERANCE * m_pressureStatistics.initialResidual)
+			{
+				/// Base grid correction, the multigrid equation carries h^2
+				m_threadPool.parallelFor(0, ny, [&](uint jBegin, uint jEnd)
+				{
+					for (uint j = jBegin; j < jEnd; j++)
+					{
+						for (uint i = 0; i < nx; i++)
+						{
+							m_baseResidual[(i + 1) + (j + 1) * stride] = -h0 * h0 * quadtreeCellValue(m_tree, m_residual, 0, int(i), int(j), m_boundary);
+						}
+					}
+				});
+				std::fill(m_baseCorrection.begin(), m_baseCorrection.end(), scalar(0.0));
+				m_multigrid.solve(m_baseCorrection.data(), m_baseResidual.data(), m_boundary);
+				FluidSimulation::fillGhostCells(m_baseCorrection.data(), nx, ny, m_boundary);
+
+				forEachLeaf([&](int leaf)
+				{
+					const QuadtreeNode & node = m_tree.getNode(leaf);
+					scalar * pressure = m_pressure.block(leaf);
+					double scale = 1.0 / double(1u << node.level);
+					for (uint j = 1; j <= QUADTREE_BLOCK_SIZE; j++)
+					{
+						double py = (node.by * QUADTREE_BLOCK_SIZE + j - 0.5) * scale + 0.5;
+						for (uint i = 1; i <= QUADTREE_BLOCK_SIZE; i++)
+						{
+							double px = (node.bx * QUADTREE_BLOCK_SIZE + i - 0.5) * scale + 0.5;
+							pressure[i + j * QUADTREE_BLOCK_STRIDE] += sampleLinear(m_baseCorrection.data(), stride, scalar(px), scalar(py));
+						}
+					}
+				});
+
+				for (uint s = 0; s < AMR_PRESSURE_SWEEPS; s++)
+				{
+					fillGhostCells(m_pressure);
+					forEachLeaf([this](int leaf)
+					{
+						scalar h = spacing(m_tree.getNode(leaf).level);
+						scalar * x = m_pressure.block(leaf);
+						const scalar * b = m_divergence.block(leaf);
+						forEachCell([&](std::size_t cter)
+						{
+							x[cter] = scalar(0.25) * (x[cter - 1] + x[cter + 1] + x[cter - QUADTREE_BLOCK_STRIDE] + x[cter + QUADTREE_BLOCK_STRIDE] - h * h * b[cter]);
+						});
+					});
+				}
+
+				fillGhostCells(m_pressure);
+				m_pressureStatistics.residual = computePressureResidual();
+				m_pressureStatistics.iterations++;
+			}
+			m_pressureStatistics.converged = (m_pressureStatistics.residual <= AMR_PRESSURE_TOLERANCE * m_pressureStatistics.initialResidual);
+		}
+
+		/// Residual of the leaves into m_residual, returns its rms scaled by
+		/// h^2 of every level. The ghost cells of the pressure have to be up
+		/// to date.
+		double computePressureResidual()
+		{
+			std::mutex mutex;
+			double sumSquares = 0.0;
+			const std::vector<int> & leaves = m_tree.getLeaves();
+			m_threadPool.parallelFor(0, uint(leaves.size()), [&](uint begin, uint end)
+			{
+				double partial = 0.0;
+				for (uint n = begin; n < end; n++)
+				{
+					int leaf = leaves[n];
+					scalar h = spacing(m_tree.getNode(leaf).level);
+					scalar invSpacing2 = scalar(1.0) / (h * h);
+					const scalar * x = m_pressure.block(leaf);
+					const scalar * b = m_divergence.block(leaf);
+					scalar * r = m_residual.block(leaf);
+					forEachCell([&](std::size_t cter)
+					{
+						scalar laplacian = (x[cter - 1] + x[cter + 1] + x[cter - QUADTREE_BLOCK_STRIDE] + x[cter + QUADTREE_BLOCK_STRIDE] - scalar(4.0) * x[cter]) * invSpacing2;
+						r[cter] = b[cter] - laplacian;
+						double scaled = double(h * h * r[cter]);
+						partial += scaled * scaled;
+					});
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				sumSquares += partial;
+			});
+			return std::sqrt(sumSquares / double(std::max(getNumLeafCells(), std::size_t(1))));
+		}
+
+		/// Largest velocity and density jump across a cell of a leaf, over
+		/// their thresholds. The ghost cells have to be up to date.
+		scalar refinementIndicator(int leaf) const
+		{
+			const T * u = m_u1.block(leaf);
+			const T * v = m_v1.block(leaf);
+			const T * d = m_d1.block(leaf);
+			scalar indicator = scalar(0.0);
+			forEachCell([&](std::size_t cter)
+			{
+				scalar vorticity = scalar(0.5) * std::abs(scalar(v[cter + 1]) - scalar(v[cter - 1]) - scalar(u[cter + QUADTREE_BLOCK_STRIDE]) + scalar(u[cter - QUADTREE_BLOCK_STRIDE]));
+				scalar gx = scalar(d[cter + 1]) - scalar(d[cter - 1]);
+				scalar gy = scalar(d[cter + QUADTREE_BLOCK_STRIDE]) - scalar(d[cter - QUADTREE_BLOCK_STRIDE]);
+				scalar gradient = scalar(0.5) * std::sqrt(gx * gx + gy * gy);
+				indicator = std::max(indicator, std::max(vorticity / m_refineVorticity, gradient / m_refineDensity));
+			});
+			return indicator;
+		}
+
+		/// Refines the leaves above the thresholds by one level, keeps the
+		/// tree balanced, then merges the blocks whose children all fell below
+		/// AMR_COARSEN_FRACTION of them. New leaves take limited linear
+		/// interpolations of their parent, merged blocks the mean of their
+		/// children.
+		void regrid()
+		{
+			QuadtreeField<T> * fields[] = { &m_u1, &m_v1, &m_d1 };
+			for (QuadtreeField<T> * field : fields) fillGhostCells(*field);
+
+			const std::vector<int> leaves = m_tree.getLeaves();
+			std::vector<scalar> indicator(m_tree.getCapacity(), std::numeric_limits<scalar>::max());
+			forEachLeaf([&](int leaf) { indicator[leaf] = refinementIndicator(leaf); });
+
+			std::vector<int> parents;
+			auto refine = [&](int leaf)
+			{
+				if (!m_tree.refine(leaf)) return;
+				resizeFields();
+				for (QuadtreeField<T> * field : fields) prolongQuadtreeBlock(m_tree, *field, leaf);
+				parents.push_back(leaf);
+			};
+
+			for (int leaf : leaves)
+			{
+				if (indicator[leaf] > scalar(1.0)) refine(leaf);
+			}
+
+			/// Balance, new leaves may ask coarser ones to refine in turn. Only
+			/// leaves older than the regrid are refined here, their ghost cells
+			/// are still valid.
+			for (bool balanced = false; !balanced; )
+			{
+				balanced = true;
+				m_tree.updateLeaves();
+				for (int leaf : m_tree.getLeaves())
+				{
+					int unbalanced = m_tree.findUnbalanced(leaf, m_boundary);
+					if (unbalanced < 0 || !m_tree.getNode(unbalanced).isLeaf()) continue;
+					refine(unbalanced);
+					balanced = false;
+				}
+			}
+
+			/// Coarsening, blocks refined above stay
+			std::vector<uchar> refined(m_tree.getCapacity(), 0);
+			for (int parent : parents) refined[parent] = 1;
+			for (uint level = m_tree.getNumLevels() - 1; level-- > 0; )
+			{
+				for (std::size_t block = 0; block < m_tree.getCapacity(); block++)
+				{
+					const QuadtreeNode & node = m_tree.getNode(int(block));
+					if (!node.used || node.level != level || refined[block]) continue;
+					if (!m_tree.canCoarsen(int(block), m_boundary)) continue;
+
+					bool quiet = true;
+					for (uint c = 0; c < 4; c++)
+					{
+						int child = node.children[c];
+						quiet = quiet && (std::size_t(child) < indicator.size()) && (indicator[child] < scalar(AMR_COARSEN_FRACTION));
+					}
+					if (!quiet) continue;
+
+					for (QuadtreeField<T> * field : fields) restrictQuadtreeBlock(m_tree, *field, int(block));
+					m_tree.coarsen(int(block));
+				}
+			}
+
+			m_tree.updateLeaves();
+			m_rangesValid = false;
+		}
+
+		void updateRanges()
+		{
+			if (m_rangesValid) return;
+			m_speedRange = ValueRange<scalar>();
+			m_densityRange = ValueRange<scalar>();
+			for (int leaf : m_tree.getLeaves())
+			{
+				const T * u = m_u1.block(leaf);
+				const T * v = m_v1.block(leaf);
+				const T * d = m_d1.block(leaf);
+				forEachCell([&](std::size_t cter)
+				{
+					scalar uc = scalar(u[cter]);
+					scalar vc = scalar(v[cter]);
+					m_speedRange.include(std::sqrt(uc * uc + vc * vc));
+					m_densityRange.include(scalar(d[cter]));
+				});
+			}
+			m_rangesValid = true;
+		}
+
+	private:
+		uint m_blocksX = 4;
+		uint m_blocksY = 4;
+		uint m_numLevels = AMR_LEVELS;
+		Quadtree m_tree;
+
+		/// Old and new step on every block
+		QuadtreeField<T> m_u0, m_v0, m_d0;
+		QuadtreeField<T> m_u1, m_v1, m_d1;
+
+		/// Pressure solve, on the leaves and on the base grid
+		QuadtreeField<scalar> m_pressure, m_divergence, m_residual;
+		std::vector<scalar> m_baseCorrection;
+		std::vector<scalar> m_baseResidual;
+		SolverStatistics m_pressureStatistics;
+
+		/// Refinement
+		scalar m_refineVorticity = scalar(AMR_REFINE_VORTICITY);
+		scalar m_refineDensity = scalar(AMR_REFINE_DENSITY);
+		uint m_regridInterval = AMR_REGRID_INTERVAL;
+		uint m_stepsSinceRegrid = 0;
+
+		/// Parameters
+		scalar m_diffusion = scalar(0.0);
+		scalar m_viscosity = scalar(0.0);
+		timeSteppingType m_timeStepping = TIME_STEPPING_FIXED;
+		scalar m_cflNumber = scalar(CFL_NUMBER);
+		uint m_numSubsteps = 0;
+
+		/// Information from the fluid
+		ValueRange<scalar> m_speedRange;
+		ValueRange<scalar> m_densityRange;
+		bool m_rangesValid = false;
+
+		ThreadPool m_threadPool;
+		Multigrid<scalar> m_multigrid = Multigrid<scalar>(m_threadPool);
+	};
+
+	extern template class AdaptiveFluid<float>;
+	extern template class AdaptiveFluid<double>;
+	extern template class AdaptiveFluid<float16>;
+	extern template class AdaptiveFluid<bfloat16>;
+}
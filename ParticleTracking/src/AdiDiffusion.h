@@ -0,0 +1,226 @@
+#pragma once
+#include "BoundaryConditions.h"
+#include "Precision.h"
+#include "SolverStatistics.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <vector>
+
+#define ADI_ROW_BATCH 8
+#define ADI_COLUMN_BLOCK 64
+
+namespace FluidSimulation
+{
+	/// Factorization of the line operator
+	///     (1 + 2 a) x(i) - a (x(i - 1) + x(i + 1)) = b(i),  i = 1 ... n
+	/// with the ghost cells of Fluid, x(0) = -x(1) and x(n + 1) = -x(n) with
+	/// DIRICHLET walls and a cyclic system with PERIODIC ones. Every line of
+	/// a grid has the same coefficients, so the Thomas elimination is
+	/// factored once and the lines only run the substitutions. The cyclic
+	/// system is solved with the Sherman-Morrison correction, its correction
+	/// vector is shared by all the lines too.
+	template <typename T>
+	struct TridiagonalLine
+	{
+		uint n = 0;
+		T a = T(0.0);
+
+		/// 1 / (d(i) + a c'(i - 1)) and c'(i) of the elimination
+		std::vector<T> inverseDiagonal;
+		std::vector<T> upper;
+
+		/// Periodic lines, x -= (x(1) + ratio x(n)) scale z
+		bool cyclic = false;
+		std::vector<T> correction;
+		T ratio = T(0.0);
+		T scale = T(0.0);
+
+		void factor(uint size, T coefficient, boundaryType boundary)
+		{
+			n = size;
+			a = coefficient;
+			cyclic = (boundary == PERIODIC);
+
+			std::vector<T> diagonal(n, T(1.0) + T(2.0) * a);
+			T gamma = -diagonal[0];
+			if (cyclic)
+			{
+				/// The corners -a are moved into u v^T with u = (gamma, 0, ..., -a)
+				/// and v = (1, 0, ..., -a / gamma)
+				diagonal[0] -= gamma;
+				diagonal[n - 1] -= a * a / gamma;
+			}
+			else
+			{
+				diagonal[0] += a;
+				diagonal[n - 1] += a;
+			}
+
+			inverseDiagonal.resize(n);
+			upper.resize(n);
+			for (uint i = 0; i < n; i++)
+			{
+				T previous = (i > 0) ? upper[i - 1] : T(0.0);
+				inverseDiagonal[i] = T(1.0) / (diagonal[i] + a * previous);
+				upper[i] = -a * inverseDiagonal[i];
+			}
+
+			if (!cyclic) return;
+			correction.assign(n, T(0.0));
+			correction[0] = gamma;
+			correction[n - 1] = -a;
+			substitute(correction.data(), 1);
+			ratio = -a / gamma;
+			scale = T(1.0) / (T(1.0) + correction[0] + ratio * correction[n - 1]);
+		}
+
+		/// Solves R interleaved lines in place, y[i * R + r] is cell i of line r
+		void substitute(T * y, uint R) const
+		{
+			for (uint r = 0; r < R; r++) y[r] *= inverseDiagonal[0];
+			for (uint i = 1; i < n; i++)
+			{
+				T m = inverseDiagonal[i];
+				for (uint r = 0; r < R; r++)
+				{
+					y[i * R + r] = (y[i * R + r] + a * y[(i - 1) * R + r]) * m;
+				}
+			}
+			for (uint i = n - 1; i-- > 0;)
+			{
+				T c = upper[i];
+				for (uint r = 0; r < R; r++)
+				{
+					y[i * R + r] -= c * y[(i + 1) * R + r];
+				}
+			}
+		}
+
+		/// Cyclic correction of R interleaved lines
+		void correct(T * y, uint R) const
+		{
+			if (!cyclic) return;
+			T factor[ADI_COLUMN_BLOCK];
+			for (uint r = 0; r < R; r++)
+			{
+				factor[r] = (y[r] + ratio * y[(n - 1) * R + r]) * scale;
+			}
+			for (uint i = 0; i < n; i++)
+			{
+				T z = correction[i];
+				for (uint r = 0; r < R; r++)
+				{
+					y[i * R + r] -= factor[r] * z;
+				}
+			}
+		}
+	};
+
+	/// Rows j ... j + R - 1 of a field, solved together. The R recurrences
+	/// are interleaved in the scratch so every step of the substitutions is
+	/// an R wide vector operation.
+	template <uint R, typename T>
+	inline void solveRows(T * x, const T * b, uint nx, uint j, const TridiagonalLine<Compute<T>> & line, Compute<T> * y)
+	{
+		typedef Compute<T> C;
+		std::size_t stride = std::size_t(nx) + 2;
+		for (uint r = 0; r < R; r++)
+		{
+			const T * row = b + (std::size_t(j) + r) * stride + 1;
+			for (uint i = 0; i < nx; i++) y[i * R + r] = C(row[i]);
+		}
+
+		line.substitute(y, R);
+		line.correct(y, R);
+
+		for (uint r = 0; r < R; r++)
+		{
+			T * row = x + (std::size_t(j) + r) * stride + 1;
+			for (uint i = 0; i < nx; i++) row[i] = T(y[i * R + r]);
+		}
+	}
+
+	/// Columns i ... i + width - 1 of a field, solved in place. Rows are
+	/// contiguous in memory, the columns of the block are the vector lanes.
+	template <typename T>
+	inline void solveColumns(T * x, uint nx, uint ny, uint i, uint width, const TridiagonalLine<Compute<T>> & line, Compute<T> * y)
+	{
+		typedef Compute<T> C;
+		std::size_t stride = std::size_t(nx) + 2;
+		for (uint j = 0; j < ny; j++)
+		{
+			const T * row = x + (std::size_t(j) + 1) * stride + i;
+			for (uint k = 0; k < width; k++) y[j * width + k] = C(row[k]);
+		}
+
+		line.substitute(y, width);
+		line.correct(y, width);
+
+		for (uint j = 0; j < ny; j++)
+		{
+			T * row = x + (std::size_t(j) + 1) * stride + i;
+			for (uint k = 0; k < width; k++) row[k] = T(y[j * width + k]);
+		}
+	}
+
+	/// Alternating direction implicit diffusion of
+	///     (1 + 4 a) x(i, j) - a (x(i - 1, j) + x(i + 1, j) + x(i, j - 1) + x(i, j + 1)) = b(i, j)
+	/// factored as (1 - a Dxx) (1 - a Dyy) x = b: a tridiagonal solve along
+	/// every row, then along every column. The splitting adds a^2 Dxx Dyy to
+	/// the operator and is stable for any a. Two passes over the fields
+	/// replace the Gauss-Seidel sweeps, reported as one iteration.
+	template <boundaryType B, typename T>
+	inline SolverStatistics adiDiffuse(T * const * x, const T * const * b, uint numFields, uint nx, uint ny, Compute<T> a, ThreadPool & threadPool)
+	{
+		typedef Compute<T> C;
+		SolverStatistics statistics;
+		statistics.iterations = 1;
+
+		std::size_t size = (std::size_t(nx) + 2) * (std::size_t(ny) + 2);
+		if (!(a > C(0.0)))
+		{
+			for (uint f = 0; f < numFields; f++) std::copy(b[f], b[f] + size, x[f]);
+			return statistics;
+		}
+
+		TridiagonalLine<C> rows;
+		TridiagonalLine<C> columns;
+		rows.factor(nx, a, B);
+		columns.factor(ny, a, B);
+
+		threadPool.parallelFor(1, ny + 1, [&](uint jBegin, uint jEnd)
+		{
+			std::vector<C> scratch(std::size_t(nx) * ADI_ROW_BATCH);
+			for (uint f = 0; f < numFields; f++)
+			{
+				uint j = jBegin;
+				for (; j + ADI_ROW_BATCH <= jEnd; j += ADI_ROW_BATCH)
+				{
+					solveRows<ADI_ROW_BATCH>(x[f], b[f], nx, j, rows, scratch.data());
+				}
+				for (; j < jEnd; j++)
+				{
+					solveRows<1>(x[f], b[f], nx, j, rows, scratch.data());
+				}
+			}
+		});
+
+		threadPool.parallelFor(1, nx + 1, [&](uint iBegin, uint iEnd)
+		{
+			std::vector<C> scratch(std::size_t(ny) * ADI_COLUMN_BLOCK);
+			for (uint f = 0; f < numFields; f++)
+			{
+				for (uint i = iBegin; i < iEnd; i += ADI_COLUMN_BLOCK)
+				{
+					solveColumns(x[f], nx, ny, i, std::min(iEnd - i, uint(ADI_COLUMN_BLOCK)), columns, scratch.data());
+				}
+			}
+		});
+
+		for (uint f = 0; f < numFields; f++)
+		{
+			fillGhostCells<B>(x[f], nx, ny);
+		}
+		return statistics;
+	}
+}
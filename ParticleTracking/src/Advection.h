@@ -0,0 +1,478 @@
+#pragma once
+#include "BoundaryConditions.h"
+#include "Precision.h"
+#include "SolidMask.h"
+#include <algorithm>
+
+#define ADVECTION_MAX_FIELDS 8
+
+namespace FluidSimulation
+{
+	enum advectionKernelType
+	{
+		ADVECTION_SCALAR = 0,
+		ADVECTION_AVX2,
+		ADVECTION_AVX512
+	};
+
+	enum backtraceType
+	{
+		BACKTRACE_EULER = 0,
+		BACKTRACE_RK2,
+		BACKTRACE_RK3
+	};
+
+	enum interpolationType
+	{
+		INTERPOLATION_LINEAR = 0,
+		INTERPOLATION_CUBIC
+	};
+
+	/// Semi-Lagrangian advection of up to ADVECTION_MAX_FIELDS fields sharing
+	/// one velocity, the backtrace, the boundary treatment and the bilinear
+	/// weights are computed once per cell for all the fields
+	template <typename T>
+	struct AdvectionParameters
+	{
+		uint numberCellsX = 0;
+		uint numberCellsY = 0;
+		boundaryType boundary = PERIODIC;
+		Compute<T> dt0 = Compute<T>(0.0);
+		const T * u = nullptr;
+		const T * v = nullptr;
+
+		uint numFields = 0;
+		T * xNew[ADVECTION_MAX_FIELDS];
+		const T * xOld[ADVECTION_MAX_FIELDS];
+
+		/// Higher order schemes, anything but Euler / linear runs on the
+		/// general scalar kernel
+		backtraceType backtrace = BACKTRACE_EULER;
+		interpolationType interpolation = INTERPOLATION_LINEAR;
+
+		/// When set, the range of the source values around every backtrace
+		/// is stored for the limiters of MacCormack / BFECC
+		bool recordRange = false;
+		T * minimum[ADVECTION_MAX_FIELDS];
+		T * maximum[ADVECTION_MAX_FIELDS];
+
+		/// When set only the cells of the spans are written, the fluid cells
+		/// or the active tiles
+		const SpanList * spans = nullptr;
+	};
+
+	/// Backtraced positions leaving the domain jump to the opposite side for
+	/// PERIODIC walls and stay on the wall for DIRICHLET ones
+	template <boundaryType B, typename C>
+	inline C advectionBoundaryCell(C position, uint numberCells)
+	{
+		C lowLimit = C(0.5);
+		C highLimit = numberCells + C(0.5);
+		if (position < lowLimit)
+		{
+			position = (B == PERIODIC) ? highLimit : lowLimit;
+		}
+		if (position > highLimit)
+		{
+			position = (B == PERIODIC) ? lowLimit : highLimit;
+		}
+		return position;
+	}
+
+	/// Cells iBegin ... iEnd - 1 of row j, parameters.boundary has to be B
+	template <boundaryType B, typename T>
+	inline void advectRowScalar(const AdvectionParameters<T> & parameters, uint j, uint iBegin, uint iEnd)
+	{
+		typedef Compute<T> C;
+		uint nx = parameters.numberCellsX;
+		uint ny = parameters.numberCellsY;
+		std::size_t stride = std::size_t(nx) + 2;
+		for (uint i = iBegin; i < iEnd; i++)
+		{
+			std::size_t cter = i + j * stride;
+			C x = i - parameters.dt0 * C(parameters.u[cter]);
+			C y = j - parameters.dt0 * C(parameters.v[cter]);
+			x = advectionBoundaryCell<B>(x, nx);
+			y = advectionBoundaryCell<B>(y, ny);
+
+			uint i0 = (uint)x;
+			uint j0 = (uint)y;
+
+			C s1 = x - i0;
+			C s0 = 1 - s1;
+			C t1 = y - j0;
+			C t0 = 1 - t1;
+
+			std::size_t index00 = i0 + j0 * stride;
+			for (uint f = 0; f < parameters.numFields; f++)
+			{
+				const T * xOld = parameters.xOld[f];
+				parameters.xNew[f][cter] = T(
+					s0 * (t0 * C(xOld[index00]) + t1 * C(xOld[index00 + stride])) +
+					s1 * (t0 * C(xOld[index00 + 1]) + t1 * C(xOld[index00 + stride + 1])));
+			}
+		}
+	}
+
+	/// Bilinear sample at a position in cell units already inside the domain
+	template <typename C, typename T>
+	inline C sampleLinear(const T * x, std::size_t stride, C px, C py)
+	{
+		uint i0 = (uint)px;
+		uint j0 = (uint)py;
+		C s1 = px - i0;
+		C t1 = py - j0;
+
+		std::size_t index00 = i0 + j0 * stride;
+		return (1 - s1) * ((1 - t1) * C(x[index00]) + t1 * C(x[index00 + stride])) +
+			s1 * ((1 - t1) * C(x[index00 + 1]) + t1 * C(x[index00 + stride + 1]));
+	}
+
+	/// Cubic Hermite between f1 and f2 with central slopes, a slope is zeroed
+	/// when it disagrees in sign with f2 - f1 (Fedkiw et al. 2001) and the
+	/// result is clamped to [f1, f2] so no new extrema appear
+	template <typename C>
+	inline C monotoneCubic(C f0, C f1, C f2, C f3, C t)
+	{
+		C delta = f2 - f1;
+		C d1 = C(0.5) * (f2 - f0);
+		C d2 = C(0.5) * (f3 - f1);
+		if (d1 * delta <= C(0.0)) d1 = C(0.0);
+		if (d2 * delta <= C(0.0)) d2 = C(0.0);
+
+		C a3 = d1 + d2 - C(2.0) * delta;
+		C a2 = C(3.0) * delta - C(2.0) * d1 - d2;
+		C value = ((a3 * t + a2) * t + d1) * t + f1;
+		return std::min(std::max(value, std::min(f1, f2)), std::max(f1, f2));
+	}
+
+	/// Bicubic over the 4 x 4 nodes around the cell, the stencil is clamped
+	/// to the ghost ring next to the walls
+	template <typename C, typename T>
+	inline C sampleCubic(const T * x, uint nx, uint ny, std::size_t stride, uint i0, uint j0, C s1, C t1)
+	{
+		uint columns[4] = { (i0 > 0) ? i0 - 1 : 0, i0, i0 + 1, std::min(i0 + 2, nx + 1) };
+		uint rows[4] = { (j0 > 0) ? j0 - 1 : 0, j0, j0 + 1, std::min(j0 + 2, ny + 1) };
+
+		C values[4];
+		for (uint r = 0; r < 4; r++)
+		{
+			const T * row = x + rows[r] * stride;
+			values[r] = monotoneCubic(C(row[columns[0]]), C(row[columns[1]]), C(row[columns[2]]), C(row[columns[3]]), s1);
+		}
+		return monotoneCubic(values[0], values[1], values[2], values[3], t1);
+	}
+
+	/// Any backtrace / interpolation, optionally recording the range of the
+	/// four source values around each backtrace. Intermediate positions of
+	/// the Runge-Kutta backtraces go through the same wall treatment. RK2 is
+	/// Heun's rule, the midpoint rule keeps no weight on the cell's own
+	/// velocity and turns noisy at large CFL next to no-slip walls.
+	template <boundaryType B, typename T>
+	inline void advectRowGeneral(const AdvectionParameters<T> & parameters, uint j, uint iBegin, uint iEnd)
+	{
+		typedef Compute<T> C;
+		uint nx = parameters.numberCellsX;
+		uint ny = parameters.numberCellsY;
+		std::size_t stride = std::size_t(nx) + 2;
+		C dt0 = parameters.dt0;
+
+		for (uint i = iBegin; i < iEnd; i++)
+		{
+			std::size_t cter = i + j * stride;
+			C u1 = C(parameters.u[cter]);
+			C v1 = C(parameters.v[cter]);
+
+			C x = i - dt0 * u1;
+			C y = j - dt0 * v1;
+			if (parameters.backtrace == BACKTRACE_RK2)
+			{
+				C xe = advectionBoundaryCell<B>(x, nx);
+				C ye = advectionBoundaryCell<B>(y, ny);
+				x = i - C(0.5) * dt0 * (u1 + sampleLinear(parameters.u, stride, xe, ye));
+				y = j - C(0.5) * dt0 * (v1 + sampleLinear(parameters.v, stride, xe, ye));
+			}
+			else if (parameters.backtrace == BACKTRACE_RK3)
+			{
+				C x2 = advectionBoundaryCell<B>(i - C(0.5) * dt0 * u1, nx);
+				C y2 = advectionBoundaryCell<B>(j - C(0.5) * dt0 * v1, ny);
+				C u2 = sampleLinear(parameters.u, stride, x2, y2);
+				C v2 = sampleLinear(parameters.v, stride, x2, y2);
+
+				C x3 = advectionBoundaryCell<B>(i - C(0.75) * dt0 * u2, nx);
+				C y3 = advectionBoundaryCell<B>(j - C(0.75) * dt0 * v2, ny);
+				C u3 = sampleLinear(parameters.u, stride, x3, y3);
+				C v3 = sampleLinear(parameters.v, stride, x3, y3);
+
+				x = i - dt0 * (C(2.0) * u1 + C(3.0) * u2 + C(4.0) * u3) / C(9.0);
+				y = j - dt0 * (C(2.0) * v1 + C(3.0) * v2 + C(4.0) * v3) / C(9.0);
+			}
+			x = advectionBoundaryCell<B>(x, nx);
+			y = advectionBoundaryCell<B>(y, ny);
+
+			uint i0 = (uint)x;
+			uint j0 = (uint)y;
+			C s1 = x - i0;
+			C t1 = y - j0;
+
+			std::size_t index00 = i0 + j0 * stride;
+			for (uint f = 0; f < parameters.numFields; f++)
+			{
+				const T * xOld = parameters.xOld[f];
+				C value;
+				if (parameters.interpolation == INTERPOLATION_CUBIC)
+				{
+					value = sampleCubic<C>(xOld, nx, ny, stride, i0, j0, s1, t1);
+				}
+				else
+				{
+					value = (1 - s1) * ((1 - t1) * C(xOld[index00]) + t1 * C(xOld[index00 + stride])) +
+						s1 * ((1 - t1) * C(xOld[index00 + 1]) + t1 * C(xOld[index00 + stride + 1]));
+				}
+				parameters.xNew[f][cter] = T(value);
+
+				if (parameters.recordRange)
+				{
+					C a00 = C(xOld[index00]);
+					C a01 = C(xOld[index00 + stride]);
+					C a10 = C(xOld[index00 + 1]);
+					C a11 = C(xOld[index00 + stride + 1]);
+					parameters.minimum[f][cter] = T(std::min(std::min(a00, a01), std::min(a10, a11)));
+					parameters.maximum[f][cter] = T(std::max(std::max(a00, a01), std::max(a10, a11)));
+				}
+			}
+		}
+	}
+
+	template <typename T>
+	inline bool advectionNeedsGeneralKernel(const AdvectionParameters<T> & parameters)
+	{
+		return parameters.backtrace != BACKTRACE_EULER || parameters.interpolation != INTERPOLATION_LINEAR || parameters.recordRange;
+	}
+
+#ifdef FLUIDSIM_SIMD_X86
+	/// 8 cells per iteration, the bilinear corners are fetched with gathers.
+	/// Gathers take 32 bit offsets, see advectionFitsGather
+	template <boundaryType B>
+	FLUIDSIM_TARGET_AVX2 inline void advectRowAvx2(const AdvectionParameters<float> & parameters, uint j, uint iBegin, uint iEnd)
+	{
+		uint nx = parameters.numberCellsX;
+		uint ny = parameters.numberCellsY;
+		std::size_t stride = std::size_t(nx) + 2;
+		bool periodic = (B == PERIODIC);
+
+		__m256 lowLimit = _mm256_set1_ps(0.5f);
+		__m256 highLimitX = _mm256_set1_ps(nx + 0.5f);
+		__m256 highLimitY = _mm256_set1_ps(ny + 0.5f);
+		__m256 lowValueX = periodic ? highLimitX : lowLimit;
+		__m256 lowValueY = periodic ? highLimitY : lowLimit;
+		__m256 highValueX = periodic ? lowLimit : highLimitX;
+		__m256 highValueY = periodic ? lowLimit : highLimitY;
+		__m256 dt0 = _mm256_set1_ps(parameters.dt0);
+		__m256 one = _mm256_set1_ps(1.0f);
+		__m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+		__m256 y0 = _mm256_set1_ps((float)j);
+		__m256i strideVector = _mm256_set1_epi32((int)stride);
+
+		uint i = iBegin;
+		for (; i + 8 <= iEnd; i += 8)
+		{
+			std::size_t cter = i + j * stride;
+			__m256 x = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)i), lane), _mm256_mul_ps(dt0, _mm256_loadu_ps(parameters.u + cter)));
+			__m256 y = _mm256_sub_ps(y0, _mm256_mul_ps(dt0, _mm256_loadu_ps(parameters.v + cter)));
+
+			x = _mm256_blendv_ps(x, lowValueX, _mm256_cmp_ps(x, lowLimit, _CMP_LT_OQ));
+			x = _mm256_blendv_ps(x, highValueX, _mm256_cmp_ps(x, highLimitX, _CMP_GT_OQ));
+			y = _mm256_blendv_ps(y, lowValueY, _mm256_cmp_ps(y, lowLimit, _CMP_LT_OQ));
+			y = _mm256_blendv_ps(y, highValueY, _mm256_cmp_ps(y, highLimitY, _CMP_GT_OQ));
+
+			__m256i i0 = _mm256_cvttps_epi32(x);
+			__m256i j0 = _mm256_cvttps_epi32(y);
+
+			__m256 s1 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(i0));
+			__m256 s0 = _mm256_sub_ps(one, s1);
+			__m256 t1 = _mm256_sub_ps(y, _mm256_cvtepi32_ps(j0));
+			__m256 t0 = _mm256_sub_ps(one, t1);
+
+			__m256i index00 = _mm256_add_epi32(i0, _mm256_mullo_epi32(j0, strideVector));
+			__m256i index01 = _mm256_add_epi32(index00, strideVector);
+
+			for (uint f = 0; f < parameters.numFields; f++)
+			{
+				const float * xOld = parameters.xOld[f];
+				__m256 a00 = _mm256_i32gather_ps(xOld, index00, 4);
+				__m256 a01 = _mm256_i32gather_ps(xOld, index01, 4);
+				__m256 a10 = _mm256_i32gather_ps(xOld + 1, index00, 4);
+				__m256 a11 = _mm256_i32gather_ps(xOld + 1, index01, 4);
+
+				__m256 left = _mm256_add_ps(_mm256_mul_ps(t0, a00), _mm256_mul_ps(t1, a01));
+				__m256 right = _mm256_add_ps(_mm256_mul_ps(t0, a10), _mm256_mul_ps(t1, a11));
+				_mm256_storeu_ps(parameters.xNew[f] + cter, _mm256_add_ps(_mm256_mul_ps(s0, left), _mm256_mul_ps(s1, right)));
+			}
+		}
+
+		advectRowScalar<B>(parameters, j, i, iEnd);
+	}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+	/// 16 cells per iteration, the compiler may contract the interpolation
+	/// into FMAs so results can differ from the other kernels in the last bit
+	template <boundaryType B>
+	FLUIDSIM_TARGET_AVX512 inline void advectRowAvx512(const AdvectionParameters<float> & parameters, uint j, uint iBegin, uint iEnd)
+	{
+		uint nx = parameters.numberCellsX;
+		uint ny = parameters.numberCellsY;
+		std::size_t stride = std::size_t(nx) + 2;
+		bool periodic = (B == PERIODIC);
+
+		__m512 lowLimit = _mm512_set1_ps(0.5f);
+		__m512 highLimitX = _mm512_set1_ps(nx + 0.5f);
+		__m512 highLimitY = _mm512_set1_ps(ny + 0.5f);
+		__m512 lowValueX = periodic ? highLimitX : lowLimit;
+		__m512 lowValueY = periodic ? highLimitY : lowLimit;
+		__m512 highValueX = periodic ? lowLimit : highLimitX;
+		__m512 highValueY = periodic ? lowLimit : highLimitY;
+		__m512 dt0 = _mm512_set1_ps(parameters.dt0);
+		__m512 one = _mm512_set1_ps(1.0f);
+		__m512 lane = _mm512_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+			8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f);
+		__m512 y0 = _mm512_set1_ps((float)j);
+		__m512i strideVector = _mm512_set1_epi32((int)stride);
+
+		uint i = iBegin;
+		for (; i + 16 <= iEnd; i += 16)
+		{
+			std::size_t cter = i + j * stride;
+			__m512 x = _mm512_sub_ps(_mm512_add_ps(_mm512_set1_ps((float)i), lane), _mm512_mul_ps(dt0, _mm512_loadu_ps(parameters.u + cter)));
+			__m512 y = _mm512_sub_ps(y0, _mm512_mul_ps(dt0, _mm512_loadu_ps(parameters.v + cter)));
+
+			x = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, lowLimit, _CMP_LT_OQ), x, lowValueX);
+			x = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, highLimitX, _CMP_GT_OQ), x, highValueX);
+			y = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(y, lowLimit, _CMP_LT_OQ), y, lowValueY);
+			y = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(y, highLimitY, _CMP_GT_OQ), y, highValueY);
+
+			__m512i i0 = _mm512_cvttps_epi32(x);
+			__m512i j0 = _mm512_cvttps_epi32(y);
+
+			__m512 s1 = _mm512_sub_ps(x, _mm512_cvtepi32_ps(i0));
+			__m512 s0 = _mm512_sub_ps(one, s1);
+			__m512 t1 = _mm512_sub_ps(y, _mm512_cvtepi32_ps(j0));
+			__m512 t0 = _mm512_sub_ps(one, t1);
+
+			__m512i index00 = _mm512_add_epi32(i0, _mm512_mullo_epi32(j0, strideVector));
+			__m512i index01 = _mm512_add_epi32(index00, strideVector);
+
+			for (uint f = 0; f < parameters.numFields; f++)
+			{
+				const float * xOld = parameters.xOld[f];
+				__m512 a00 = _mm512_i32gather_ps(index00, xOld, 4);
+				__m512 a01 = _mm512_i32gather_ps(index01, xOld, 4);
+				__m512 a10 = _mm512_i32gather_ps(index00, xOld + 1, 4);
+				__m512 a11 = _mm512_i32gather_ps(index01, xOld + 1, 4);
+
+				__m512 left = _mm512_add_ps(_mm512_mul_ps(t0, a00), _mm512_mul_ps(t1, a01));
+				__m512 right = _mm512_add_ps(_mm512_mul_ps(t0, a10), _mm512_mul_ps(t1, a11));
+				_mm512_storeu_ps(parameters.xNew[f] + cter, _mm512_add_ps(_mm512_mul_ps(s0, left), _mm512_mul_ps(s1, right)));
+			}
+		}
+
+		advectRowScalar<B>(parameters, j, i, iEnd);
+	}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+	/// Widest kernel the processor supports
+	inline advectionKernelType detectAdvectionKernel()
+	{
+#if defined(FLUIDSIM_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")) return ADVECTION_AVX512;
+		if (__builtin_cpu_supports("avx2")) return ADVECTION_AVX2;
+#elif defined(FLUIDSIM_SIMD_X86)
+		int registers[4];
+		__cpuidex(registers, 7, 0);
+		bool osSavesAvx = (_xgetbv(0) & 0x6) == 0x6;
+		bool osSavesAvx512 = (_xgetbv(0) & 0xe6) == 0xe6;
+		if (osSavesAvx512 && (registers[1] & (1 << 16))) return ADVECTION_AVX512;
+		if (osSavesAvx && (registers[1] & (1 << 5))) return ADVECTION_AVX2;
+#endif
+		return ADVECTION_SCALAR;
+	}
+
+	/// The gathers of the vector kernels address the field with 32 bit offsets
+	inline bool advectionFitsGather(uint numberCellsX, uint numberCellsY)
+	{
+		std::size_t size = (std::size_t(numberCellsX) + 2) * (std::size_t(numberCellsY) + 2);
+		return size <= std::size_t(std::numeric_limits<int>::max());
+	}
+
+	/// Calls the kernel on every span of rows jBegin ... jEnd - 1 to be
+	/// advected, whole rows without a mask
+	template <typename T, typename Kernel>
+	inline void advectSpans(const AdvectionParameters<T> & parameters, uint jBegin, uint jEnd, const Kernel & kernel)
+	{
+		for (uint j = jBegin; j < jEnd; j++)
+		{
+			if (!parameters.spans)
+			{
+				kernel(j, 1, parameters.numberCellsX + 1);
+				continue;
+			}
+			for (const CellSpan * span = parameters.spans->spansBegin(j); span != parameters.spans->spansEnd(j); span++)
+			{
+				kernel(j, span->iBegin, span->iEnd);
+			}
+		}
+	}
+
+	/// Rows jBegin ... jEnd - 1 with the requested kernel, the vector kernels
+	/// only cover the Euler / bilinear scheme on single precision storage
+	/// whose offsets fit the gathers
+	template <boundaryType B, typename T>
+	inline void advectRows(const AdvectionParameters<T> & parameters, advectionKernelType kernel, uint jBegin, uint jEnd)
+	{
+		if (advectionNeedsGeneralKernel(parameters))
+		{
+			advectSpans(parameters, jBegin, jEnd, [&](uint j, uint iBegin, uint iEnd) { advectRowGeneral<B>(parameters, j, iBegin, iEnd); });
+			return;
+		}
+		advectSpans(parameters, jBegin, jEnd, [&](uint j, uint iBegin, uint iEnd) { advectRowScalar<B>(parameters, j, iBegin, iEnd); });
+	}
+
+#ifdef FLUIDSIM_SIMD_X86
+	template <boundaryType B>
+	inline void advectRows(const AdvectionParameters<float> & parameters, advectionKernelType kernel, uint jBegin, uint jEnd)
+	{
+		if (advectionNeedsGeneralKernel(parameters))
+		{
+			advectSpans(parameters, jBegin, jEnd, [&](uint j, uint iBegin, uint iEnd) { advectRowGeneral<B>(parameters, j, iBegin, iEnd); });
+			return;
+		}
+		if (!advectionFitsGather(parameters.numberCellsX, parameters.numberCellsY)) kernel = ADVECTION_SCALAR;
+
+		if (kernel == ADVECTION_AVX512)
+		{
+			advectSpans(parameters, jBegin, jEnd, [&](uint j, uint iBegin, uint iEnd) { advectRowAvx512<B>(parameters, j, iBegin, iEnd); });
+			return;
+		}
+		if (kernel == ADVECTION_AVX2)
+		{
+			advectSpans(parameters, jBegin, jEnd, [&](uint j, uint iBegin, uint iEnd) { advectRowAvx2<B>(parameters, j, iBegin, iEnd); });
+			return;
+		}
+		advectSpans(parameters, jBegin, jEnd, [&](uint j, uint iBegin, uint iEnd) { advectRowScalar<B>(parameters, j, iBegin, iEnd); });
+	}
+#endif
+
+	template <typename T>
+	inline void advectRows(const AdvectionParameters<T> & parameters, advectionKernelType kernel, uint jBegin, uint jEnd)
+	{
+		(parameters.boundary == PERIODIC) ? advectRows<PERIODIC>(parameters, kernel, jBegin, jEnd) :
+			advectRows<DIRICHLET>(parameters, kernel, jBegin, jEnd);
+	}
+}
@@ -3,24 +3,27 @@
 
 namespace FluidSimulation
 {
-	static real TaylorGreenVortexDensity(real t, real x, real y)
+	template <typename T>
+	static T TaylorGreenVortexDensity(T t, T x, T y)
 	{
-		real factorA = -real(0.25) * std::exp(-real(4.0) * t);
-		real factorB = std::cos(real(2.0) * x * ONE_PI) + std::cos(real(2.0) * y * ONE_PI);
+		T factorA = -T(0.25) * std::exp(-T(4.0) * t);
+		T factorB = std::cos(T(2.0) * x * onePi<T>()) + std::cos(T(2.0) * y * onePi<T>());
 		return (factorA * factorB);
 	}
 
-	static real TaylorGreenVortexVelocityU(real t, real x, real y)
+	template <typename T>
+	static T TaylorGreenVortexVelocityU(T t, T x, T y)
 	{
-		real factorA = -std::exp(-real(2.0) * t);
-		real factorB = std::cos(TWO_PI * x) * std::sin(TWO_PI * y);
+		T factorA = -std::exp(-T(2.0) * t);
+		T factorB = std::cos(twoPi<T>() * x) * std::sin(twoPi<T>() * y);
 		return (factorA * factorB);
 	}
 
-	static real TaylorGreenVortexVelocityV(real t, real x, real y)
+	template <typename T>
+	static T TaylorGreenVortexVelocityV(T t, T x, T y)
 	{
-		real factorA = +std::exp(-real(2.0) * t);
-		real factorB = std::sin(TWO_PI * x) * std::cos(TWO_PI * y);
+		T factorA = +std::exp(-T(2.0) * t);
+		T factorB = std::sin(twoPi<T>() * x) * std::cos(twoPi<T>() * y);
 		return (factorA * factorB);
 	}
 }
\ No newline at end of file
@@ -1,7 +1,4 @@
 #pragma once
-#define ONE_PI real(3.14159265359)
-#define TWO_PI real(6.28318530718)
-
 #include <FreeImage/FreeImage.h>
 #include <GLFW/glfw3.h>
 #include <ctime>
@@ -89,6 +86,7 @@ namespace FluidSimulation
 				frame++;
 			}
 
+			m_scene->stopSimulation();
 			glfwDestroyWindow(m_window);
 		}
 
@@ -193,6 +191,10 @@ namespace FluidSimulation
 					m_scene->decreaseFluidTimeStep();
 					break;
 
+				case GLFW_KEY_A:
+					m_scene->toggleFluidTimeStepping();
+					break;
+
 				case GLFW_KEY_F3:
 					m_scene->increaseParticleSystemTimeStep();
 					break;
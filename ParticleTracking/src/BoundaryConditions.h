@@ -1,4 +1,6 @@
 #pragma once
+#include "Definitions.h"
+#include <cstddef>
 
 namespace FluidSimulation
 {
@@ -18,6 +20,11 @@ namespace FluidSimulation
 			return m_boundary;
 		}
 
+		void setBoundaryType(boundaryType boundary)
+		{
+			m_boundary = boundary;
+		}
+
 		void switchBoundaryCondition()
 		{
 			m_boundary = (m_boundary == PERIODIC) ? DIRICHLET : PERIODIC;
@@ -26,4 +33,64 @@ namespace FluidSimulation
 	protected:
 		boundaryType m_boundary = PERIODIC;
 	};
-}
\ No newline at end of file
+
+	/// Fills the ring of ghost cells of a (nx + 2) x (ny + 2) row major field
+	/// with the same conventions as Fluid, for solvers working on grids of
+	/// any size. The boundary is a template parameter so the kernels calling
+	/// it are specialized once per wall type and carry no per cell branches.
+	/// Offsets are 64 bit so fields may hold more than 2^32 cells.
+	template <boundaryType B, typename T>
+	inline void fillGhostCells(T * x, uint nx, uint ny)
+	{
+		std::size_t stride = std::size_t(nx) + 2;
+		T * bottom = x;
+		T * first = x + stride;
+		T * last = x + ny * stride;
+		T * top = x + (std::size_t(ny) + 1) * stride;
+
+		if (B == PERIODIC)
+		{
+			for (uint j = 1; j <= ny; j++)
+			{
+				T * row = x + j * stride;
+				row[0] = row[nx];
+				row[nx + 1] = row[1];
+			}
+			for (uint i = 1; i <= nx; i++)
+			{
+				bottom[i] = last[i];
+				top[i] = first[i];
+			}
+
+			bottom[0] = last[nx];
+			top[0] = first[nx];
+			bottom[nx + 1] = last[1];
+			top[nx + 1] = first[1];
+		}
+		else
+		{
+			for (uint j = 1; j <= ny; j++)
+			{
+				T * row = x + j * stride;
+				row[0] = -row[1];
+				row[nx + 1] = -row[nx];
+			}
+			for (uint i = 1; i <= nx; i++)
+			{
+				bottom[i] = -first[i];
+				top[i] = -last[i];
+			}
+
+			bottom[0] = T(0.0f);
+			top[0] = T(0.0f);
+			bottom[nx + 1] = T(0.0f);
+			top[nx + 1] = T(0.0f);
+		}
+	}
+
+	template <typename T>
+	inline void fillGhostCells(T * x, uint nx, uint ny, boundaryType boundary)
+	{
+		(boundary == PERIODIC) ? fillGhostCells<PERIODIC>(x, nx, ny) : fillGhostCells<DIRICHLET>(x, nx, ny);
+	}
+}
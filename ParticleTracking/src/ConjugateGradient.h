@@ -0,0 +1,366 @@
+#pragma once
+#include "BoundaryConditions.h"
+#include "SolverStatistics.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <mutex>
+
+#define CONJUGATE_GRADIENT_MAX_ITERATIONS 500
+#define CONJUGATE_GRADIENT_TOLERANCE 1.0e-4
+#define CONJUGATE_GRADIENT_PARALLEL_CELLS 64
+#define MIC_TUNING 0.97
+#define MIC_SAFETY 0.25
+
+namespace FluidSimulation
+{
+	enum preconditionerType
+	{
+		PRECONDITIONER_NONE = 0,
+		PRECONDITIONER_JACOBI,
+		PRECONDITIONER_MIC
+	};
+
+	/// Matrix free preconditioned conjugate gradient for the same Poisson
+	/// problem as Multigrid,
+	///     4 x(i, j) - x(i - 1, j) - x(i + 1, j) - x(i, j - 1) - x(i, j + 1) = b(i, j)
+	/// where the ghost cells follow x. With DIRICHLET walls the ghost cell is
+	/// minus the interior one, so wall cells get an extra unit on the diagonal.
+	/// With PERIODIC walls the matrix is singular, residuals are kept with
+	/// zero mean. MIC(0) drops the periodic wrap couplings and is applied with
+	/// sequential triangular sweeps, everything else runs on the thread pool.
+	/// T is the precision of the vectors, float or double, dot products are
+	/// always accumulated in double.
+	template <typename T>
+	class ConjugateGradient
+	{
+	public:
+		ConjugateGradient(ThreadPool & threadPool)
+			: m_threadPool(threadPool)
+		{
+
+		}
+
+		void resize(uint numberCellsX, uint numberCellsY)
+		{
+			m_numberCellsX = numberCellsX;
+			m_numberCellsY = numberCellsY;
+
+			std::size_t size = (std::size_t(numberCellsX) + 2) * (std::size_t(numberCellsY) + 2);
+			m_residual.assign(size, T(0.0));
+			m_auxiliar.assign(size, T(0.0));
+			m_search.assign(size, T(0.0));
+			m_product.assign(size, T(0.0));
+			m_precon.assign(size, T(0.0));
+			m_preconValid = false;
+		}
+
+		/// Iterates until the rms residual drops by the tolerance or the maximum
+		/// number of iterations is reached, x is used as initial guess. The
+		/// tolerance is relative to the reference residual when given, the
+		/// one of a zero guess, otherwise to the initial one.
+		SolverStatistics solve(T * x, const T * b, boundaryType boundary, T referenceResidual = T(0.0))
+		{
+			SolverStatistics statistics;
+			if (m_numberCellsX == 0 || m_numberCellsY == 0) return statistics;
+
+			m_boundary = boundary;
+			if (m_preconditioner == PRECONDITIONER_MIC && (!m_preconValid || m_preconBoundary != m_boundary))
+			{
+				buildIncompleteCholesky();
+			}
+
+			T * r = m_residual.data();
+			T * z = m_auxiliar.data();
+			T * p = m_search.data();
+			T * q = m_product.data();
+
+			/// r = b - A x
+			fillGhostCells(x, m_numberCellsX, m_numberCellsY, m_boundary);
+			applyOperator(x, q);
+			forEachRow([&](uint jBegin, uint jEnd)
+			{
+				forEachCell(jBegin, jEnd, [&](std::size_t cter) { r[cter] = b[cter] - q[cter]; });
+			});
+			removeMean(r);
+
+			statistics.initialResidual = rootMeanSquare(r);
+			statistics.residual = statistics.initialResidual;
+			statistics.referenceResidual = referenceResidual;
+			T target = m_tolerance * ((referenceResidual > T(0.0)) ? referenceResidual : T(statistics.initialResidual));
+			if (statistics.residual <= target) return statistics;
+
+			applyPreconditioner(r, z);
+			std::copy(m_auxiliar.begin(), m_auxiliar.end(), m_search.begin());
+			double rz = dot(r, z);
+
+			while (statistics.iterations < m_maxIterations)
+			{
+				fillGhostCells(p, m_numberCellsX, m_numberCellsY, m_boundary);
+				applyOperator(p, q);
+
+				double pq = dot(p, q);
+				if (pq <= 0.0) break;
+				T alpha = T(rz / pq);
+
+				forEachRow([&](uint jBegin, uint jEnd)
+				{
+					forEachCell(jBegin, jEnd, [&](std::size_t cter)
+					{
+						x[cter] += alpha * p[cter];
+						r[cter] -= alpha * q[cter];
+					});
+				});
+				statistics.iterations++;
+
+				statistics.residual = rootMeanSquare(r);
+				if (statistics.residual <= target) break;
+
+				applyPreconditioner(r, z);
+				double rzNew = dot(r, z);
+				T beta = T(rzNew / rz);
+				rz = rzNew;
+
+				forEachRow([&](uint jBegin, uint jEnd)
+				{
+					forEachCell(jBegin, jEnd, [&](std::size_t cter) { p[cter] = z[cter] + beta * p[cter]; });
+				});
+			}
+
+			statistics.converged = (statistics.residual <= target);
+			fillGhostCells(x, m_numberCellsX, m_numberCellsY, m_boundary);
+			return statistics;
+		}
+
+		void setPreconditioner(preconditionerType preconditioner)
+		{
+			m_preconditioner = preconditioner;
+			m_preconValid = false;
+		}
+
+		preconditionerType getPreconditioner() const
+		{
+			return m_preconditioner;
+		}
+
+		void setMaxIterations(uint maxIterations)
+		{
+			m_maxIterations = maxIterations;
+		}
+
+		void setTolerance(T tolerance)
+		{
+			m_tolerance = tolerance;
+		}
+
+	protected:
+		template <typename Function>
+		void forEachRow(const Function & function)
+		{
+			if (m_numberCellsY >= CONJUGATE_GRADIENT_PARALLEL_CELLS)
+			{
+				m_threadPool.parallelFor(1, m_numberCellsY + 1, function);
+			}
+			else
+			{
+				function(1, m_numberCellsY + 1);
+			}
+		}
+
+		template <typename Function>
+		void forEachCell(uint jBegin, uint jEnd, const Function & function)
+		{
+			std::size_t stride = std::size_t(m_numberCellsX) + 2;
+			for (uint j = jBegin; j < jEnd; j++)
+			{
+				for (uint i = 1; i <= m_numberCellsX; i++)
+				{
+					function(i + j * stride);
+				}
+			}
+		}
+
+		double dot(const T * a, const T * b)
+		{
+			std::mutex mutex;
+			double sum = 0.0;
+			forEachRow([&](uint jBegin, uint jEnd)
+			{
+				double partialSum = 0.0;
+				forEachCell(jBegin, jEnd, [&](std::size_t cter) { partialSum += double(a[cter]) * double(b[cter]); });
+
+				std::lock_guard<std::mutex> lock(mutex);
+				sum += partialSum;
+			});
+			return sum;
+		}
+
+		T rootMeanSquare(const T * a)
+		{
+			return T(std::sqrt(dot(a, a) / (double(m_numberCellsX) * double(m_numberCellsY))));
+		}
+
+		/// Keeps the residual in the range of the singular periodic operator
+		void removeMean(T * a)
+		{
+			if (m_boundary != PERIODIC) return;
+
+			std::size_t stride = std::size_t(m_numberCellsX) + 2;
+			double mean = 0.0;
+			for (uint j = 1; j <= m_numberCellsY; j++)
+			{
+				for (uint i = 1; i <= m_numberCellsX; i++)
+				{
+					mean += a[i + j * stride];
+				}
+			}
+			mean /= double(m_numberCellsX) * double(m_numberCellsY);
+
+			forEachRow([&](uint jBegin, uint jEnd)
+			{
+				forEachCell(jBegin, jEnd, [&](std::size_t cter) { a[cter] -= T(mean); });
+			});
+		}
+
+		/// q = A x, the ghost cells of x have to be up to date
+		void applyOperator(const T * x, T * q)
+		{
+			std::size_t stride = std::size_t(m_numberCellsX) + 2;
+			forEachRow([&](uint jBegin, uint jEnd)
+			{
+				forEachCell(jBegin, jEnd, [&](std::size_t cter)
+				{
+					q[cter] = T(4.0) * x[cter] - x[cter - 1] - x[cter + 1] - x[cter - stride] - x[cter + stride];
+				});
+			});
+		}
+
+		T diagonal(uint i, uint j) const
+		{
+			if (m_boundary == PERIODIC) return T(4.0);
+
+			T wallCells = T((i == 1) + (i == m_numberCellsX) + (j == 1) + (j == m_numberCellsY));
+			return T(4.0) + wallCells;
+		}
+
+		void applyPreconditioner(const T * r, T * z)
+		{
+			std::size_t stride = std::size_t(m_numberCellsX) + 2;
+			switch (m_preconditioner)
+			{
+			case PRECONDITIONER_JACOBI:
+				forEachRow([&](uint jBegin, uint jEnd)
+				{
+					for (uint j = jBegin; j < jEnd; j++)
+					{
+						for (uint i = 1; i <= m_numberCellsX; i++)
+						{
+							z[i + j * stride] = r[i + j * stride] / diagonal(i, j);
+						}
+					}
+				});
+				break;
+
+			case PRECONDITIONER_MIC:
+				applyIncompleteCholesky(r, z);
+				break;
+
+			default:
+			case PRECONDITIONER_NONE:
+				std::copy(r, r + stride * (std::size_t(m_numberCellsY) + 2), z);
+				break;
+			}
+			removeMean(z);
+		}
+
+		/// Modified incomplete Cholesky, couplings are -1 between interior
+		/// neighbours and the wrap around of periodic walls is dropped
+		void buildIncompleteCholesky()
+		{
+			std::size_t stride = std::size_t(m_numberCellsX) + 2;
+			T * precon = m_precon.data();
+
+			for (uint j = 1; j <= m_numberCellsY; j++)
+			{
+				for (uint i = 1; i <= m_numberCellsX; i++)
+				{
+					T diag = diagonal(i, j);
+					T e = diag;
+
+					if (i > 1)
+					{
+						T westPrecon = precon[(i - 1) + j * stride];
+						T westCoupling = (j < m_numberCellsY) ? T(1.0) : T(0.0);
+						e -= westPrecon * westPrecon + T(MIC_TUNING) * westCoupling * westPrecon * westPrecon;
+					}
+
+					if (j > 1)
+					{
+						T sothPrecon = precon[i + (j - 1) * stride];
+						T sothCoupling = (i < m_numberCellsX) ? T(1.0) : T(0.0);
+						e -= sothPrecon * sothPrecon + T(MIC_TUNING) * sothCoupling * sothPrecon * sothPrecon;
+					}
+
+					if (e < T(MIC_SAFETY) * diag) e = diag;
+					precon[i + j * stride] = T(1.0) / std::sqrt(e);
+				}
+			}
+
+			m_preconBoundary = m_boundary;
+			m_preconValid = true;
+		}
+
+		void applyIncompleteCholesky(const T * r, T * z)
+		{
+			std::size_t stride = std::size_t(m_numberCellsX) + 2;
+			const T * precon = m_precon.data();
+
+			/// Solve L q = r
+			for (uint j = 1; j <= m_numberCellsY; j++)
+			{
+				for (uint i = 1; i <= m_numberCellsX; i++)
+				{
+					std::size_t cter = i + j * stride;
+					T t = r[cter];
+					if (i > 1) t += precon[cter - 1] * z[cter - 1];
+					if (j > 1) t += precon[cter - stride] * z[cter - stride];
+					z[cter] = t * precon[cter];
+				}
+			}
+
+			/// Solve L^T z = q
+			for (uint j = m_numberCellsY; j >= 1; j--)
+			{
+				for (uint i = m_numberCellsX; i >= 1; i--)
+				{
+					std::size_t cter = i + j * stride;
+					T t = z[cter];
+					if (i < m_numberCellsX) t += precon[cter] * z[cter + 1];
+					if (j < m_numberCellsY) t += precon[cter] * z[cter + stride];
+					z[cter] = t * precon[cter];
+				}
+			}
+		}
+
+	private:
+		ThreadPool & m_threadPool;
+		uint m_numberCellsX = 0;
+		uint m_numberCellsY = 0;
+		boundaryType m_boundary = PERIODIC;
+
+		/// Work vectors
+		std::vector<T> m_residual;
+		std::vector<T> m_auxiliar;
+		std::vector<T> m_search;
+		std::vector<T> m_product;
+
+		/// Diagonal of the incomplete factor and the walls it was built for
+		std::vector<T> m_precon;
+		boundaryType m_preconBoundary = PERIODIC;
+		bool m_preconValid = false;
+
+		/// Parameters
+		preconditionerType m_preconditioner = PRECONDITIONER_MIC;
+		uint m_maxIterations = CONJUGATE_GRADIENT_MAX_ITERATIONS;
+		T m_tolerance = T(CONJUGATE_GRADIENT_TOLERANCE);
+	};
+}
@@ -0,0 +1,347 @@
+#pragma once
+#include "BoundaryConditions.h"
+#include <mpi.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#define DECOMPOSITION_TAG_WEST 1
+#define DECOMPOSITION_TAG_EAST 2
+#define DECOMPOSITION_TAG_SOUTH 3
+#define DECOMPOSITION_TAG_NORTH 4
+
+namespace FluidSimulation
+{
+	/// Datatype of the reductions, fields themselves travel as raw bytes so
+	/// the 16 bit storage formats need no datatype of their own
+	template <typename S>
+	struct MpiDatatype;
+
+	template <>
+	struct MpiDatatype<float>
+	{
+		static MPI_Datatype get() { return MPI_FLOAT; }
+	};
+
+	template <>
+	struct MpiDatatype<double>
+	{
+		static MPI_Datatype get() { return MPI_DOUBLE; }
+	};
+
+	/// Splits an nx x ny grid in px x py blocks, one per rank of the
+	/// communicator, and moves the halos between them. A block stores its
+	/// cells with a ring of haloWidth cells on every side, row major with a
+	/// stride of the block width + 2 haloWidth. The ring plays the part of the
+	/// ghost cells of Fluid: along the cuts it holds copies of the cells of
+	/// the neighbour blocks, along the walls it follows fillGhostCells.
+	///
+	/// Cell indices are global and 1 based like in Fluid, a block owns cells
+	/// getFirstCellX() ... getFirstCellX() + getNumCellsX() - 1 along x.
+	class Decomposition
+	{
+	public:
+		Decomposition(MPI_Comm communicator = MPI_COMM_WORLD)
+			: m_communicator(communicator)
+		{
+			MPI_Comm_rank(m_communicator, &m_rank);
+			MPI_Comm_size(m_communicator, &m_numRanks);
+		}
+
+		/// Picks the process grid with the shortest total cut. Blocks are at
+		/// least haloWidth cells wide so every halo comes from the nearest
+		/// neighbours, false when the grid is too small for the ranks.
+		bool resize(uint numberCellsX, uint numberCellsY, uint haloWidth, boundaryType boundary)
+		{
+			m_boundary = boundary;
+			m_haloWidth = std::max(haloWidth, uint(1));
+
+			uint ranks = uint(m_numRanks);
+			m_numBlocksX = 0;
+			m_numBlocksY = 0;
+			double bestCut = 0.0;
+			for (uint px = 1; px <= ranks; px++)
+			{
+				if (ranks % px != 0) continue;
+				uint py = ranks / px;
+				if (numberCellsX / px < m_haloWidth || numberCellsY / py < m_haloWidth) continue;
+
+				double cut = double(px) * double(numberCellsY) + double(py) * double(numberCellsX);
+				if (m_numBlocksX == 0 || cut < bestCut)
+				{
+					m_numBlocksX = px;
+					m_numBlocksY = py;
+					bestCut = cut;
+				}
+			}
+			if (m_numBlocksX == 0) return false;
+
+			m_blockX = uint(m_rank) % m_numBlocksX;
+			m_blockY = uint(m_rank) / m_numBlocksX;
+			splitCells(numberCellsX, m_numBlocksX, m_blockX, m_firstCellX, m_numCellsX);
+			splitCells(numberCellsY, m_numBlocksY, m_blockY, m_firstCellY, m_numCellsY);
+
+			m_neighbours[0] = neighbourRank(int(m_blockX) - 1, int(m_blockY));
+			m_neighbours[1] = neighbourRank(int(m_blockX) + 1, int(m_blockY));
+			m_neighbours[2] = neighbourRank(int(m_blockX), int(m_blockY) - 1);
+			m_neighbours[3] = neighbourRank(int(m_blockX), int(m_blockY) + 1);
+			m_acrossSeam[0] = (m_blockX == 0);
+			m_acrossSeam[1] = (m_blockX == m_numBlocksX - 1);
+			m_acrossSeam[2] = (m_blockY == 0);
+			m_acrossSeam[3] = (m_blockY == m_numBlocksY - 1);
+
+			m_exchangeSeconds = 0.0;
+			return true;
+		}
+
+		/// Halos along the cuts and the walls, the counterpart of
+		/// fillGhostCells. Fields of a batch travel in the same messages.
+		template <typename T>
+		void exchangeHalos(T * const * x, uint numFields)
+		{
+			exchange(x, numFields, true);
+		}
+
+		/// Halos along the cuts only, ghost cells on the walls (and across
+		/// the periodic seam) keep their values. This is what a relaxation
+		/// on the whole grid sees between the colours of a red-black sweep.
+		template <typename T>
+		void exchangeInterfaces(T * const * x, uint numFields)
+		{
+			exchange(x, numFields, false);
+		}
+
+		template <typename T>
+		void exchangeHalos(T * x)
+		{
+			exchange(&x, 1, true);
+		}
+
+		template <typename S>
+		S reduceSum(S value) const
+		{
+			MPI_Allreduce(MPI_IN_PLACE, &value, 1, MpiDatatype<S>::get(), MPI_SUM, m_communicator);
+			return value;
+		}
+
+		/// Element wise maximum of a few values in one collective
+		template <typename S>
+		void reduceMax(S * values, uint count) const
+		{
+			MPI_Allreduce(MPI_IN_PLACE, values, int(count), MpiDatatype<S>::get(), MPI_MAX, m_communicator);
+		}
+
+		template <typename S>
+		S reduceMax(S value) const
+		{
+			reduceMax(&value, 1);
+			return value;
+		}
+
+		int getRank() const
+		{
+			return m_rank;
+		}
+
+		int getNumRanks() const
+		{
+			return m_numRanks;
+		}
+
+		uint getNumBlocksX() const
+		{
+			return m_numBlocksX;
+		}
+
+		uint getNumBlocksY() const
+		{
+			return m_numBlocksY;
+		}
+
+		uint getFirstCellX() const
+		{
+			return m_firstCellX;
+		}
+
+		uint getFirstCellY() const
+		{
+			return m_firstCellY;
+		}
+
+		uint getNumCellsX() const
+		{
+			return m_numCellsX;
+		}
+
+		uint getNumCellsY() const
+		{
+			return m_numCellsY;
+		}
+
+		uint getHaloWidth() const
+		{
+			return m_haloWidth;
+		}
+
+		std::size_t getStride() const
+		{
+			return std::size_t(m_numCellsX) + 2 * m_haloWidth;
+		}
+
+		std::size_t getFieldSize() const
+		{
+			return getStride() * (std::size_t(m_numCellsY) + 2 * m_haloWidth);
+		}
+
+		/// Offset of the global cell (i, j), which has to be inside the block or its halo
+		std::size_t localIndex(uint i, uint j) const
+		{
+			return (i + m_haloWidth - m_firstCellX) + (j + m_haloWidth - m_firstCellY) * getStride();
+		}
+
+		/// Wall clock time spent in exchanges since the last resize
+		double getExchangeSeconds() const
+		{
+			return m_exchangeSeconds;
+		}
+
+	protected:
+		static void splitCells(uint numberCells, uint numBlocks, uint block, uint & firstCell, uint & numCells)
+		{
+			uint base = numberCells / numBlocks;
+			uint remainder = numberCells % numBlocks;
+			firstCell = 1 + block * base + std::min(block, remainder);
+			numCells = base + ((block < remainder) ? 1 : 0);
+		}
+
+		int neighbourRank(int blockX, int blockY) const
+		{
+			int numBlocksX = int(m_numBlocksX);
+			int numBlocksY = int(m_numBlocksY);
+			if (blockX < 0 || blockX >= numBlocksX || blockY < 0 || blockY >= numBlocksY)
+			{
+				if (m_boundary != PERIODIC) return MPI_PROC_NULL;
+				blockX = (blockX + numBlocksX) % numBlocksX;
+				blockY = (blockY + numBlocksY) % numBlocksY;
+			}
+			return blockX + blockY * numBlocksX;
+		}
+
+		/// Sends a rectangle of every field to one neighbour and receives the
+		/// matching rectangle from the opposite one
+		template <typename T>
+		void shift(T * const * x, uint numFields, std::size_t sendOffset, std::size_t receiveOffset, std::size_t width, uint height,
+			uint direction, uint opposite, int tag, bool walls)
+		{
+			int destination = (walls || !m_acrossSeam[direction]) ? m_neighbours[direction] : MPI_PROC_NULL;
+			int source = (walls || !m_acrossSeam[opposite]) ? m_neighbours[opposite] : MPI_PROC_NULL;
+			if (destination == MPI_PROC_NULL && source == MPI_PROC_NULL) return;
+
+			std::size_t stride = getStride();
+			std::size_t rowBytes = width * sizeof(T);
+			std::size_t bytes = numFields * height * rowBytes;
+			m_sendBuffer.resize(bytes);
+			m_receiveBuffer.resize(bytes);
+
+			if (destination != MPI_PROC_NULL)
+			{
+				unsigned char * buffer = m_sendBuffer.data();
+				for (uint f = 0; f < numFields; f++)
+				{
+					for (uint j = 0; j < height; j++, buffer += rowBytes)
+					{
+						std::memcpy(buffer, x[f] + sendOffset + j * stride, rowBytes);
+					}
+				}
+			}
+
+			MPI_Sendrecv(m_sendBuffer.data(), int(bytes), MPI_BYTE, destination, tag,
+				m_receiveBuffer.data(), int(bytes), MPI_BYTE, source, tag, m_communicator, MPI_STATUS_IGNORE);
+
+			if (source != MPI_PROC_NULL)
+			{
+				const unsigned char * buffer = m_receiveBuffer.data();
+				for (uint f = 0; f < numFields; f++)
+				{
+					for (uint j = 0; j < height; j++, buffer += rowBytes)
+					{
+						std::memcpy(x[f] + receiveOffset + j * stride, buffer, rowBytes);
+					}
+				}
+			}
+		}
+
+		/// Columns first and then whole rows including their halo columns, so
+		/// the corners arrive from the diagonal neighbours in the second phase
+		template <typename T>
+		void exchange(T * const * x, uint numFields, bool walls)
+		{
+			double start = MPI_Wtime();
+			std::size_t halo = m_haloWidth;
+			std::size_t stride = getStride();
+			std::size_t nx = m_numCellsX;
+			std::size_t ny = m_numCellsY;
+			bool dirichlet = walls && (m_boundary == DIRICHLET);
+
+			shift(x, numFields, halo + halo * stride, halo + nx + halo * stride, halo, m_numCellsY, 0, 1, DECOMPOSITION_TAG_WEST, walls);
+			shift(x, numFields, nx + halo * stride, halo * stride, halo, m_numCellsY, 1, 0, DECOMPOSITION_TAG_EAST, walls);
+
+			for (uint f = 0; dirichlet && f < numFields; f++)
+			{
+				for (std::size_t j = halo; j < halo + ny; j++)
+				{
+					T * row = x[f] + j * stride;
+					if (m_blockX == 0) row[halo - 1] = -row[halo];
+					if (m_blockX == m_numBlocksX - 1) row[halo + nx] = -row[halo + nx - 1];
+				}
+			}
+
+			shift(x, numFields, halo * stride, (halo + ny) * stride, stride, m_haloWidth, 2, 3, DECOMPOSITION_TAG_SOUTH, walls);
+			shift(x, numFields, ny * stride, 0, stride, m_haloWidth, 3, 2, DECOMPOSITION_TAG_NORTH, walls);
+
+			for (uint f = 0; dirichlet && f < numFields; f++)
+			{
+				T * bottom = x[f] + (halo - 1) * stride;
+				T * top = x[f] + (halo + ny) * stride;
+				for (std::size_t i = 0; i < stride; i++)
+				{
+					if (m_blockY == 0) bottom[i] = -bottom[i + stride];
+					if (m_blockY == m_numBlocksY - 1) top[i] = -top[i - stride];
+				}
+
+				if (m_blockY == 0 && m_blockX == 0) bottom[halo - 1] = T(0.0f);
+				if (m_blockY == 0 && m_blockX == m_numBlocksX - 1) bottom[halo + nx] = T(0.0f);
+				if (m_blockY == m_numBlocksY - 1 && m_blockX == 0) top[halo - 1] = T(0.0f);
+				if (m_blockY == m_numBlocksY - 1 && m_blockX == m_numBlocksX - 1) top[halo + nx] = T(0.0f);
+			}
+
+			m_exchangeSeconds += MPI_Wtime() - start;
+		}
+
+	private:
+		MPI_Comm m_communicator;
+		int m_rank = 0;
+		int m_numRanks = 1;
+		boundaryType m_boundary = PERIODIC;
+		uint m_haloWidth = 1;
+
+		/// Process grid and the block of this rank
+		uint m_numBlocksX = 0;
+		uint m_numBlocksY = 0;
+		uint m_blockX = 0;
+		uint m_blockY = 0;
+		uint m_firstCellX = 1;
+		uint m_firstCellY = 1;
+		uint m_numCellsX = 0;
+		uint m_numCellsY = 0;
+
+		/// West, east, south and north, the seam flags mark the neighbours
+		/// that are only neighbours through the periodic wrap
+		int m_neighbours[4] = { MPI_PROC_NULL, MPI_PROC_NULL, MPI_PROC_NULL, MPI_PROC_NULL };
+		bool m_acrossSeam[4] = { false, false, false, false };
+
+		std::vector<unsigned char> m_sendBuffer;
+		std::vector<unsigned char> m_receiveBuffer;
+		double m_exchangeSeconds = 0.0;
+	};
+}
@@ -1,8 +1,12 @@
 #pragma once
 #define GLM_SWIZZLE
+#define ONE_PI real(3.14159265359)
+#define TWO_PI real(6.28318530718)
 
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/glm.hpp>
+#include <limits>
+#include <cmath>
 
 namespace FluidSimulation
 {
@@ -13,5 +17,18 @@ namespace FluidSimulation
 	typedef glm::vec2 vec2;
 	typedef float real;
 
-	real infinity = std::numeric_limits<real>::infinity();
+	static const real infinity = std::numeric_limits<real>::infinity();
+
+	/// pi in the precision of T, ONE_PI / TWO_PI are single precision
+	template <typename T>
+	inline T onePi()
+	{
+		return T(3.14159265358979323846);
+	}
+
+	template <typename T>
+	inline T twoPi()
+	{
+		return T(6.28318530717958647693);
+	}
 }
\ No newline at end of file
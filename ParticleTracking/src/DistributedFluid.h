@@ -0,0 +1,525 @@
+#pragma once
+#include "Decomposition.h"
+#include "Fluid.h"
+
+#define DECOMPOSITION_HALO_WIDTH 4
+
+namespace FluidSimulation
+{
+	/// Stable fluids solver split in blocks across the ranks of an MPI
+	/// communicator, every rank only allocates its block and its halo. The
+	/// steps are those of Fluid with red-black relaxation, semi-Lagrangian
+	/// advection with Euler backtraces and Gauss-Seidel pressure: with the
+	/// scalar advection kernel on the single process side both give the same
+	/// fields bit for bit, whatever the number of ranks. The obstacle is the
+	/// exception: it keeps the model Fluid had before SolidMask, see
+	/// addSimpleObstacle, so with setObstacle the fields differ from Fluid's.
+	///
+	/// The backtrace of a cell may reach getHaloWidth() - 1 cells into the
+	/// halo, frames moving the fastest cell further are split in substeps,
+	/// on top of the CFL substeps of the adaptive mode.
+	template <typename T>
+	class DistributedFluid
+		: public TimeIntegrator<Compute<T>>
+		, public BoundaryConditions
+	{
+	public:
+		typedef T storage;
+		typedef Compute<T> scalar;
+
+		DistributedFluid(MPI_Comm communicator = MPI_COMM_WORLD)
+			: m_decomposition(communicator)
+		{
+			this->setTimeIncrement(scalar(TIME_INTEGRATION_INCREMENT_FLUID));
+			this->setTimeStep(scalar(TIME_INTEGRATION_INCREMENT_FLUID));
+		}
+
+		/// Same substepping as Fluid::update, the limit is the halo width in
+		/// fixed mode and the smaller of the halo and the CFL number otherwise
+		void update()
+		{
+			scalar remaining = this->m_timeStep;
+			scalar minimumStep = remaining / scalar(MAX_SUBSTEPS);
+			m_numSubsteps = 0;
+			while (remaining > scalar(0.0))
+			{
+				scalar dt = std::max(computeStableTimeStep(), minimumStep);
+				if (dt > remaining - scalar(0.5) * minimumStep) dt = remaining;
+
+				advance(dt);
+				remaining -= dt;
+				m_numSubsteps++;
+			}
+		}
+
+		scalar computeStableTimeStep() const
+		{
+			scalar cells = scalar(m_decomposition.getHaloWidth() - 1);
+			if (m_timeStepping == TIME_STEPPING_ADAPTIVE) cells = std::min(cells, m_cflNumber);
+
+			if (!(m_maxSpeed > scalar(0.0))) return std::numeric_limits<scalar>::max();
+			return cells * m_spacingCells / m_maxSpeed;
+		}
+
+		void advance(scalar dt)
+		{
+			(m_boundary == PERIODIC) ? updateStep<PERIODIC>(dt) : updateStep<DIRICHLET>(dt);
+		}
+
+		template <boundaryType B>
+		void updateStep(scalar dt)
+		{
+			std::swap(m_u0, m_u1);
+			std::swap(m_v0, m_v1);
+			std::swap(m_d0, m_d1);
+			T * diffusedNew[] = { m_u1.data(), m_v1.data(), m_d1.data() };
+			const T * diffusedOld[] = { m_u0.data(), m_v0.data(), m_d0.data() };
+			scalar viscousTerm = m_viscosity * dt * inverseSpacing() * inverseSpacing();
+			scalar densityTerm = m_diffusion * dt * inverseSpacing() * inverseSpacing();
+			relax(diffusedNew, diffusedOld, 2, viscousTerm, scalar(1.0) + scalar(4.0) * viscousTerm, 20);
+			relax(diffusedNew + 2, diffusedOld + 2, 1, densityTerm, scalar(1.0) + scalar(4.0) * densityTerm, 20);
+
+			std::swap(m_u0, m_u1);
+			std::swap(m_v0, m_v1);
+			T * velocityNew[] = { m_u1.data(), m_v1.data() };
+			const T * velocityOld[] = { m_u0.data(), m_v0.data() };
+			advectFields<B>(velocityNew, velocityOld, 2, m_u0.data(), m_v0.data(), dt);
+			project();
+
+			std::swap(m_d0, m_d1);
+			T * densityNew[] = { m_d1.data() };
+			const T * densityOld[] = { m_d0.data() };
+			advectFields<B>(densityNew, densityOld, 1, m_u1.data(), m_v1.data(), dt);
+
+			findExtremeValues();
+			addSimpleObstacle();
+		}
+
+		/// Collective, every rank has to call it with the same size. False
+		/// when the grid cannot give every rank a block as wide as the halo.
+		bool setGridSize(uint numberCellsX, uint numberCellsY)
+		{
+			m_numberCellsX = std::max(numberCellsX, uint(NUM_CELLS_MIN));
+			m_numberCellsY = std::max(numberCellsY, uint(NUM_CELLS_MIN));
+			return init();
+		}
+
+		bool init()
+		{
+			m_spacingCells = (scalar(1.0) / std::min(m_numberCellsX, m_numberCellsY));
+			if (!m_decomposition.resize(m_numberCellsX, m_numberCellsY, m_haloWidth, m_boundary)) return false;
+
+			std::size_t size = m_decomposition.getFieldSize();
+			m_u0.assign(size, T(0.0f));
+			m_u1.assign(size, T(0.0f));
+			m_v0.assign(size, T(0.0f));
+			m_v1.assign(size, T(0.0f));
+			m_d0.assign(size, T(0.0f));
+			m_d1.assign(size, T(0.0f));
+			m_divergence.assign(size, scalar(0.0));
+			m_pressure.assign(size, scalar(0.0));
+
+			initialCondition();
+			return true;
+		}
+
+		/// Takes effect on the next init, at least 2 so backtraces may leave the block
+		void setHaloWidth(uint haloWidth)
+		{
+			m_haloWidth = std::max(haloWidth, uint(2));
+		}
+
+		uint getHaloWidth() const
+		{
+			return m_haloWidth;
+		}
+
+		void setDiffusion(scalar diffusion)
+		{
+			m_diffusion = glm::clamp(diffusion, scalar(0.0), scalar(1.0));
+		}
+
+		scalar getDiffusion() const
+		{
+			return m_diffusion;
+		}
+
+		void setViscosity(scalar viscosity)
+		{
+			m_viscosity = glm::clamp(viscosity, scalar(0.0), scalar(1.0));
+		}
+
+		scalar getViscosity() const
+		{
+			return m_viscosity;
+		}
+
+		void setObstacle(bool enabled)
+		{
+			m_enabledObstacle = enabled;
+		}
+
+		void setTimeStepping(timeSteppingType timeStepping)
+		{
+			m_timeStepping = timeStepping;
+		}
+
+		void setCflNumber(scalar cflNumber)
+		{
+			m_cflNumber = cflNumber;
+		}
+
+		scalar getCflNumber() const
+		{
+			return m_cflNumber;
+		}
+
+		uint getNumSubsteps() const
+		{
+			return m_numSubsteps;
+		}
+
+		uint getNumCellsX() const
+		{
+			return m_numberCellsX;
+		}
+
+		uint getNumCellsY() const
+		{
+			return m_numberCellsY;
+		}
+
+		const Decomposition & getDecomposition() const
+		{
+			return m_decomposition;
+		}
+
+		/// Extremes over the whole grid, reduced across the ranks every step
+		scalar getMaxDensity() const
+		{
+			return m_maxDensity;
+		}
+
+		scalar getMinDensity() const
+		{
+			return m_minDensity;
+		}
+
+		scalar getMaxSpeed() const
+		{
+			return m_maxSpeed;
+		}
+
+		scalar getMinSpeed() const
+		{
+			return m_minSpeed;
+		}
+
+		/// Global residuals of the last pressure solve
+		const SolverStatistics & getPressureStatistics() const
+		{
+			return m_pressureStatistics;
+		}
+
+		/// Collective, see Fluid::computeDivergenceNorm
+		double computeDivergenceNorm()
+		{
+			double sumSquares = 0.0;
+			forEachCell([&](uint i, uint j, std::size_t cter)
+			{
+				std::size_t stride = m_decomposition.getStride();
+				scalar divergence = scalar(0.5) * inverseSpacing() * (scalar(m_u1[cter + 1]) - scalar(m_u1[cter - 1]) + scalar(m_v1[cter + stride]) - scalar(m_v1[cter - stride]));
+				sumSquares += double(divergence) * double(divergence);
+			});
+			return std::sqrt(m_decomposition.reduceSum(sumSquares) / (double(m_numberCellsX) * double(m_numberCellsY)));
+		}
+
+		/// Collective, see Fluid::computeTaylorGreenError
+		double computeTaylorGreenError()
+		{
+			double sumSquares = 0.0;
+			forEachCell([&](uint i, uint j, std::size_t cter)
+			{
+				scalar x = (i - scalar(0.5)) * m_spacingCells;
+				scalar y = (j - scalar(0.5)) * m_spacingCells;
+				double du = double(scalar(m_u1[cter]) - TaylorGreenVortexVelocityU(scalar(0.0), x, y));
+				double dv = double(scalar(m_v1[cter]) - TaylorGreenVortexVelocityV(scalar(0.0), x, y));
+				sumSquares += du * du + dv * dv;
+			});
+			return std::sqrt(m_decomposition.reduceSum(sumSquares) / (double(m_numberCellsX) * double(m_numberCellsY)));
+		}
+
+	protected:
+		/// function(i, j, offset) over the cells of the block, rows outermost
+		template <typename Function>
+		void forEachCell(const Function & function) const
+		{
+			uint iBegin = m_decomposition.getFirstCellX();
+			uint jBegin = m_decomposition.getFirstCellY();
+			uint iEnd = iBegin + m_decomposition.getNumCellsX();
+			uint jEnd = jBegin + m_decomposition.getNumCellsY();
+			for (uint j = jBegin; j < jEnd; j++)
+			{
+				std::size_t offset = m_decomposition.localIndex(iBegin, j);
+				for (uint i = iBegin; i < iEnd; i++, offset++)
+				{
+					function(i, j, offset);
+				}
+			}
+		}
+
+		/// Ghost cells stay zero like in Fluid, the interfaces are filled so
+		/// the halos never hold stale data
+		void initialCondition()
+		{
+			forEachCell([&](uint i, uint j, std::size_t cter)
+			{
+				scalar x = (i - scalar(0.5)) * m_spacingCells;
+				scalar y = (j - scalar(0.5)) * m_spacingCells;
+				m_u1[cter] = T(TaylorGreenVortexVelocityU(scalar(0.0), x, y));
+				m_v1[cter] = T(TaylorGreenVortexVelocityV(scalar(0.0), x, y));
+				m_d1[cter] = T(TaylorGreenVortexDensity(scalar(0.0), x, y));
+			});
+
+			T * fields[] = { m_u1.data(), m_v1.data(), m_d1.data() };
+			m_decomposition.exchangeInterfaces(fields, 3);
+			findExtremeValues();
+		}
+
+		/// Local extremes first, then a single reduction of the maxima and
+		/// the negated minima
+		void findExtremeValues()
+		{
+			const scalar infinity = std::numeric_limits<scalar>::infinity();
+			scalar maxSpeed = -infinity;
+			scalar minSpeed = +infinity;
+			scalar maxDensity = -infinity;
+			scalar minDensity = +infinity;
+
+			forEachCell([&](uint i, uint j, std::size_t cter)
+			{
+				scalar u = scalar(m_u1[cter]);
+				scalar v = scalar(m_v1[cter]);
+				scalar speedCell = std::sqrt(u * u + v * v);
+				findMinMaxValue(speedCell, maxSpeed, minSpeed);
+
+				scalar densityCell = scalar(m_d1[cter]);
+				findMinMaxValue(densityCell, maxDensity, minDensity);
+			});
+
+			scalar extremes[] = { maxSpeed, -minSpeed, maxDensity, -minDensity };
+			m_decomposition.reduceMax(extremes, 4);
+			m_maxSpeed = extremes[0];
+			m_minSpeed = -extremes[1];
+			m_maxDensity = extremes[2];
+			m_minDensity = -extremes[3];
+		}
+
+		/// The cells of the square are zeroed after every step. They are not
+		/// walls of the diffusion, advection and projection as the solids of
+		/// Fluid are, the flow runs through them during the step.
+		void addSimpleObstacle()
+		{
+			uint numberCellsUnit = std::min(m_numberCellsX, m_numberCellsY);
+			if (!m_enabledObstacle || numberCellsUnit <= 8) return;
+
+			uint centerIndexi = m_numberCellsX / 2;
+			uint centerIndexj = m_numberCellsY / 2;
+			uint extensionObstacle = numberCellsUnit / 8;
+			forEachCell([&](uint i, uint j, std::size_t cter)
+			{
+				if (i + extensionObstacle < centerIndexi || i > centerIndexi + extensionObstacle) return;
+				if (j + extensionObstacle < centerIndexj || j > centerIndexj + extensionObstacle) return;
+
+				m_u1[cter] = T(0.0f);
+				m_v1[cter] = T(0.0f);
+				m_d1[cter] = T(0.0f);
+			});
+
+			T * fields[] = { m_u1.data(), m_v1.data(), m_d1.data() };
+			m_decomposition.exchangeInterfaces(fields, 3);
+		}
+
+		/// Cells per unit length
+		scalar inverseSpacing() const
+		{
+			return scalar(std::min(m_numberCellsX, m_numberCellsY));
+		}
+
+		/// relaxRedBlack on the block, the colour of a cell follows its
+		/// global index
+		template <typename S>
+		void relaxColour(S * const * x, const S * const * b, uint numFields, scalar a, scalar c, uint colour)
+		{
+			std::ptrdiff_t stride = std::ptrdiff_t(m_decomposition.getStride());
+			uint iBegin = m_decomposition.getFirstCellX();
+			uint jBegin = m_decomposition.getFirstCellY();
+			uint iEnd = iBegin + m_decomposition.getNumCellsX();
+			uint jEnd = jBegin + m_decomposition.getNumCellsY();
+			scalar invc = scalar(1.0) / c;
+
+			for (uint j = jBegin; j < jEnd; j++)
+			{
+				uint iFirst = iBegin + ((iBegin + j + colour) & 1);
+				std::size_t offset = m_decomposition.localIndex(iFirst, j);
+				for (uint f = 0; f < numFields; f++)
+				{
+					S * cell = x[f] + offset;
+					const S * cellOld = b[f] + offset;
+					for (uint i = iFirst; i < iEnd; i += 2, cell += 2, cellOld += 2)
+					{
+						*cell = S((scalar(*cellOld) + a * (scalar(cell[-1]) + scalar(cell[1]) + scalar(cell[-stride]) + scalar(cell[stride]))) * invc);
+					}
+				}
+			}
+		}
+
+		/// Red-black Gauss-Seidel with the interfaces refreshed between the
+		/// colours and all the halos after every sweep
+		template <typename S>
+		void relax(S * const * x, const S * const * b, uint numFields, scalar a, scalar c, uint sweeps)
+		{
+			for (uint s = 0; s < sweeps; s++)
+			{
+				relaxColour(x, b, numFields, a, c, 0);
+				m_decomposition.exchangeInterfaces(x, numFields);
+				relaxColour(x, b, numFields, a, c, 1);
+				m_decomposition.exchangeHalos(x, numFields);
+			}
+		}
+
+		/// advectRowScalar on the block. Backtraces are bounded in global
+		/// cell units exactly like on a single process and only the corner
+		/// cell is moved to the block: positions the wall treatment sent to
+		/// the far side of a periodic domain are brought back through the
+		/// seam, anything still outside the halo is clamped to it.
+		template <boundaryType B>
+		void advectFields(T * const * xNew, const T * const * xOld, uint numFields, const T * u, const T * v, scalar dt)
+		{
+			scalar dt0 = dt * inverseSpacing();
+			std::size_t stride = m_decomposition.getStride();
+			int halo = int(m_decomposition.getHaloWidth());
+			int originX = int(m_decomposition.getFirstCellX()) - halo;
+			int originY = int(m_decomposition.getFirstCellY()) - halo;
+			int lastX = int(m_decomposition.getNumCellsX()) + 2 * halo - 2;
+			int lastY = int(m_decomposition.getNumCellsY()) + 2 * halo - 2;
+
+			forEachCell([&](uint i, uint j, std::size_t cter)
+			{
+				scalar x = i - dt0 * scalar(u[cter]);
+				scalar y = j - dt0 * scalar(v[cter]);
+				x = advectionBoundaryCell<B>(x, m_numberCellsX);
+				y = advectionBoundaryCell<B>(y, m_numberCellsY);
+
+				uint i0 = (uint)x;
+				uint j0 = (uint)y;
+
+				scalar s1 = x - i0;
+				scalar s0 = 1 - s1;
+				scalar t1 = y - j0;
+				scalar t0 = 1 - t1;
+
+				int i0Local = localCorner<B>(int(i0) - originX, lastX, int(m_numberCellsX));
+				int j0Local = localCorner<B>(int(j0) - originY, lastY, int(m_numberCellsY));
+
+				std::size_t index00 = std::size_t(i0Local) + std::size_t(j0Local) * stride;
+				for (uint f = 0; f < numFields; f++)
+				{
+					const T * old = xOld[f];
+					xNew[f][cter] = T(
+						s0 * (t0 * scalar(old[index00]) + t1 * scalar(old[index00 + stride])) +
+						s1 * (t0 * scalar(old[index00 + 1]) + t1 * scalar(old[index00 + stride + 1])));
+				}
+			});
+
+			m_decomposition.exchangeHalos(xNew, numFields);
+		}
+
+		template <boundaryType B>
+		static int localCorner(int corner, int last, int numberCells)
+		{
+			if (B == PERIODIC)
+			{
+				if (corner < 0) corner += numberCells;
+				if (corner > last) corner -= numberCells;
+			}
+			return std::min(std::max(corner, 0), last);
+		}
+
+		/// Starts from zero like Fluid with its fixed 20 sweeps, a warm start
+		/// only pays off for a solve that runs to a tolerance
+		void project()
+		{
+			std::size_t stride = m_decomposition.getStride();
+			forEachCell([&](uint i, uint j, std::size_t cter)
+			{
+				m_divergence[cter] = -scalar(0.5 * m_spacingCells) * (scalar(m_u1[cter + 1]) - scalar(m_u1[cter - 1]) + scalar(m_v1[cter + stride]) - scalar(m_v1[cter - stride]));
+				m_pressure[cter] = scalar(0.0);
+			});
+			scalar * pressureFields[] = { m_divergence.data(), m_pressure.data() };
+			m_decomposition.exchangeHalos(pressureFields, 2);
+
+			scalar * pressure[] = { m_pressure.data() };
+			const scalar * divergence[] = { m_divergence.data() };
+			m_pressureStatistics.initialResidual = pressureResidual();
+			relax(pressure, divergence, 1, scalar(1.0), scalar(4.0), 20);
+			m_pressureStatistics.residual = pressureResidual();
+			m_pressureStatistics.iterations = 20;
+
+			forEachCell([&](uint i, uint j, std::size_t cter)
+			{
+				m_u1[cter] -= scalar(0.5) * inverseSpacing() * (m_pressure[cter + 1] - m_pressure[cter - 1]);
+				m_v1[cter] -= scalar(0.5) * inverseSpacing() * (m_pressure[cter + stride] - m_pressure[cter - stride]);
+			});
+			T * velocity[] = { m_u1.data(), m_v1.data() };
+			m_decomposition.exchangeHalos(velocity, 2);
+		}
+
+		/// Collective rms of the pressure equation residual
+		double pressureResidual()
+		{
+			std::size_t stride = m_decomposition.getStride();
+			double sumSquares = 0.0;
+			forEachCell([&](uint i, uint j, std::size_t cter)
+			{
+				scalar residual = m_divergence[cter] - (scalar(4.0) * m_pressure[cter] - m_pressure[cter - 1] - m_pressure[cter + 1] - m_pressure[cter - stride] - m_pressure[cter + stride]);
+				sumSquares += double(residual) * double(residual);
+			});
+			return std::sqrt(m_decomposition.reduceSum(sumSquares) / (double(m_numberCellsX) * double(m_numberCellsY)));
+		}
+
+	private:
+		Decomposition m_decomposition;
+		uint m_haloWidth = DECOMPOSITION_HALO_WIDTH;
+
+		scalar m_spacingCells = 0.0;
+		uint m_numberCellsX = 64;
+		uint m_numberCellsY = 64;
+
+		/// Blocks with their halos, old and new step
+		std::vector<T> m_u0;
+		std::vector<T> m_u1;
+		std::vector<T> m_v0;
+		std::vector<T> m_v1;
+		std::vector<T> m_d0;
+		std::vector<T> m_d1;
+		std::vector<scalar> m_divergence;
+		std::vector<scalar> m_pressure;
+
+		/// Parameters
+		scalar m_diffusion = scalar(0.0);
+		scalar m_viscosity = scalar(0.0);
+		bool m_enabledObstacle = false;
+		timeSteppingType m_timeStepping = TIME_STEPPING_FIXED;
+		scalar m_cflNumber = scalar(CFL_NUMBER);
+		uint m_numSubsteps = 0;
+
+		/// Global information from the fluid
+		scalar m_maxDensity = -std::numeric_limits<scalar>::infinity();
+		scalar m_minDensity = +std::numeric_limits<scalar>::infinity();
+		scalar m_maxSpeed = -std::numeric_limits<scalar>::infinity();
+		scalar m_minSpeed = +std::numeric_limits<scalar>::infinity();
+
+		SolverStatistics m_pressureStatistics;
+	};
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include "Definitions.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <new>
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define ARENA_ALIGNMENT std::size_t(64)
+#define ARENA_HUGE_PAGE_SIZE (std::size_t(2) << 20)
+
+namespace FluidSimulation
+{
+	/// One block of memory sliced into the fields of a solver, every slice
+	/// starts on a cache line. Reserving rewinds the slices and only
+	/// replaces the block when it is too small, so a regrid within the
+	/// capacity reslices in place. On Linux the block is mapped straight
+	/// from the system, its pages are zero until written and only what was
+	/// handed out since is cleared; with huge pages it is aligned to 2 MB
+	/// and advised for transparent huge pages. Elsewhere it is an aligned
+	/// heap block.
+	class FieldArena
+	{
+	public:
+		FieldArena() {}
+
+		~FieldArena()
+		{
+			release();
+		}
+
+		FieldArena(const FieldArena &) = delete;
+		FieldArena & operator=(const FieldArena &) = delete;
+
+		/// A different setting drops the block, the next reserve maps a new one
+		void setHugePages(bool enabled)
+		{
+			if (enabled == m_hugePages) return;
+			release();
+			m_hugePages = enabled;
+		}
+
+		bool isUsingHugePages() const
+		{
+			return m_hugePages;
+		}
+
+		/// Bytes a slice of count values takes, padding included
+		template <typename T>
+		static std::size_t sliceBytes(std::size_t count)
+		{
+			return roundUp(count * sizeof(T), ARENA_ALIGNMENT);
+		}
+
+		void reserve(std::size_t bytes)
+		{
+			m_offset = 0;
+			if (bytes <= m_capacity) return;
+
+			release();
+			allocate(bytes);
+		}
+
+		template <typename T>
+		T * slice(std::size_t count)
+		{
+			std::size_t bytes = sliceBytes<T>(count);
+			if (bytes > m_capacity - m_offset) throw std::bad_alloc();
+
+			T * pointer = reinterpret_cast<T *>(m_memory + m_offset);
+			m_offset += bytes;
+			return pointer;
+		}
+
+		/// Zeroes the slices handed out since the last reserve. Every field
+		/// type has zero as all bits clear. Memory never handed out before is
+		/// still zero and skipped, whatever is handed out now counts as
+		/// written from here on.
+		void clear()
+		{
+			std::memset(m_memory, 0, std::min(m_offset, m_written));
+			m_written = std::max(m_written, m_offset);
+		}
+
+		std::size_t getCapacity() const
+		{
+			return m_capacity;
+		}
+
+		void release()
+		{
+			if (!m_block) return;
+
+#if defined(_WIN32)
+			_aligned_free(m_block);
+#else
+			munmap(m_block, m_blockBytes);
+#endif
+			m_block = nullptr;
+			m_memory = nullptr;
+			m_blockBytes = 0;
+			m_capacity = 0;
+			m_offset = 0;
+			m_written = 0;
+		}
+
+	protected:
+		static std::size_t roundUp(std::size_t bytes, std::size_t alignment)
+		{
+			return (bytes + alignment - 1) / alignment * alignment;
+		}
+
+		void allocate(std::size_t bytes)
+		{
+			std::size_t alignment = m_hugePages ? ARENA_HUGE_PAGE_SIZE : ARENA_ALIGNMENT;
+			m_capacity = roundUp(bytes, alignment);
+
+#if defined(_WIN32)
+			m_blockBytes = m_capacity;
+			m_block = _aligned_malloc(m_blockBytes, ARENA_ALIGNMENT);
+			if (!m_block) { m_capacity = 0; throw std::bad_alloc(); }
+			m_memory = static_cast<unsigned char *>(m_block);
+			m_written = m_capacity;
+#else
+			/// Mappings start on a page, huge pages need the extra room to align
+			m_blockBytes = m_capacity + (m_hugePages ? ARENA_HUGE_PAGE_SIZE : 0);
+			m_block = mmap(nullptr, m_blockBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (m_block == MAP_FAILED) { m_block = nullptr; m_blockBytes = 0; m_capacity = 0; throw std::bad_alloc(); }
+
+			std::uintptr_t address = reinterpret_cast<std::uintptr_t>(m_block);
+			m_memory = reinterpret_cast<unsigned char *>(roundUp(address, alignment));
+#if defined(MADV_HUGEPAGE)
+			if (m_hugePages) madvise(m_memory, m_capacity, MADV_HUGEPAGE);
+#endif
+			m_written = 0;
+#endif
+		}
+
+	private:
+		void * m_block = nullptr;
+		unsigned char * m_memory = nullptr;
+		std::size_t m_blockBytes = 0;
+		std::size_t m_capacity = 0;
+		std::size_t m_offset = 0;
+
+		/// Bytes from the start that may no longer be zero
+		std::size_t m_written = 0;
+
+		bool m_hugePages = false;
+	};
+}
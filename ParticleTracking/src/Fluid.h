@@ -1,101 +1,369 @@
 #pragma once
+#include "AdiDiffusion.h"
 #include "AnalyticalSolutions.h"
+#include "Advection.h"
 #include "BoundaryConditions.h"
+#include "FieldArena.h"
 #include "TimeIntegrator.h"
-
-#define TIME_INTEGRATION_INCREMENT_FLUID real(0.1)
-#define VISCOSITY_STEP real(0.001)
-#define DIFFUSION_STEP real(0.001)
+#include "SceneObject.h"
+#include "SolidMask.h"
+#include "ThreadPool.h"
+#include "TileActivity.h"
+#include "Relaxation.h"
+#include "ConjugateGradient.h"
+#include "SpectralSolver.h"
+#include "Multigrid.h"
+#include "Precision.h"
+#include "Utilities.h"
+#include <type_traits>
+#include <mutex>
+#include <vector>
+
+#define TIME_INTEGRATION_INCREMENT_FLUID 0.1
+#define VISCOSITY_STEP 0.001
+#define DIFFUSION_STEP 0.001
 #define NUM_CELLS_MAX 512
 #define NUM_CELLS_MIN 4
+#define CFL_NUMBER 5.0
+#define MAX_SUBSTEPS 16
+#define ACTIVITY_THRESHOLD 1.0e-4
+#define MAX_SCALAR_CHANNELS ADVECTION_MAX_FIELDS
 
 namespace FluidSimulation
 {
+	enum pressureSolverType
+	{
+		PRESSURE_GAUSS_SEIDEL = 0,
+		PRESSURE_MULTIGRID,
+		PRESSURE_CONJUGATE_GRADIENT,
+		PRESSURE_SPECTRAL
+	};
+
+	enum diffusionSolverType
+	{
+		DIFFUSION_GAUSS_SEIDEL = 0,
+		DIFFUSION_SPECTRAL,
+		DIFFUSION_ADI
+	};
+
+	enum advectionSchemeType
+	{
+		ADVECTION_SEMI_LAGRANGIAN = 0,
+		ADVECTION_MACCORMACK,
+		ADVECTION_BFECC
+	};
+
+	enum timeSteppingType
+	{
+		TIME_STEPPING_FIXED = 0,
+		TIME_STEPPING_ADAPTIVE
+	};
+
+	enum pressureGuessType
+	{
+		PRESSURE_GUESS_ZERO = 0,
+		PRESSURE_GUESS_PREVIOUS,
+		PRESSURE_GUESS_EXTRAPOLATED
+	};
+
+	/// Steps of the last pressure solves. The pressure of the projection is
+	/// the physical one times the step, guesses from earlier solves are
+	/// rescaled to the new step and extrapolated linearly in time.
+	template <typename T>
+	struct PressureHistory
+	{
+		uint numSolves = 0;
+		T timeStep = T(0.0);
+		T previousTimeStep = T(0.0);
+
+		/// The pressure before the last one is stored too
+		bool hasPrevious = false;
+
+		/// Weights of the last and of the previous pressure in the guess for
+		/// a step dt, both zero without history
+		void guessWeights(pressureGuessType guess, T dt, T & last, T & previous) const
+		{
+			last = previous = T(0.0);
+			if (guess == PRESSURE_GUESS_ZERO || numSolves == 0) return;
+
+			T ratio = dt / timeStep;
+			if (guess == PRESSURE_GUESS_EXTRAPOLATED && hasPrevious)
+			{
+				last = ratio * (T(1.0) + ratio);
+				previous = ratio * dt / previousTimeStep;
+				return;
+			}
+			last = ratio;
+		}
+
+		void record(pressureGuessType guess, T dt)
+		{
+			hasPrevious = (guess == PRESSURE_GUESS_EXTRAPOLATED) && (numSolves > 0);
+			previousTimeStep = timeStep;
+			timeStep = dt;
+			numSolves++;
+		}
+
+		void clear()
+		{
+			numSolves = 0;
+			hasPrevious = false;
+		}
+	};
+
+	/// Stable fluids solver on a grid of nx x ny square cells, the shorter
+	/// side of the domain has unit length. T is the storage type of the
+	/// transported fields (velocity and density): float, double, or the 16
+	/// bit float16 / bfloat16 formats, which are computed in float. The
+	/// pressure solve always runs in the compute precision.
+	template <typename T>
 	class Fluid
 		: public SceneObject
-		, public TimeIntegrator
+		, public TimeIntegrator<Compute<T>>
 		, public BoundaryConditions
 	{
 	public:
+		typedef T storage;
+		typedef Compute<T> scalar;
+
 		Fluid()
 		{
-			this->setTimeIncrement(TIME_INTEGRATION_INCREMENT_FLUID);
-			this->setTimeStep(TIME_INTEGRATION_INCREMENT_FLUID);
+			this->setTimeIncrement(scalar(TIME_INTEGRATION_INCREMENT_FLUID));
+			this->setTimeStep(scalar(TIME_INTEGRATION_INCREMENT_FLUID));
+		}
+
+		/// Advances one frame of the time step. In adaptive mode the frame is
+		/// split in substeps moving the fastest cell at most CFL_NUMBER cells,
+		/// with at most MAX_SUBSTEPS of them: quiet flows take the whole frame
+		/// in one step and only violent frames pay for the substeps.
+		void update()
+		{
+			if (m_timeStepping == TIME_STEPPING_FIXED)
+			{
+				advance(this->m_timeStep);
+				m_numSubsteps = 1;
+				return;
+			}
+
+			scalar remaining = this->m_timeStep;
+			scalar minimumStep = remaining / scalar(MAX_SUBSTEPS);
+			m_numSubsteps = 0;
+			while (remaining > scalar(0.0))
+			{
+				scalar dt = std::max(computeStableTimeStep(), minimumStep);
+
+				/// Slivers left by rounding are merged into the last substep
+				if (dt > remaining - scalar(0.5) * minimumStep) dt = remaining;
+
+				advance(dt);
+				remaining -= dt;
+				m_numSubsteps++;
+			}
 		}
 
-		~Fluid()
+		/// Largest step moving the fastest cell CFL_NUMBER cells, based on
+		/// the speed at the end of the last step and the drags since then
+		scalar computeStableTimeStep()
 		{
-			deallocateMemory();
+			scalar maxSpeed = getMaxSpeed();
+			if (!(maxSpeed > scalar(0.0))) return std::numeric_limits<scalar>::max();
+			return m_cflNumber * m_spacingCells / maxSpeed;
 		}
 
-		void update()
-		{			
+		/// Boundary handling is resolved here once per step, the kernels
+		/// below are instantiated for each wall type
+		void advance(scalar dt)
+		{
+			(m_boundary == PERIODIC) ? updateStep<PERIODIC>(dt) : updateStep<DIRICHLET>(dt);
+		}
+
+		/// The step as a graph of stages on the thread pool. Diffusion goes
+		/// from the current fields into the old ones and advection brings
+		/// them back, so the buffers end the step where they started. The
+		/// density diffusion overlaps the velocity advection and projection.
+		template <boundaryType B>
+		void updateStep(scalar dt)
+		{
+			/// Extremes read since the previous step are reduced by the passes
+			/// writing the fields, the others on their next read
+			bool fuseSpeed = m_speedRangeRead;
+			bool fuseDensity = m_densityRangeRead;
+			m_speedRangeRead = m_densityRangeRead = false;
+			m_speedRangeValid = m_densityRangeValid = false;
+
+			if (m_sparseTiles) updateActivity(dt);
+			const SpanList * velocitySpans = passSpans(m_velocityActivity);
+			const SpanList * densitySpans = passSpans(m_densityActivity);
+
+			TaskGraph graph;
+
+			/// Velocity diffuses with the viscosity, the scalar channels with
+			/// the diffusion, each group as one batch whose red-black sweeps
+			/// spread the rows over the pool. The groups are independent tasks,
+			/// or one task when they share the coefficient and form a single
+			/// batch, on a single thread, and with the spectral solver, which
+			/// cannot run two solves at the same time. With sparse tiles the
+			/// two groups visit different cells.
+			uint numScalars = m_numScalars;
+			uint numDiffused = 2 + numScalars;
+			T * diffusedNew[2 + MAX_SCALAR_CHANNELS] = { m_u0, m_v0 };
+			const T * diffusedOld[2 + MAX_SCALAR_CHANNELS] = { m_u1, m_v1 };
+			solidBoundaryType solidBoundary[2 + MAX_SCALAR_CHANNELS] = { SOLID_NO_SLIP, SOLID_NO_SLIP };
+			for (uint k = 0; k < numScalars; k++)
+			{
+				diffusedNew[2 + k] = m_scalars0[k];
+				diffusedOld[2 + k] = m_scalars1[k];
+				solidBoundary[2 + k] = SOLID_ZERO_FLUX;
+			}
+			scalar viscousTerm = diffusionTerm(m_viscosity, dt);
+			scalar densityTerm = diffusionTerm(m_diffusion, dt);
+
+			/// The velocity keeps its statistics in slot 0, the channels in
+			/// slot 1
+			uint velocityDiffused, scalarsDiffused;
+			for (SolverStatistics & statistics : m_diffusionStatistics) statistics = SolverStatistics();
+			bool singleTask = !m_sparseTiles && (viscousTerm == densityTerm || m_threadPool.getNumThreads() == 1 || isSpectralDiffusionActive());
+			if (singleTask)
+			{
+				velocityDiffused = scalarsDiffused = graph.addTask([=]()
+				{
+					if (viscousTerm == densityTerm)
+					{
+						m_diffusionStatistics[0] = diffuseFields<B>(diffusedNew, diffusedOld, numDiffused, viscousTerm, solidBoundary, velocitySpans);
+						return;
+					}
+					m_diffusionStatistics[0] = diffuseFields<B>(diffusedNew, diffusedOld, 2, viscousTerm, solidBoundary, velocitySpans);
+					m_diffusionStatistics[1] = diffuseFields<B>(diffusedNew + 2, diffusedOld + 2, numScalars, densityTerm, solidBoundary + 2, velocitySpans);
+				});
+			}
+			else
+			{
+				velocityDiffused = graph.addTask([=]() { m_diffusionStatistics[0] = diffuseFields<B>(diffusedNew, diffusedOld, 2, viscousTerm, solidBoundary, velocitySpans); });
+				scalarsDiffused = graph.addTask([=]() { m_diffusionStatistics[1] = diffuseFields<B>(diffusedNew + 2, diffusedOld + 2, numScalars, densityTerm, solidBoundary + 2, densitySpans); });
+			}
+
 			/// Velocity step
-			std::swap(m_u0, m_u1);
-			std::swap(m_v0, m_v1);
-			diffuse(m_u1, m_u0, m_diffusion);
-			diffuse(m_v1, m_v0, m_diffusion);
+			uint advected = graph.addTask([=]()
+			{
+				T * velocityNew[] = { m_u1, m_v1 };
+				const T * velocityOld[] = { m_u0, m_v0 };
+				advectFields<B>(velocityNew, velocityOld, 2, m_u0, m_v0, dt, solidBoundary, velocitySpans);
+			}, { velocityDiffused });
+			uint projected = graph.addTask([=]() { project<B>(dt, velocitySpans, fuseSpeed ? &m_speedRange : nullptr); }, { advected });
+
+			/// Scalar step, one backtrace per cell for all the channels
+			graph.addTask([=]()
+			{
+				advectFields<B>(m_scalars1, m_scalars0, numScalars, m_u1, m_v1, dt, solidBoundary + 2, densitySpans, fuseDensity ? &m_densityRange : nullptr);
+			}, { projected, scalarsDiffused });
 
-			std::swap(m_u0, m_u1);
-			std::swap(m_v0, m_v1);
-			advect(m_u1, m_u0, m_u0, m_v0, m_timeStep);
-			advect(m_v1, m_v0, m_u0, m_v0, m_timeStep);
-			project();
+			m_threadPool.run(graph);
+			m_speedRangeValid = fuseSpeed;
+			m_densityRangeValid = fuseDensity;
+		}
 
-			/// Density step
-			std::swap(m_d0, m_d1);
-			diffuse(m_d1, m_d0, m_diffusion);
+		scalar getSpacingCells() const
+		{
+			return m_spacingCells;
+		}
 
-			std::swap(m_d0, m_d1);
-			advect(m_d1, m_d0, m_u1, m_v1, m_timeStep);
+		scalar getVelocityU(uint i, uint j)
+		{
+			return scalar(m_u1[rowLinearIndexMap(i, j)]);
+		}
 
-			/// Find min/max values
-			findExtremeValues();			
+		scalar getVelocityV(uint i, uint j)
+		{
+			return scalar(m_v1[rowLinearIndexMap(i, j)]);
+		}
 
-			/// Add an square obstacle
-			addSimpleObstacle();
+		scalar getDensity(uint i, uint j)
+		{
+			return scalar(m_scalars1[0][rowLinearIndexMap(i, j)]);
 		}
 
-		real getSpacingCells() const
+		/// Passive scalars advected and diffused like the density, which is
+		/// channel 0: dyes, temperature, tracer concentrations. A new count
+		/// reallocates the fields and restarts the simulation.
+		void setNumScalars(uint numScalars)
 		{
-			return m_spacingCells;
+			m_numScalars = glm::clamp(numScalars, uint(1), uint(MAX_SCALAR_CHANNELS));
+			if (m_u1) init();
+		}
+
+		uint getNumScalars() const
+		{
+			return m_numScalars;
+		}
+
+		scalar getScalar(uint channel, uint i, uint j)
+		{
+			return scalar(m_scalars1[channel][rowLinearIndexMap(i, j)]);
 		}
 
-		real getVelocityU(uint i, uint j)
+		/// Extremes of a channel over the flow, a pass over the field
+		ValueRange<scalar> getScalarRange(uint channel)
 		{
-			return m_u1[rowLinearIndexMap(i, j)];
+			ValueRange<scalar> range;
+			reduceRows(range, [&](ValueRange<scalar> & partial, uint j) { includeRow(partial, m_scalars1[channel], j); });
+			return range;
 		}
 
-		real getVelocityV(uint i, uint j)
+		/// Values per field, ghost cells included
+		std::size_t getFieldSize() const
 		{
-			return m_v1[rowLinearIndexMap(i, j)];
+			return fieldSize();
 		}
 
-		real getDensity(uint i, uint j)
+		/// Current velocity and density in the compute precision, row major
+		/// with the ghost cells like the fields themselves
+		void copyFields(scalar * u, scalar * v, scalar * d) const
 		{
-			return m_d1[rowLinearIndexMap(i, j)];
+			std::size_t size = fieldSize();
+			for (std::size_t n = 0; n < size; n++)
+			{
+				u[n] = scalar(m_u1[n]);
+				v[n] = scalar(m_v1[n]);
+				d[n] = scalar(m_scalars1[0][n]);
+			}
 		}
 
 	public:
+		/// Keeps the maximum speed current so the next adaptive step sees the
+		/// drag. Drags, sources and sinks inside solids are ignored.
 		void addDrag(uint i, uint j, vec2 force)
 		{
+			if (!isInterior(i, j) || m_solidMask.isSolid(i, j)) return;
+			m_velocityActivity.touch(1, i, j);
 			m_u1[rowLinearIndexMap(i, j)] += force.x;
 			m_v1[rowLinearIndexMap(i, j)] += force.y;
+			if (m_speedRangeValid) m_speedRange.include(cellSpeed(rowLinearIndexMap(i, j)));
 		}
 
-		void addSource(uint i, uint j, real intensity)
+		void addSource(uint i, uint j, scalar intensity)
 		{
-			m_d1[rowLinearIndexMap(i, j)] += intensity;
+			addScalar(0, i, j, intensity);
 		}
 
-		void addSink(uint i, uint j, real intensity)
+		void addSink(uint i, uint j, scalar intensity)
 		{
-			m_d1[rowLinearIndexMap(i, j)] -= intensity;
+			addScalar(0, i, j, -intensity);
 		}
 
+		void addScalar(uint channel, uint i, uint j, scalar amount)
+		{
+			if (!isInterior(i, j) || m_solidMask.isSolid(i, j)) return;
+			m_densityActivity.touch(1, i, j);
+			m_scalars1[channel][rowLinearIndexMap(i, j)] += amount;
+			if (channel == 0) m_densityRangeValid = false;
+		}
+
+		/// The square obstacle in the centre, part of the solids
 		void setObstacle(bool enabled)
 		{
+			if (enabled == m_enabledObstacle) return;
 			m_enabledObstacle = enabled;
+			if (m_u1) rebuildSolids();
 		}
 
 		bool isObstacleEnabled()
@@ -103,426 +371,1164 @@ namespace FluidSimulation
 			return m_enabledObstacle;
 		}
 
+		/// Obstacles of any shape, rasterized again at every resolution
+		void setSolidGeometry(const SolidGeometry & geometry)
+		{
+			m_solidGeometry = geometry;
+			if (m_u1) rebuildSolids();
+		}
+
+		const SolidGeometry & getSolidGeometry() const
+		{
+			return m_solidGeometry;
+		}
+
+		/// Solid cells of the current grid, the geometry and the obstacle
+		const SolidMask & getSolidMask() const
+		{
+			return m_solidMask;
+		}
+
 	public:
 		void init()
 		{
-			m_spacingCells = (real(1.0) / m_numberCells);
+			m_spacingCells = (scalar(1.0) / std::min(m_numberCellsX, m_numberCellsY));
 
-			deallocateMemory();
 			allocateMemory();
 			clearValues();
+			m_multigrid.resize(m_numberCellsX, m_numberCellsY);
+			m_conjugateGradient.resize(m_numberCellsX, m_numberCellsY);
+			m_spectralSolver.resize(m_numberCellsX, m_numberCellsY);
+			std::vector<T>().swap(m_advectionScratch);
+			m_pressureHistory.clear();
+			m_velocityActivity.resize(m_numberCellsX, m_numberCellsY, 2);
+			m_densityActivity.resize(m_numberCellsX, m_numberCellsY, 2);
 
 			initialCondition();
+			rebuildSolids();
+			m_speedRangeValid = m_densityRangeValid = false;
 		}
 
+		/// Interactive refinement keeps the aspect ratio and stays within
+		/// NUM_CELLS_MIN ... NUM_CELLS_MAX
 		void increaseGridSize()
 		{
-			m_numberCells *= 2;
-			if (m_numberCells > NUM_CELLS_MAX) { m_numberCells = NUM_CELLS_MAX; return; }
+			if (2 * std::max(m_numberCellsX, m_numberCellsY) > NUM_CELLS_MAX) return;
+			m_numberCellsX *= 2;
+			m_numberCellsY *= 2;
 			init();
 		}
 
 		void decreaseGridSize()
 		{
-			m_numberCells /= 2;
-			if (m_numberCells < NUM_CELLS_MIN) { m_numberCells = NUM_CELLS_MIN; return; }
+			if (std::min(m_numberCellsX, m_numberCellsY) / 2 < NUM_CELLS_MIN) return;
+			m_numberCellsX /= 2;
+			m_numberCellsY /= 2;
+			init();
+		}
+
+		void setGridSize(uint numberCells)
+		{
+			setGridSize(numberCells, numberCells);
+		}
+
+		/// Any resolution from NUM_CELLS_MIN up, only limited by memory
+		void setGridSize(uint numberCellsX, uint numberCellsY)
+		{
+			m_numberCellsX = std::max(numberCellsX, uint(NUM_CELLS_MIN));
+			m_numberCellsY = std::max(numberCellsY, uint(NUM_CELLS_MIN));
 			init();
 		}
 
 		void increaseDiffusion()
 		{
-			m_diffusion += DIFFUSION_STEP;
-			if (m_diffusion > real(1.0)) { m_diffusion = real(1.0); return; }
+			m_diffusion += scalar(DIFFUSION_STEP);
+			if (m_diffusion > scalar(1.0)) { m_diffusion = scalar(1.0); return; }
 		}
 
 		void decreaseDiffusion()
 		{
-			m_diffusion -= DIFFUSION_STEP;
-			if (m_diffusion < real(0.0)) { m_diffusion = real(0.0); return; }
+			m_diffusion -= scalar(DIFFUSION_STEP);
+			if (m_diffusion < scalar(0.0)) { m_diffusion = scalar(0.0); return; }
+		}
+
+		void setDiffusion(scalar diffusion)
+		{
+			m_diffusion = glm::clamp(diffusion, scalar(0.0), scalar(1.0));
+		}
+
+		void setViscosity(scalar viscosity)
+		{
+			m_viscosity = glm::clamp(viscosity, scalar(0.0), scalar(1.0));
 		}
 
 		void increaseViscosity()
 		{
-			m_viscosity += VISCOSITY_STEP;
-			if (m_viscosity > real(1.0)) { m_viscosity = real(1.0); return; }
+			m_viscosity += scalar(VISCOSITY_STEP);
+			if (m_viscosity > scalar(1.0)) { m_viscosity = scalar(1.0); return; }
 		}
 
 		void decreaseViscosity()
 		{
-			m_viscosity -= VISCOSITY_STEP;
-			if (m_viscosity < real(0.0)) { m_viscosity = real(0.0); return; }
+			m_viscosity -= scalar(VISCOSITY_STEP);
+			if (m_viscosity < scalar(0.0)) { m_viscosity = scalar(0.0); return; }
 		}
 
-		real getMaxDensity() const
+		/// The extremes leave out the solids, their cells are not part of the
+		/// flow. Reading them after a step that did not reduce them takes a
+		/// pass over the field, and makes the next steps reduce them.
+		scalar getMaxDensity()
 		{
-			return m_maxDensity;
+			return densityRange().maximum;
 		}
 
-		real getMinDensity() const
+		scalar getMinDensity()
 		{
-			return m_minDensity;
+			return densityRange().minimum;
 		}
 
-		real getMaxSpeed() const
+		scalar getMaxSpeed()
 		{
-			return m_maxSpeed;
+			return speedRange().maximum;
 		}
 
-		real getMinSpeed() const
+		scalar getMinSpeed()
 		{
-			return m_minSpeed;
+			return speedRange().minimum;
 		}
 
-		real getViscosity() const
+		scalar getViscosity() const
 		{
 			return m_viscosity;
 		}
 
-		real getDiffusion() const
+		scalar getDiffusion() const
 		{
 			return m_diffusion;
 		}
 
+		/// Cells along x, the interactive front end only works on square grids
 		uint getNumCells() const
 		{
-			return m_numberCells;
+			return m_numberCellsX;
 		}
 
-	protected:
-		void deallocateMemory()
+		uint getNumCellsX() const
 		{
-			delete[] m_v1;
-			delete[] m_v0;
-			delete[] m_u1;
-			delete[] m_u0;
-			delete[] m_d1;
-			delete[] m_d0;
-			delete[] m_pressure;
-			delete[] m_divergence;
+			return m_numberCellsX;
 		}
 
-		void allocateMemory()
+		uint getNumCellsY() const
 		{
-			/// Count for the ghost cells with the factor of 2
-			uint size = (m_numberCells + 2) * (m_numberCells + 2);
-			m_divergence = new real[size];
-			m_pressure = new real[size];
-			m_d0 = new real[size];
-			m_d1 = new real[size];
-			m_u0 = new real[size];
-			m_u1 = new real[size];
-			m_v0 = new real[size];
-			m_v1 = new real[size];
+			return m_numberCellsY;
 		}
 
-		void clearValues()
+		void setRelaxationType(relaxationType relaxation)
+		{
+			m_relaxation = relaxation;
+		}
+
+		relaxationType getRelaxationType() const
+		{
+			return m_relaxation;
+		}
+
+		/// Transparent huge pages for the fields, applied at the next init
+		void setHugePages(bool enabled)
+		{
+			m_hugePages = enabled;
+		}
+
+		bool isUsingHugePages() const
+		{
+			return m_arena.isUsingHugePages();
+		}
+
+		void setNumThreads(uint numThreads)
+		{
+			m_threadPool.resize(numThreads);
+		}
+
+		uint getNumThreads() const
+		{
+			return m_threadPool.getNumThreads();
+		}
+
+		void setPressureSolver(pressureSolverType pressureSolver)
+		{
+			m_pressureSolver = pressureSolver;
+		}
+
+		pressureSolverType getPressureSolver() const
+		{
+			return m_pressureSolver;
+		}
+
+		Multigrid<scalar> & getMultigrid()
+		{
+			return m_multigrid;
+		}
+
+		/// Sweeps and tolerance of the Gauss-Seidel pressure solve
+		RelaxationCriterion & getPressureRelaxation()
+		{
+			return m_pressureRelaxation;
+		}
+
+		/// Sweeps and tolerance of the diffusion relaxation
+		RelaxationCriterion & getDiffusionRelaxation()
+		{
+			return m_diffusionRelaxation;
+		}
+
+		ConjugateGradient<scalar> & getConjugateGradient()
+		{
+			return m_conjugateGradient;
+		}
+
+		void setAdvectionKernel(advectionKernelType advectionKernel)
+		{
+			m_advectionKernel = advectionKernel;
+		}
+
+		advectionKernelType getAdvectionKernel() const
+		{
+			return m_advectionKernel;
+		}
+
+		void setAdvectionScheme(advectionSchemeType advectionScheme)
+		{
+			m_advectionScheme = advectionScheme;
+		}
+
+		advectionSchemeType getAdvectionScheme() const
+		{
+			return m_advectionScheme;
+		}
+
+		void setBacktrace(backtraceType backtrace)
+		{
+			m_backtrace = backtrace;
+		}
+
+		backtraceType getBacktrace() const
+		{
+			return m_backtrace;
+		}
+
+		void setInterpolation(interpolationType interpolation)
+		{
+			m_interpolation = interpolation;
+		}
+
+		interpolationType getInterpolation() const
+		{
+			return m_interpolation;
+		}
+
+		void setDiffusionSolver(diffusionSolverType diffusionSolver)
+		{
+			m_diffusionSolver = diffusionSolver;
+		}
+
+		diffusionSolverType getDiffusionSolver() const
+		{
+			return m_diffusionSolver;
+		}
+
+		void setTimeStepping(timeSteppingType timeStepping)
+		{
+			m_timeStepping = timeStepping;
+		}
+
+		timeSteppingType getTimeStepping() const
+		{
+			return m_timeStepping;
+		}
+
+		void switchTimeStepping()
+		{
+			m_timeStepping = (m_timeStepping == TIME_STEPPING_FIXED) ? TIME_STEPPING_ADAPTIVE : TIME_STEPPING_FIXED;
+		}
+
+		void setCflNumber(scalar cflNumber)
+		{
+			m_cflNumber = cflNumber;
+		}
+
+		scalar getCflNumber() const
+		{
+			return m_cflNumber;
+		}
+
+		/// Substeps taken by the last update
+		uint getNumSubsteps() const
+		{
+			return m_numSubsteps;
+		}
+
+		/// Advection and diffusion only visit the tiles where the fields or
+		/// the flow reaching them within a step exceed the threshold, the
+		/// other tiles are set to zero
+		void setSparseTiles(bool enabled)
+		{
+			if (enabled == m_sparseTiles) return;
+			m_sparseTiles = enabled;
+
+			/// The dense passes wrote every tile since the last sparse step
+			if (!enabled || !m_u1) return;
+			m_velocityActivity.touchAll(0);
+			m_velocityActivity.touchAll(1);
+			m_densityActivity.touchAll(0);
+			m_densityActivity.touchAll(1);
+		}
+
+		bool isUsingSparseTiles() const
 		{
-			uint size = (m_numberCells + 2) * (m_numberCells + 2);
-			for (uint n = 0; n < size; n++)
+			return m_sparseTiles;
+		}
+
+		void setActivityThreshold(scalar threshold)
+		{
+			m_activityThreshold = std::max(threshold, scalar(0.0));
+		}
+
+		scalar getActivityThreshold() const
+		{
+			return m_activityThreshold;
+		}
+
+		/// Tiles of the velocity and the density the last sparse step visited
+		const TileActivity & getVelocityActivity() const
+		{
+			return m_velocityActivity;
+		}
+
+		const TileActivity & getDensityActivity() const
+		{
+			return m_densityActivity;
+		}
+
+		/// Spectral solves need a periodic grid with power of two sides and
+		/// no solids, otherwise they fall back to Gauss-Seidel
+		bool isSpectralSolveActive() const
+		{
+			return (m_boundary == PERIODIC) && m_spectralSolver.isSupported() && !m_solidMask.hasSolids();
+		}
+
+		/// Spectral diffusion writes the whole grid, sparse tiles relax instead
+		bool isSpectralDiffusionActive() const
+		{
+			return (m_diffusionSolver == DIFFUSION_SPECTRAL) && isSpectralSolveActive() && !m_sparseTiles;
+		}
+
+		/// The line solves of ADI run across the solids and the inactive
+		/// tiles, both relax instead
+		bool isAdiDiffusionActive() const
+		{
+			return (m_diffusionSolver == DIFFUSION_ADI) && !m_solidMask.hasSolids() && !m_sparseTiles;
+		}
+
+		/// Multigrid and conjugate gradients work on the whole grid, with
+		/// solids the pressure is relaxed over the fluid cells instead
+		pressureSolverType getActivePressureSolver() const
+		{
+			if (m_solidMask.hasSolids()) return PRESSURE_GAUSS_SEIDEL;
+			if (m_pressureSolver == PRESSURE_SPECTRAL && !isSpectralSolveActive()) return PRESSURE_GAUSS_SEIDEL;
+			return m_pressureSolver;
+		}
+
+		/// Rms of the central difference divergence of the velocity over the
+		/// fluid cells
+		double computeDivergenceNorm()
+		{
+			double sumSquares = 0.0;
+			std::size_t numCells = 0;
+			for (uint j = 1; j <= m_numberCellsY; j++)
 			{
-				m_divergence[n] = real(0.0);
-				m_pressure[n] = real(0.0);
-				m_d0[n] = real(0.0);
-				m_d1[n] = real(0.0);
-				m_u0[n] = real(0.0);
-				m_u1[n] = real(0.0);
-				m_v0[n] = real(0.0);
-				m_v1[n] = real(0.0);
+				forEachFlowCell(j, [&](std::size_t cter)
+				{
+					std::size_t stride = std::size_t(m_numberCellsX) + 2;
+					scalar divergence = scalar(0.5) * inverseSpacing() * (scalar(m_u1[cter + 1]) - scalar(m_u1[cter - 1]) + scalar(m_v1[cter + stride]) - scalar(m_v1[cter - stride]));
+					sumSquares += double(divergence) * double(divergence);
+					numCells++;
+				});
 			}
+			return std::sqrt(sumSquares / double(std::max(numCells, std::size_t(1))));
 		}
 
-		void initialCondition()
+		/// Rms velocity error against the Taylor-Green vortex of the initial
+		/// condition. Without viscosity the vortex is a steady solution of the
+		/// Euler equations, whatever it lost is numerical dissipation.
+		double computeTaylorGreenError()
 		{
-			for (uint i = 1; i <= m_numberCells; i++)
+			double sumSquares = 0.0;
+			for (uint j = 1; j <= m_numberCellsY; j++)
 			{
-				real x = (i - 0.5f) * m_spacingCells;
-				for (uint j = 1; j <= m_numberCells; j++)
+				scalar y = (j - scalar(0.5)) * m_spacingCells;
+				for (uint i = 1; i <= m_numberCellsX; i++)
 				{
-					real y = (j - 0.5f) * m_spacingCells;
-
-					real uVelocity = TaylorGreenVortexVelocityU(real(0.0), x, y);
-					real vVelocity = TaylorGreenVortexVelocityV(real(0.0), x, y);
-					real density = TaylorGreenVortexDensity(real(0.0), x, y);
+					scalar x = (i - scalar(0.5)) * m_spacingCells;
+					double du = double(scalar(m_u1[rowLinearIndexMap(i, j)]) - TaylorGreenVortexVelocityU(scalar(0.0), x, y));
+					double dv = double(scalar(m_v1[rowLinearIndexMap(i, j)]) - TaylorGreenVortexVelocityV(scalar(0.0), x, y));
+					sumSquares += du * du + dv * dv;
+				}
+			}
+			return std::sqrt(sumSquares / (double(m_numberCellsX) * double(m_numberCellsY)));
+		}
 
-					m_u1[rowLinearIndexMap(i, j)] = uVelocity;
-					m_v1[rowLinearIndexMap(i, j)] = vVelocity;
-					m_d1[rowLinearIndexMap(i, j)] = density;
+		/// Iterations and residual of the last pressure solve
+		const SolverStatistics & getPressureStatistics() const
+		{
+			return m_pressureStatistics;
+		}
 
-					coreExtremeValues(i, j);
-				}
+		/// Iterations and residual of the last diffusion, the least converged
+		/// of the fields
+		SolverStatistics getDiffusionStatistics() const
+		{
+			SolverStatistics statistics;
+			for (const SolverStatistics & field : m_diffusionStatistics)
+			{
+				if (field.iterations > 0) statistics.merge(field);
 			}
+			return statistics;
+		}
+
+		/// Initial guess of the pressure solves. Only the solves that run to a
+		/// tolerance use it: multigrid, conjugate gradients and Gauss-Seidel
+		/// with a tolerance. The others start from zero
+		void setPressureGuess(pressureGuessType pressureGuess)
+		{
+			m_pressureGuess = pressureGuess;
+		}
+
+		pressureGuessType getPressureGuess() const
+		{
+			return m_pressureGuess;
 		}
 
-		void findExtremeValues()
+		bool pressureSolveToTolerance() const
 		{
-			m_maxDensity = -infinity;
-			m_minDensity = +infinity;
-			m_maxSpeed = -infinity;
-			m_minSpeed = +infinity;
+			pressureSolverType pressureSolver = getActivePressureSolver();
+			if (pressureSolver == PRESSURE_MULTIGRID || pressureSolver == PRESSURE_CONJUGATE_GRADIENT) return true;
+			return pressureSolver == PRESSURE_GAUSS_SEIDEL && m_pressureRelaxation.tolerance > 0.0;
+		}
 
-			for (uint i = 1; i <= m_numberCells; i++)
+	protected:
+		/// Every field is a slice of one arena. It is reserved for at least
+		/// the largest interactive grid, refining and coarsening reslice it
+		/// in place.
+		void allocateMemory()
+		{
+			std::size_t size = fieldSize();
+			std::size_t interactiveSize = (std::size_t(NUM_CELLS_MAX) + 2) * (std::size_t(NUM_CELLS_MAX) + 2);
+			m_arena.setHugePages(m_hugePages);
+			m_arena.reserve(arenaBytes(std::max(size, interactiveSize)));
+
+			m_divergence = m_arena.slice<scalar>(size);
+			m_pressure = m_arena.slice<scalar>(size);
+			m_pressurePrevious = m_arena.slice<scalar>(size);
+			for (uint k = 0; k < m_numScalars; k++) m_scalars0[k] = m_arena.slice<T>(size);
+			for (uint k = 0; k < m_numScalars; k++) m_scalars1[k] = m_arena.slice<T>(size);
+			m_u0 = m_arena.slice<T>(size);
+			m_u1 = m_arena.slice<T>(size);
+			m_v0 = m_arena.slice<T>(size);
+			m_v1 = m_arena.slice<T>(size);
+		}
+
+		std::size_t arenaBytes(std::size_t size) const
+		{
+			return 3 * FieldArena::sliceBytes<scalar>(size) + (4 + 2 * m_numScalars) * FieldArena::sliceBytes<T>(size);
+		}
+
+		void clearValues()
+		{
+			m_arena.clear();
+		}
+
+		void initialCondition()
+		{
+			for (uint i = 1; i <= m_numberCellsX; i++)
 			{
-				for (uint j = 1; j <= m_numberCells; j++)
+				scalar x = (i - scalar(0.5)) * m_spacingCells;
+				for (uint j = 1; j <= m_numberCellsY; j++)
 				{
-					coreExtremeValues(i, j);
+					scalar y = (j - scalar(0.5)) * m_spacingCells;
+
+					scalar uVelocity = TaylorGreenVortexVelocityU(scalar(0.0), x, y);
+					scalar vVelocity = TaylorGreenVortexVelocityV(scalar(0.0), x, y);
+					scalar density = TaylorGreenVortexDensity(scalar(0.0), x, y);
+
+					m_u1[rowLinearIndexMap(i, j)] = T(uVelocity);
+					m_v1[rowLinearIndexMap(i, j)] = T(vVelocity);
+					m_scalars1[0][rowLinearIndexMap(i, j)] = T(density);
 				}
 			}
 		}
 
-		void coreExtremeValues(uint i, uint j)
+		const ValueRange<scalar> & speedRange()
 		{
-			real speedCell = glm::length(vec2(m_u1[rowLinearIndexMap(i, j)], m_v1[rowLinearIndexMap(i, j)]));
-			findMinMaxValue(speedCell, m_maxSpeed, m_minSpeed);
+			m_speedRangeRead = true;
+			if (!m_speedRangeValid) findSpeedExtremes();
+			return m_speedRange;
+		}
+
+		const ValueRange<scalar> & densityRange()
+		{
+			m_densityRangeRead = true;
+			if (!m_densityRangeValid) findDensityExtremes();
+			return m_densityRange;
+		}
+
+		void findSpeedExtremes()
+		{
+			reduceRows(m_speedRange, [this](ValueRange<scalar> & range, uint j) { includeSpeedRow(range, j); });
+			m_speedRangeValid = true;
+		}
 
-			real densityCell = m_d1[rowLinearIndexMap(i, j)];
-			findMinMaxValue(densityCell, m_maxDensity, m_minDensity);
+		void findDensityExtremes()
+		{
+			reduceRows(m_densityRange, [this](ValueRange<scalar> & range, uint j) { includeRow(range, m_scalars1[0], j); });
+			m_densityRangeValid = true;
 		}
 
-		void addSimpleObstacle()
+		/// Every thread reduces its rows into a partial range
+		template <typename Function>
+		void reduceRows(ValueRange<scalar> & range, const Function & includeRow)
 		{
-			if (m_enabledObstacle && m_numberCells > 8)
+			std::mutex mutex;
+			range = ValueRange<scalar>();
+			m_threadPool.parallelFor(1, m_numberCellsY + 1, [&](uint jBegin, uint jEnd)
 			{
-				uint centerIndex = m_numberCells / 2;
-				int extenstionObstacle = m_numberCells / 8;
-				for (int oi = -extenstionObstacle; oi < (extenstionObstacle + 1); oi++)
+				ValueRange<scalar> partial;
+				for (uint j = jBegin; j < jEnd; j++)
 				{
-					for (int oj = -extenstionObstacle; oj < (extenstionObstacle + 1); oj++)
-					{
-						uint obstaceIndexi = centerIndex + oi;
-						uint obstaceIndexj = centerIndex + oj;
-
-						m_u1[rowLinearIndexMap(obstaceIndexi, obstaceIndexj)] = real(0.0);
-						m_v1[rowLinearIndexMap(obstaceIndexi, obstaceIndexj)] = real(0.0);
-						m_d1[rowLinearIndexMap(obstaceIndexi, obstaceIndexj)] = real(0.0);
-					}
+					includeRow(partial, j);
 				}
-			}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				range.merge(partial);
+			});
 		}
 
-		uint rowLinearIndexMap(uint i, uint j)
+		scalar cellSpeed(std::size_t cter) const
 		{
-			return (i + (j * (m_numberCells + 2)));
+			scalar u = scalar(m_u1[cter]);
+			scalar v = scalar(m_v1[cter]);
+			return std::sqrt(u * u + v * v);
 		}
 
-		uint colLinearIndexMap(uint i, uint j)
+		void includeSpeedRow(ValueRange<scalar> & range, uint j) const
 		{
-			return (j + (i * (m_numberCells + 2)));
+			forEachFlowCell(j, [&](std::size_t cter) { range.include(cellSpeed(cter)); });
 		}
 
-	protected:
-		void applyBoundaryCell(real & position)
+		void includeRow(ValueRange<scalar> & range, const T * x, uint j) const
+		{
+			forEachFlowCell(j, [&](std::size_t cter) { range.include(scalar(x[cter])); });
+		}
+
+		/// Interior cells of row j outside the solids
+		template <typename Function>
+		void forEachFlowCell(uint j, const Function & function) const
+		{
+			forEachCell(&m_solidMask.getSpans(), j, function);
+		}
+
+		/// Cells of row j in the spans, every interior cell without them
+		template <typename Function>
+		void forEachCell(const SpanList * spans, uint j, const Function & function) const
 		{
-			if (position < real(0.5))
+			std::size_t row = std::size_t(j) * (std::size_t(m_numberCellsX) + 2);
+			if (!spans)
 			{
-				position = (m_boundary == PERIODIC) ? m_numberCells + real(0.5) : real(0.5);
+				for (uint i = 1; i <= m_numberCellsX; i++) function(row + i);
+				return;
 			}
-			if (position > m_numberCells + real(0.5))
+			for (const CellSpan * span = spans->spansBegin(j); span != spans->spansEnd(j); span++)
 			{
-				position = (m_boundary == PERIODIC) ? real(0.5) : m_numberCells + real(0.5);
+				for (uint i = span->iBegin; i < span->iEnd; i++) function(row + i);
 			}
 		}
 
-		void periodicBoundaryConditions(real * x)
+		/// Cells the passes over a group of fields visit: the active tiles
+		/// with sparse tiles, otherwise the fluid cells, or null for all of
+		/// them without solids
+		const SpanList * passSpans(const TileActivity & activity) const
+		{
+			if (m_sparseTiles) return &activity.getSpans();
+			return m_solidMask.hasSolids() ? &m_solidMask.getSpans() : nullptr;
+		}
+
+		/// Tiles the spans of a sparse step come from, null for other spans
+		const TileActivity * activityOf(const SpanList * spans) const
+		{
+			if (!m_sparseTiles) return nullptr;
+			if (spans == &m_velocityActivity.getSpans()) return &m_velocityActivity;
+			if (spans == &m_densityActivity.getSpans()) return &m_densityActivity;
+			return nullptr;
+		}
+
+		/// Measures the velocity and the density at the start of a step. The
+		/// tiles above the threshold are active together with the ones a
+		/// backtrace and the interpolation stencil reach from them. The
+		/// inactive tiles of every buffer are zeroed once, so the passes read
+		/// zero there and neither read nor write them afterwards.
+		void updateActivity(scalar dt)
+		{
+			const T * velocity[] = { m_u1, m_v1 };
+			m_velocityActivity.measure(velocity, 2, 1, m_threadPool);
+			m_densityActivity.measure(m_scalars1, m_numScalars, 1, m_threadPool);
+
+			/// The bound is per component, the speed is at most sqrt(2) times
+			/// larger. Diffusion leaks at most one more tile.
+			double reach = std::sqrt(2.0) * m_velocityActivity.getMaxBound() * std::abs(double(dt)) * double(inverseSpacing()) + 2.0;
+			reach = std::min(reach, double(std::max(m_numberCellsX, m_numberCellsY)));
+			uint radius = uint(std::ceil(reach / TILE_SIZE)) + 1;
+
+			bool periodic = (m_boundary == PERIODIC);
+			m_velocityActivity.activate(double(m_activityThreshold), radius, periodic);
+			m_densityActivity.activate(double(m_activityThreshold), radius, periodic);
+			m_velocityActivity.buildSpans(m_solidMask.getSpans());
+			m_densityActivity.buildSpans(m_solidMask.getSpans());
+
+			T * velocityOld[] = { m_u0, m_v0 };
+			T * velocityNew[] = { m_u1, m_v1 };
+			m_velocityActivity.prepareBuffer(velocityOld, 2, 0);
+			m_velocityActivity.prepareBuffer(velocityNew, 2, 1);
+			m_densityActivity.prepareBuffer(m_scalars0, m_numScalars, 0);
+			m_densityActivity.prepareBuffer(m_scalars1, m_numScalars, 1);
+		}
+
+		/// Cells [iBegin, iEnd) x [jBegin, jEnd) of the square obstacle, false
+		/// when there is none
+		bool obstacleCells(uint & iBegin, uint & iEnd, uint & jBegin, uint & jEnd) const
+		{
+			uint numberCellsUnit = std::min(m_numberCellsX, m_numberCellsY);
+			if (!m_enabledObstacle || numberCellsUnit <= 8) return false;
+
+			uint extensionObstacle = numberCellsUnit / 8;
+			iBegin = m_numberCellsX / 2 - extensionObstacle;
+			iEnd = m_numberCellsX / 2 + extensionObstacle + 1;
+			jBegin = m_numberCellsY / 2 - extensionObstacle;
+			jEnd = m_numberCellsY / 2 + extensionObstacle + 1;
+			return true;
+		}
+
+		/// Rasterizes the geometry and the square obstacle on the current
+		/// grid. Cells turning solid lose their flow and the ones next to the
+		/// flow get their boundary values.
+		void rebuildSolids()
 		{
-			/// Walls
-			for (uint i = 1; i <= m_numberCells; i++)
+			m_solidMask.rasterize(m_solidGeometry, m_numberCellsX, m_numberCellsY);
+
+			uint iBegin, iEnd, jBegin, jEnd;
+			if (obstacleCells(iBegin, iEnd, jBegin, jEnd))
 			{
-				uint leftWallGhost = rowLinearIndexMap(0, i);
-				uint rightWallFluid = rowLinearIndexMap(m_numberCells, i);
-				x[leftWallGhost] = x[rightWallFluid];
+				m_solidMask.addCells(iBegin, iEnd, jBegin, jEnd);
+				m_solidMask.update();
+			}
+			m_speedRangeValid = m_densityRangeValid = false;
+			for (uint buffer = 0; buffer < 2; buffer++)
+			{
+				m_velocityActivity.touchAll(buffer);
+				m_densityActivity.touchAll(buffer);
+			}
+			if (!m_solidMask.hasSolids()) return;
 
-				uint rightWallGhost = rowLinearIndexMap(m_numberCells + 1, i);
-				uint leftWallFluid = rowLinearIndexMap(1, i);
-				x[rightWallGhost] = x[leftWallFluid];
-				
-				uint bottomWallGhost = rowLinearIndexMap(i, 0);
-				uint topWallFluid = rowLinearIndexMap(i, m_numberCells);
-				x[bottomWallGhost] = x[topWallFluid];
+			T * fields[] = { m_u0, m_v0, m_u1, m_v1 };
+			for (T * field : fields) m_solidMask.clearSolidCells(field);
+			for (uint k = 0; k < m_numScalars; k++)
+			{
+				m_solidMask.clearSolidCells(m_scalars0[k]);
+				m_solidMask.clearSolidCells(m_scalars1[k]);
+			}
+			m_solidMask.clearSolidCells(m_pressure);
+			m_solidMask.clearSolidCells(m_pressurePrevious);
+			m_solidMask.clearSolidCells(m_divergence);
+
+			m_solidMask.fillSolidCells(m_u1, SOLID_NO_SLIP);
+			m_solidMask.fillSolidCells(m_v1, SOLID_NO_SLIP);
+			fillGhostCells(m_u1, m_numberCellsX, m_numberCellsY, m_boundary);
+			fillGhostCells(m_v1, m_numberCellsX, m_numberCellsY, m_boundary);
+			for (uint k = 0; k < m_numScalars; k++)
+			{
+				m_solidMask.fillSolidCells(m_scalars1[k], SOLID_ZERO_FLUX);
+				fillGhostCells(m_scalars1[k], m_numberCellsX, m_numberCellsY, m_boundary);
+			}
+		}
 
-				uint topWallGhost = rowLinearIndexMap(i, m_numberCells + 1);
-				uint bottomWallFluid = rowLinearIndexMap(i, 1);
-				x[topWallGhost] = x[bottomWallFluid];
+		/// Boundary values of the solids next to the flow
+		void fillSolidCells(T * const * x, uint numFields, const solidBoundaryType * solidBoundary)
+		{
+			if (!m_solidMask.hasSolids()) return;
+			for (uint f = 0; f < numFields; f++)
+			{
+				m_solidMask.fillSolidCells(x[f], solidBoundary[f]);
 			}
+		}
+
+		/// Cells 1 ... N of both axes, the ghost cells are rewritten by every pass
+		bool isInterior(uint i, uint j) const
+		{
+			return i >= 1 && i <= m_numberCellsX && j >= 1 && j <= m_numberCellsY;
+		}
+
+		std::size_t rowLinearIndexMap(uint i, uint j)
+		{
+			return (i + (j * (std::size_t(m_numberCellsX) + 2)));
+		}
+
+		std::size_t colLinearIndexMap(uint i, uint j)
+		{
+			return (j + (i * (std::size_t(m_numberCellsY) + 2)));
+		}
+
+		std::size_t fieldSize() const
+		{
+			return (std::size_t(m_numberCellsX) + 2) * (std::size_t(m_numberCellsY) + 2);
+		}
+
+		/// Cells per unit length
+		scalar inverseSpacing() const
+		{
+			return scalar(std::min(m_numberCellsX, m_numberCellsY));
+		}
 
-			/// Corners
-			uint leftBottomGhost = rowLinearIndexMap(0, 0);
-			uint rightTopFluid = rowLinearIndexMap(m_numberCells, m_numberCells);
-			x[leftBottomGhost] = x[rightTopFluid];
+	protected:
+		template <boundaryType B, typename S>
+		void boundaryConditions(S * x)
+		{
+			fillGhostCells<B>(x, m_numberCellsX, m_numberCellsY);
+		}
 
-			uint rightBottomGhost = rowLinearIndexMap(0, m_numberCells + 1);
-			uint leftTopFluid = rowLinearIndexMap(m_numberCells, 1);
-			x[rightBottomGhost] = x[leftTopFluid];
+		/// Gauss-Seidel relaxation over the fluid cells, the solids next to
+		/// the flow take zero flux boundary values. Stops on the pressure
+		/// relaxation criterion, the residuals are those of b - A x.
+		template <boundaryType B>
+		SolverStatistics linearSolver(scalar * xNew, const scalar * xOld, scalar a = scalar(0.0), scalar c = scalar(1.0))
+		{
+			scalar * fieldsNew[] = { xNew };
+			const scalar * fieldsOld[] = { xOld };
+			solidBoundaryType solidBoundary[] = { SOLID_ZERO_FLUX };
+			const SpanList * spans = m_solidMask.hasSolids() ? &m_solidMask.getSpans() : nullptr;
+			return relax<B>(m_relaxation, fieldsNew, fieldsOld, 1, m_numberCellsX, m_numberCellsY, a, c, m_pressureRelaxation, m_threadPool,
+				spans, &m_solidMask, solidBoundary);
+		}
 
-			uint leftTopGhost = rowLinearIndexMap(m_numberCells + 1, 0);
-			uint rightBottomFluid = rowLinearIndexMap(1, m_numberCells);
-			x[leftTopGhost] = x[rightBottomFluid];
+		template <boundaryType B>
+		SolverStatistics diffuse(T * xNew, T * xOld, scalar diffuseTerm, solidBoundaryType solidBoundary, const SpanList * spans = nullptr)
+		{
+			T * fieldsNew[] = { xNew };
+			const T * fieldsOld[] = { xOld };
+			return diffuseFields<B>(fieldsNew, fieldsOld, 1, diffuseTerm, &solidBoundary, spans);
+		}
 
-			uint rightTopGhost = rowLinearIndexMap(m_numberCells + 1, m_numberCells + 1);
-			uint leftBottomFLuid = rowLinearIndexMap(1, 1);
-			x[rightTopGhost] = x[leftBottomFLuid];
+		/// Coefficient a of the implicit diffusion (1 + 4 a) x - a sum(x) = b
+		/// of a step dt, coefficient dt / h^2
+		scalar diffusionTerm(scalar coefficient, scalar dt) const
+		{
+			return coefficient * dt * inverseSpacing() * inverseSpacing();
 		}
 
-		void dirichletBoundaryConditions(real * x)
+		/// Diffuses several fields with the same coefficient in one batched
+		/// solve, solidBoundary gives the wall type of every field. Only the
+		/// cells of the spans are relaxed, all of them without.
+		template <boundaryType B>
+		SolverStatistics diffuseFields(T * const * xNew, const T * const * xOld, uint numFields, scalar diffuseTerm, const solidBoundaryType * solidBoundary,
+			const SpanList * spans = nullptr)
 		{
-			/// Walls
-			for (uint i = 1; i <= m_numberCells; i++)
+			if (isAdiDiffusionActive())
 			{
-				uint leftWallGhost = rowLinearIndexMap(0, i);
-				uint leftWallFluid = rowLinearIndexMap(1, i);
-				x[leftWallGhost] = -x[leftWallFluid];
+				return adiDiffuse<B>(xNew, xOld, numFields, m_numberCellsX, m_numberCellsY, diffuseTerm, m_threadPool);
+			}
 
-				uint rightWallGhost = rowLinearIndexMap(m_numberCells + 1, i);
-				uint rightWallFluid = rowLinearIndexMap(m_numberCells, i);
-				x[rightWallGhost] = -x[rightWallFluid];
-				
-				uint bottomWallGhost = rowLinearIndexMap(i, 0);
-				uint bottomWallFluid = rowLinearIndexMap(i, 1);
-				x[bottomWallGhost] = -x[bottomWallFluid];
-				
-				uint topWallGhost = rowLinearIndexMap(i, m_numberCells + 1);
-				uint topWallFluid = rowLinearIndexMap(i, m_numberCells);
-				x[topWallGhost] = -x[topWallFluid];
+			if (isSpectralDiffusionActive() && std::is_same<T, scalar>::value)
+			{
+				SolverStatistics statistics;
+				for (uint f = 0; f < numFields; f++)
+				{
+					statistics.merge(diffuseSpectral(xNew[f], xOld[f], diffuseTerm));
+				}
+				return statistics;
 			}
 
-			/// Corners
-			uint leftBottomGhost = rowLinearIndexMap(0, 0);
-			uint rightBottomGhost = rowLinearIndexMap(0, m_numberCells + 1);
-			uint leftTopGhost = rowLinearIndexMap(m_numberCells + 1, 0);
-			uint rightTopGhost = rowLinearIndexMap(m_numberCells + 1, m_numberCells + 1);
-			x[leftBottomGhost] = real(0.0);
-			x[rightBottomGhost] = real(0.0);
-			x[leftTopGhost] = real(0.0);
-			x[rightTopGhost] = real(0.0);
+			scalar c = scalar(1.0) + scalar(4.0) * diffuseTerm;
+			return relax<B>(m_relaxation, xNew, xOld, numFields, m_numberCellsX, m_numberCellsY, diffuseTerm, c, m_diffusionRelaxation, m_threadPool,
+				spans, &m_solidMask, solidBoundary);
+		}
+
+		/// The spectral solver works in the compute precision, fields stored
+		/// in a 16 bit format are relaxed instead
+		SolverStatistics diffuseSpectral(scalar * xNew, const scalar * xOld, scalar diffuseTerm)
+		{
+			return m_spectralSolver.solveHelmholtz(xNew, xOld, diffuseTerm, scalar(1.0) + scalar(4.0) * diffuseTerm);
+		}
+
+		template <typename S>
+		SolverStatistics diffuseSpectral(S * xNew, const S * xOld, scalar diffuseTerm)
+		{
+			return SolverStatistics();
+		}
+
+		template <boundaryType B>
+		void advect(T * xNew, T * xOld, const T * u, const T * v, scalar dt, solidBoundaryType solidBoundary, const SpanList * spans = nullptr,
+			ValueRange<scalar> * range = nullptr)
+		{
+			T * fieldsNew[] = { xNew };
+			const T * fieldsOld[] = { xOld };
+			advectFields<B>(fieldsNew, fieldsOld, 1, u, v, dt, &solidBoundary, spans, range);
 		}
 
-		void linearSolver(real * xNew, real * xOld, real a = real(0.0), real c = real(1.0))
+		/// MacCormack and BFECC estimate the error of a semi-Lagrangian step by
+		/// advecting its result back with -dt. MacCormack corrects the forward
+		/// result with half the error, BFECC corrects the source and advects it
+		/// again. Either result is clamped to the range of the source values
+		/// around the forward backtrace (Selle et al. 2008) so the correction
+		/// never creates new extrema. A range receives the extremes of the
+		/// first field, reduced by the last pass as it writes each row. Only
+		/// the cells of the spans are advected, all of them without, and
+		/// solidBoundary gives the wall type of every field.
+		template <boundaryType B>
+		void advectFields(T * const * xNew, const T * const * xOld, uint numFields, const T * u, const T * v, scalar dt,
+			const solidBoundaryType * solidBoundary, const SpanList * spans = nullptr, ValueRange<scalar> * range = nullptr)
 		{
-			/// Gauss-Seidel relaxation
-			int relaxationSteps = 20;
-			for (int steps = 0; steps < relaxationSteps; steps++)
+			if (m_advectionScheme == ADVECTION_SEMI_LAGRANGIAN)
+			{
+				advectPass<B>(xNew, xOld, numFields, u, v, dt, nullptr, nullptr, solidBoundary, spans, range);
+				return;
+			}
+
+			/// Backward result, minimum and maximum of every field
+			std::size_t size = fieldSize();
+			if (m_advectionScratch.size() < 3 * numFields * size) m_advectionScratch.resize(3 * numFields * size);
+			T * backward[ADVECTION_MAX_FIELDS];
+			T * minimum[ADVECTION_MAX_FIELDS];
+			T * maximum[ADVECTION_MAX_FIELDS];
+			for (uint f = 0; f < numFields; f++)
+			{
+				backward[f] = m_advectionScratch.data() + (3 * f + 0) * size;
+				minimum[f] = m_advectionScratch.data() + (3 * f + 1) * size;
+				maximum[f] = m_advectionScratch.data() + (3 * f + 2) * size;
+			}
+
+			/// The second BFECC pass backtraces into the inactive tiles of the
+			/// scratch, which still hold the fields of earlier passes
+			const TileActivity * activity = activityOf(spans);
+			if (activity && m_advectionScheme == ADVECTION_BFECC)
+			{
+				for (uint f = 0; f < numFields; f++) activity->clearInactive(backward[f]);
+			}
+
+			advectPass<B>(xNew, xOld, numFields, u, v, dt, minimum, maximum, solidBoundary, spans);
+			advectPass<B>(backward, xNew, numFields, u, v, -dt, nullptr, nullptr, solidBoundary, spans);
+
+			if (m_advectionScheme == ADVECTION_BFECC)
 			{
-				for (uint j = 1; j <= m_numberCells; j++)
+				m_threadPool.parallelFor(1, m_numberCellsY + 1, [&](uint jBegin, uint jEnd)
 				{
-					for (uint i = 1; i <= m_numberCells; i++)
+					for (uint f = 0; f < numFields; f++)
 					{
-						uint cter = rowLinearIndexMap(i + 0, j + 0);
-						uint east = rowLinearIndexMap(i + 1, j + 0);
-						uint west = rowLinearIndexMap(i - 1, j + 0);
-						uint nrth = rowLinearIndexMap(i + 0, j + 1);
-						uint soth = rowLinearIndexMap(i + 0, j - 1);
+						for (uint j = jBegin; j < jEnd; j++)
+						{
+							forEachCell(spans, j, [&](std::size_t cter)
+							{
+								backward[f][cter] = T(scalar(1.5) * scalar(xOld[f][cter]) - scalar(0.5) * scalar(backward[f][cter]));
+							});
+						}
+					}
+				});
+				fillSolidCells(backward, numFields, solidBoundary);
+				for (uint f = 0; f < numFields; f++)
+				{
+					boundaryConditions<B>(backward[f]);
+				}
+				advectPass<B>(xNew, backward, numFields, u, v, dt, nullptr, nullptr, solidBoundary, spans);
+			}
 
-						xNew[cter] = ((xOld[cter]) + a * (xNew[west] + xNew[east] + xNew[soth] + xNew[nrth])) / c;
+			std::mutex mutex;
+			if (range) *range = ValueRange<scalar>();
+			m_threadPool.parallelFor(1, m_numberCellsY + 1, [&](uint jBegin, uint jEnd)
+			{
+				ValueRange<scalar> partial;
+				for (uint f = 0; f < numFields; f++)
+				{
+					for (uint j = jBegin; j < jEnd; j++)
+					{
+						forEachCell(spans, j, [&](std::size_t cter)
+						{
+							scalar value = scalar(xNew[f][cter]);
+							if (m_advectionScheme == ADVECTION_MACCORMACK)
+							{
+								value += scalar(0.5) * (scalar(xOld[f][cter]) - scalar(backward[f][cter]));
+							}
+							value = std::min(std::max(value, scalar(minimum[f][cter])), scalar(maximum[f][cter]));
+							xNew[f][cter] = T(value);
+						});
+						if (range && f == 0) includeRow(partial, xNew[0], j);
 					}
 				}
 
-				(m_boundary == PERIODIC) ? periodicBoundaryConditions(xNew) : dirichletBoundaryConditions(xNew);
+				if (!range) return;
+				std::lock_guard<std::mutex> lock(mutex);
+				range->merge(partial);
+			});
+
+			fillSolidCells(xNew, numFields, solidBoundary);
+			for (uint f = 0; f < numFields; f++)
+			{
+				boundaryConditions<B>(xNew[f]);
 			}
 		}
 
-		void diffuse(real * xNew, real * xOld, real diffuseTerm)
+		/// One semi-Lagrangian pass of several fields with the same velocity,
+		/// the backtrace is computed once per cell and the rows are split
+		/// across the threads
+		template <boundaryType B>
+		void advectPass(T * const * xNew, const T * const * xOld, uint numFields, const T * u, const T * v, scalar dt,
+			T * const * minimum, T * const * maximum, const solidBoundaryType * solidBoundary, const SpanList * spans = nullptr,
+			ValueRange<scalar> * range = nullptr)
 		{
-			linearSolver(xNew, xOld, diffuseTerm);
-		}
+			AdvectionParameters<T> parameters;
+			parameters.numberCellsX = m_numberCellsX;
+			parameters.numberCellsY = m_numberCellsY;
+			parameters.boundary = B;
+			parameters.dt0 = dt * inverseSpacing();
+			parameters.u = u;
+			parameters.v = v;
+			parameters.numFields = numFields;
+			parameters.backtrace = m_backtrace;
+			parameters.interpolation = m_interpolation;
+			parameters.recordRange = (minimum != nullptr);
+			parameters.spans = spans;
+			for (uint f = 0; f < numFields; f++)
+			{
+				parameters.xNew[f] = xNew[f];
+				parameters.xOld[f] = xOld[f];
+				parameters.minimum[f] = parameters.recordRange ? minimum[f] : nullptr;
+				parameters.maximum[f] = parameters.recordRange ? maximum[f] : nullptr;
+			}
 
-		void advect(real * xNew, real * xOld, const real * u, const real * v, real dt)
-		{
-			real dt0 = dt * m_numberCells;
-			for (uint j = 1; j <= m_numberCells; j++)
+			if (!range)
 			{
-				for (uint i = 1; i <= m_numberCells; i++)
+				m_threadPool.parallelFor(1, m_numberCellsY + 1, [&](uint jBegin, uint jEnd)
 				{
-					real x = i - dt0 * u[rowLinearIndexMap(i, j)]; 
-					real y = j - dt0 * v[rowLinearIndexMap(i, j)];
-					applyBoundaryCell(x);
-					applyBoundaryCell(y);
-					
-					uint i0 = (uint)x; 
-					uint i1 = i0 + 1;
-					
-					uint j0 = (uint)y; 
-					uint j1 = j0 + 1;
-
-					real s1 = x - i0; 
-					real s0 = 1 - s1; 
-					real t1 = y - j0; 
-					real t0 = 1 - t1;
-
-					xNew[rowLinearIndexMap(i, j)] = 
-						s0*(t0*xOld[rowLinearIndexMap(i0, j0)] + t1*xOld[rowLinearIndexMap(i0, j1)]) +
-						s1*(t0*xOld[rowLinearIndexMap(i1, j0)] + t1*xOld[rowLinearIndexMap(i1, j1)]);
-				}
+					advectRows<B>(parameters, m_advectionKernel, jBegin, jEnd);
+				});
+			}
+			else
+			{
+				/// Each row is reduced right after the kernel wrote it
+				std::mutex mutex;
+				*range = ValueRange<scalar>();
+				m_threadPool.parallelFor(1, m_numberCellsY + 1, [&](uint jBegin, uint jEnd)
+				{
+					ValueRange<scalar> partial;
+					for (uint j = jBegin; j < jEnd; j++)
+					{
+						advectRows<B>(parameters, m_advectionKernel, j, j + 1);
+						includeRow(partial, xNew[0], j);
+					}
+
+					std::lock_guard<std::mutex> lock(mutex);
+					range->merge(partial);
+				});
+			}
+
+			fillSolidCells(xNew, numFields, solidBoundary);
+			for (uint f = 0; f < numFields; f++)
+			{
+				boundaryConditions<B>(xNew[f]);
 			}
-			(m_boundary == PERIODIC) ? periodicBoundaryConditions(xNew) : dirichletBoundaryConditions(xNew);
 		}
 	
-		void project()
+		/// A range receives the extremes of the projected speed. The stencils
+		/// only run over the fluid cells, the solids next to them hold the
+		/// boundary values: the velocity vanishes on their faces and the
+		/// pressure has no normal gradient there. The pressure is solved on
+		/// every cell, only the velocity of the spans is corrected.
+		///
+		/// A solve that runs to a tolerance may start from the pressure of
+		/// the last steps, rescaled to the step dt. Tolerances are relative
+		/// to the residual of a zero guess, so a good guess saves iterations
+		/// instead of asking for a smaller residual.
+		template <boundaryType B>
+		void project(scalar dt, const SpanList * spans = nullptr, ValueRange<scalar> * speedRange = nullptr)
 		{
-			for (uint j = 1; j <= m_numberCells; j++)
+			/// A fixed number of Gauss-Seidel sweeps leaves an error in the
+			/// pressure that a warm start carries over from step to step
+			pressureGuessType pressureGuess = m_pressureGuess;
+			if (!pressureSolveToTolerance()) pressureGuess = PRESSURE_GUESS_ZERO;
+
+			scalar last, previous;
+			m_pressureHistory.guessWeights(pressureGuess, dt, last, previous);
+			bool storePrevious = (pressureGuess == PRESSURE_GUESS_EXTRAPOLATED);
+
+			/// Rows are independent in both stencil loops
+			std::mutex mutex;
+			double sumSquares = 0.0;
+			std::size_t numCells = 0;
+			m_threadPool.parallelFor(1, m_numberCellsY + 1, [&](uint firstRow, uint lastRow)
 			{
-				for (uint i = 1; i <= m_numberCells; i++)
+				std::size_t stride = std::size_t(m_numberCellsX) + 2;
+				double partialSum = 0.0;
+				std::size_t partialCells = 0;
+				for (uint j = firstRow; j < lastRow; j++)
 				{
-					uint cter = rowLinearIndexMap(i + 0, j + 0);
-					uint east = rowLinearIndexMap(i + 1, j + 0);
-					uint west = rowLinearIndexMap(i - 1, j + 0);
-					uint nrth = rowLinearIndexMap(i + 0, j + 1);
-					uint soth = rowLinearIndexMap(i + 0, j - 1);
-
-					m_divergence[cter] = -real(0.5 * m_spacingCells) * (m_u1[east] - m_u1[west] + m_v1[nrth] - m_v1[soth]);
-					m_pressure[cter] = real(0.0);
+					forEachFlowCell(j, [&](std::size_t cter)
+					{
+						m_divergence[cter] = -scalar(0.5 * m_spacingCells) * (scalar(m_u1[cter + 1]) - scalar(m_u1[cter - 1]) + scalar(m_v1[cter + stride]) - scalar(m_v1[cter - stride]));
+						partialSum += double(m_divergence[cter]) * double(m_divergence[cter]);
+						partialCells++;
+
+						scalar guess = last * m_pressure[cter] - previous * m_pressurePrevious[cter];
+						if (storePrevious) m_pressurePrevious[cter] = m_pressure[cter];
+						m_pressure[cter] = guess;
+					});
 				}
-			}
-			(m_boundary == PERIODIC) ? periodicBoundaryConditions(m_divergence) : dirichletBoundaryConditions(m_divergence);
-			(m_boundary == PERIODIC) ? periodicBoundaryConditions(m_pressure) : dirichletBoundaryConditions(m_pressure);
 
-			linearSolver(m_pressure, m_divergence, real(1.0), real(4.0));
+				std::lock_guard<std::mutex> lock(mutex);
+				sumSquares += partialSum;
+				numCells += partialCells;
+			});
+			double referenceResidual = std::sqrt(sumSquares / double(std::max(numCells, std::size_t(1))));
+			m_pressureHistory.record(pressureGuess, dt);
+
+			boundaryConditions<B>(m_divergence);
+			if (m_solidMask.hasSolids()) m_solidMask.fillSolidCells(m_pressure, SOLID_ZERO_FLUX);
+			boundaryConditions<B>(m_pressure);
+
+			pressureSolverType pressureSolver = getActivePressureSolver();
+			if (pressureSolver == PRESSURE_MULTIGRID)
+			{
+				m_pressureStatistics = m_multigrid.solve(m_pressure, m_divergence, B, scalar(referenceResidual));
+			}
+			else if (pressureSolver == PRESSURE_CONJUGATE_GRADIENT)
+			{
+				m_pressureStatistics = m_conjugateGradient.solve(m_pressure, m_divergence, B, scalar(referenceResidual));
+			}
+			else if (pressureSolver == PRESSURE_SPECTRAL)
+			{
+				m_pressureStatistics = m_spectralSolver.solveProjection(m_pressure, m_divergence);
+			}
+			else
+			{
+				m_pressureStatistics = linearSolver<B>(m_pressure, m_divergence, scalar(1.0), scalar(4.0));
+			}
+			m_pressureStatistics.referenceResidual = referenceResidual;
 
-			for (uint j = 1; j <= m_numberCells; j++)
+			if (speedRange) *speedRange = ValueRange<scalar>();
+			m_threadPool.parallelFor(1, m_numberCellsY + 1, [&](uint firstRow, uint lastRow)
 			{
-				for (uint i = 1; i <= m_numberCells; i++)
+				std::size_t stride = std::size_t(m_numberCellsX) + 2;
+				ValueRange<scalar> partial;
+				for (uint j = firstRow; j < lastRow; j++)
 				{
-					uint cter = rowLinearIndexMap(i + 0, j + 0);
-					uint east = rowLinearIndexMap(i + 1, j + 0);
-					uint west = rowLinearIndexMap(i - 1, j + 0);
-					uint nrth = rowLinearIndexMap(i + 0, j + 1);
-					uint soth = rowLinearIndexMap(i + 0, j - 1);
-
-					m_u1[cter] -= real(0.5 * m_numberCells) * (m_pressure[east] - m_pressure[west]);
-					m_v1[cter] -= real(0.5 * m_numberCells) * (m_pressure[nrth] - m_pressure[soth]);
+					forEachCell(spans, j, [&](std::size_t cter)
+					{
+						m_u1[cter] -= scalar(0.5) * inverseSpacing() * (m_pressure[cter + 1] - m_pressure[cter - 1]);
+						m_v1[cter] -= scalar(0.5) * inverseSpacing() * (m_pressure[cter + stride] - m_pressure[cter - stride]);
+					});
+					if (speedRange) includeSpeedRow(partial, j);
 				}
-			}
-			(m_boundary == PERIODIC) ? periodicBoundaryConditions(m_u1) : dirichletBoundaryConditions(m_u1);
-			(m_boundary == PERIODIC) ? periodicBoundaryConditions(m_v1) : dirichletBoundaryConditions(m_v1);
+
+				if (!speedRange) return;
+				std::lock_guard<std::mutex> lock(mutex);
+				speedRange->merge(partial);
+			});
+			T * velocity[] = { m_u1, m_v1 };
+			solidBoundaryType solidBoundary[] = { SOLID_NO_SLIP, SOLID_NO_SLIP };
+			fillSolidCells(velocity, 2, solidBoundary);
+			boundaryConditions<B>(m_u1);
+			boundaryConditions<B>(m_v1);
 		}
 
 	private:
-		real m_spacingCells = 0.0;
-		uint m_numberCells = 64;
+		scalar m_spacingCells = 0.0;
+		uint m_numberCellsX = 64;
+		uint m_numberCellsY = 64;
+
+		/// Owns the memory of the fields below
+		FieldArena m_arena;
+		bool m_hugePages = false;
 
 		/// To enforce divergence free
-		real * m_divergence = nullptr;
-		real * m_pressure = nullptr;
+		scalar * m_divergence = nullptr;
+		scalar * m_pressure = nullptr;
 
-		/// Old step
-		real * m_d0 = nullptr;
-		real * m_u0 = nullptr;
-		real * m_v0 = nullptr;
+		/// Pressure of the solve before the last one, for extrapolated guesses
+		scalar * m_pressurePrevious = nullptr;
+
+		/// Old step, the scalar channels are consecutive slices with the
+		/// density first
+		T * m_scalars0[MAX_SCALAR_CHANNELS] = {};
+		T * m_u0 = nullptr;
+		T * m_v0 = nullptr;
 
 		/// New step
-		real * m_d1 = nullptr;
-		real * m_u1 = nullptr;
-		real * m_v1 = nullptr;
+		T * m_scalars1[MAX_SCALAR_CHANNELS] = {};
+		T * m_u1 = nullptr;
+		T * m_v1 = nullptr;
+		uint m_numScalars = 1;
 
 		/// Parameters
-		real m_diffusion = real(0.0);
-		real m_viscosity = real(0.0);
+		scalar m_diffusion = scalar(0.0);
+		scalar m_viscosity = scalar(0.0);
 
 		/// Information from the fluid
-		real m_maxDensity = -infinity;
-		real m_minDensity = +infinity;
-		real m_maxSpeed = -infinity;
-		real m_minSpeed = +infinity;
-
-		/// Obstacle handlers
+		ValueRange<scalar> m_densityRange;
+		ValueRange<scalar> m_speedRange;
+		bool m_densityRangeValid = false;
+		bool m_speedRangeValid = false;
+		bool m_densityRangeRead = false;
+		bool m_speedRangeRead = false;
+
+		/// Solids, the geometry and the square obstacle rasterized on the grid
 		bool m_enabledObstacle = false;
+		SolidGeometry m_solidGeometry;
+		SolidMask m_solidMask;
+
+		/// Sparse tiles, buffer 0 holds the old step and 1 the new one
+		bool m_sparseTiles = false;
+		scalar m_activityThreshold = scalar(ACTIVITY_THRESHOLD);
+		TileActivity m_velocityActivity;
+		TileActivity m_densityActivity;
+
+		/// Linear solver
+		relaxationType m_relaxation = LEXICOGRAPHIC;
+		ThreadPool m_threadPool;
+
+		/// Pressure solver
+		pressureSolverType m_pressureSolver = PRESSURE_GAUSS_SEIDEL;
+		SolverStatistics m_pressureStatistics;
+		SolverStatistics m_diffusionStatistics[2];
+		RelaxationCriterion m_pressureRelaxation;
+		RelaxationCriterion m_diffusionRelaxation;
+		pressureGuessType m_pressureGuess = PRESSURE_GUESS_ZERO;
+		PressureHistory<scalar> m_pressureHistory;
+		Multigrid<scalar> m_multigrid = Multigrid<scalar>(m_threadPool);
+		ConjugateGradient<scalar> m_conjugateGradient = ConjugateGradient<scalar>(m_threadPool);
+		SpectralSolver<scalar> m_spectralSolver = SpectralSolver<scalar>(m_threadPool);
+
+		/// Diffusion solver
+		diffusionSolverType m_diffusionSolver = DIFFUSION_GAUSS_SEIDEL;
+
+		/// Time stepping, m_timeStep is the frame time in adaptive mode
+		timeSteppingType m_timeStepping = TIME_STEPPING_FIXED;
+		scalar m_cflNumber = scalar(CFL_NUMBER);
+		uint m_numSubsteps = 0;
+
+		/// Advection
+		advectionKernelType m_advectionKernel = detectAdvectionKernel();
+		advectionSchemeType m_advectionScheme = ADVECTION_SEMI_LAGRANGIAN;
+		backtraceType m_backtrace = BACKTRACE_EULER;
+		interpolationType m_interpolation = INTERPOLATION_LINEAR;
+		std::vector<T> m_advectionScratch;
 	};
-}
\ No newline at end of file
+
+	extern template class Fluid<float>;
+	extern template class Fluid<double>;
+	extern template class Fluid<float16>;
+	extern template class Fluid<bfloat16>;
+}
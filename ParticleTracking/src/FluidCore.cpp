@@ -0,0 +1,26 @@
+/// Translation unit of the headless simulation core. The solver itself
+/// lives in the headers, this file only guarantees that they compile
+/// without any of the OpenGL / GLFW / FreeImage headers in scope and
+/// holds the instantiations of the supported precisions.
+#include "AnalyticalSolutions.h"
+#include "BoundaryConditions.h"
+#include "TimeIntegrator.h"
+#include "ParticleSystem.h"
+#include "Fluid.h"
+#include "AdaptiveFluid.h"
+
+namespace FluidSimulation
+{
+	template class Fluid<float>;
+	template class Fluid<double>;
+	template class Fluid<float16>;
+	template class Fluid<bfloat16>;
+
+	template class AdaptiveFluid<float>;
+	template class AdaptiveFluid<double>;
+	template class AdaptiveFluid<float16>;
+	template class AdaptiveFluid<bfloat16>;
+
+	template class ParticleSystem<float>;
+	template class ParticleSystem<double>;
+}
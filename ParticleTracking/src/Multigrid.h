@@ -0,0 +1,382 @@
+#pragma once
+#include "BoundaryConditions.h"
+#include "ConjugateGradient.h"
+#include "SolverStatistics.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <mutex>
+
+#define MULTIGRID_MAX_CYCLES 10
+#define MULTIGRID_TOLERANCE 1.0e-4
+#define MULTIGRID_COARSEST_CELLS 2
+#define MULTIGRID_COARSE_SWEEPS 40
+#define MULTIGRID_COARSE_SMOOTH_CELLS 8
+#define MULTIGRID_COARSE_TOLERANCE 1.0e-3
+#define MULTIGRID_PARALLEL_CELLS 64
+
+namespace FluidSimulation
+{
+	enum cycleType
+	{
+		V_CYCLE = 0,
+		W_CYCLE
+	};
+
+	template <typename T>
+	struct MultigridLevel
+	{
+		uint numberCellsX = 0;
+		uint numberCellsY = 0;
+		T * x = nullptr;
+		const T * b = nullptr;
+
+		/// Storage, the finest level works on the caller's arrays
+		std::vector<T> solution;
+		std::vector<T> rhs;
+		std::vector<T> residual;
+	};
+
+	/// Geometric multigrid for the cell centred Poisson problem solved in
+	/// Fluid::project,
+	///     4 x(i, j) - x(i - 1, j) - x(i + 1, j) - x(i, j - 1) - x(i, j + 1) = b(i, j)
+	/// with the ghost cells filled as PERIODIC or DIRICHLET. Levels halve the
+	/// number of cells while both sides stay even, residuals are restricted by summing
+	/// the four children (the right hand side carries a h^2 factor) and
+	/// corrections are prolongated bilinearly. Smoothing is red-black
+	/// Gauss-Seidel so the rows of the large levels run on the thread pool.
+	/// The coarsest level gets MULTIGRID_COARSE_SWEEPS sweeps, or conjugate
+	/// gradients when an odd side stopped the coarsening above
+	/// MULTIGRID_COARSE_SMOOTH_CELLS cells, where the sweeps would leave
+	/// most of the smooth error. T is the precision of the levels, float or
+	/// double.
+	template <typename T>
+	class Multigrid
+	{
+	public:
+		Multigrid(ThreadPool & threadPool)
+			: m_threadPool(threadPool), m_coarseSolver(threadPool)
+		{
+
+		}
+
+		void resize(uint numberCellsX, uint numberCellsY)
+		{
+			m_levels.clear();
+
+			uint nx = numberCellsX;
+			uint ny = numberCellsY;
+			for (;;)
+			{
+				m_levels.push_back(MultigridLevel<T>());
+				MultigridLevel<T> & level = m_levels.back();
+
+				std::size_t size = (std::size_t(nx) + 2) * (std::size_t(ny) + 2);
+				level.numberCellsX = nx;
+				level.numberCellsY = ny;
+				level.residual.assign(size, T(0.0));
+				if (m_levels.size() > 1)
+				{
+					level.solution.assign(size, T(0.0));
+					level.rhs.assign(size, T(0.0));
+				}
+
+				if ((nx % 2) != 0 || (ny % 2) != 0) break;
+				if ((nx / 2) < MULTIGRID_COARSEST_CELLS || (ny / 2) < MULTIGRID_COARSEST_CELLS) break;
+				nx /= 2;
+				ny /= 2;
+			}
+
+			for (uint l = 1; l < m_levels.size(); l++)
+			{
+				m_levels[l].x = m_levels[l].solution.data();
+				m_levels[l].b = m_levels[l].rhs.data();
+			}
+
+			m_coarseConjugateGradient = (nx > MULTIGRID_COARSE_SMOOTH_CELLS || ny > MULTIGRID_COARSE_SMOOTH_CELLS);
+			m_coarseSolver.resize(m_coarseConjugateGradient ? nx : 0, m_coarseConjugateGradient ? ny : 0);
+		}
+
+		/// Cycles until the residual drops by the tolerance or the maximum
+		/// number of cycles is reached, x is used as initial guess. The
+		/// tolerance is relative to the reference residual when given, the
+		/// one of a zero guess, otherwise to the initial one. A grid with an
+		/// odd side has no coarser level, conjugate gradients solve it and
+		/// the statistics count their iterations.
+		SolverStatistics solve(T * x, const T * b, boundaryType boundary, T referenceResidual = T(0.0))
+		{
+			SolverStatistics statistics;
+			if (m_levels.empty()) return statistics;
+
+			if (m_levels.size() == 1 && m_coarseConjugateGradient)
+			{
+				m_coarseSolver.setTolerance(m_tolerance);
+				return m_coarseSolver.solve(x, b, boundary, referenceResidual);
+			}
+			m_coarseSolver.setTolerance(T(MULTIGRID_COARSE_TOLERANCE));
+
+			MultigridLevel<T> & finest = m_levels[0];
+			finest.x = x;
+			finest.b = b;
+			m_boundary = boundary;
+
+			fillGhostCells(x, finest.numberCellsX, finest.numberCellsY, m_boundary);
+			statistics.initialResidual = computeResidual(finest);
+			statistics.residual = statistics.initialResidual;
+			statistics.referenceResidual = referenceResidual;
+			T reference = (referenceResidual > T(0.0)) ? referenceResidual : T(statistics.initialResidual);
+
+			while (statistics.iterations < m_maxCycles &&
+				statistics.residual > m_tolerance * reference)
+			{
+				cycle(0);
+				statistics.residual = computeResidual(finest);
+				statistics.iterations++;
+			}
+			statistics.converged = (statistics.residual <= m_tolerance * reference);
+
+			finest.x = nullptr;
+			finest.b = nullptr;
+			return statistics;
+		}
+
+		void setCycleType(cycleType cycle)
+		{
+			m_cycle = cycle;
+		}
+
+		cycleType getCycleType() const
+		{
+			return m_cycle;
+		}
+
+		void setMaxCycles(uint maxCycles)
+		{
+			m_maxCycles = maxCycles;
+		}
+
+		void setTolerance(T tolerance)
+		{
+			m_tolerance = tolerance;
+		}
+
+		void setSmoothingSteps(uint preSmoothing, uint postSmoothing)
+		{
+			m_preSmoothing = preSmoothing;
+			m_postSmoothing = postSmoothing;
+		}
+
+		uint getNumLevels() const
+		{
+			return (uint)m_levels.size();
+		}
+
+	protected:
+		void cycle(uint l)
+		{
+			MultigridLevel<T> & level = m_levels[l];
+			if ((l + 1) == m_levels.size())
+			{
+				coarseSolve(level);
+				return;
+			}
+
+			smooth(level, m_preSmoothing);
+			computeResidual(level);
+
+			MultigridLevel<T> & coarse = m_levels[l + 1];
+			restrictResidual(level, coarse);
+			std::fill(coarse.solution.begin(), coarse.solution.end(), T(0.0));
+
+			uint visits = (m_cycle == W_CYCLE) ? 2 : 1;
+			for (uint v = 0; v < visits; v++)
+			{
+				cycle(l + 1);
+			}
+
+			fillGhostCells(coarse.x, coarse.numberCellsX, coarse.numberCellsY, m_boundary);
+			prolongateCorrection(coarse, level);
+			fillGhostCells(level.x, level.numberCellsX, level.numberCellsY, m_boundary);
+
+			smooth(level, m_postSmoothing);
+		}
+
+		template <typename Function>
+		void forEachRow(uint ny, const Function & function)
+		{
+			if (ny >= MULTIGRID_PARALLEL_CELLS)
+			{
+				m_threadPool.parallelFor(1, ny + 1, function);
+			}
+			else
+			{
+				function(1, ny + 1);
+			}
+		}
+
+		void smooth(MultigridLevel<T> & level, uint sweeps)
+		{
+			uint nx = level.numberCellsX;
+			uint ny = level.numberCellsY;
+			std::size_t stride = std::size_t(nx) + 2;
+			T * x = level.x;
+			const T * b = level.b;
+
+			for (uint s = 0; s < sweeps; s++)
+			{
+				for (uint colour = 0; colour < 2; colour++)
+				{
+					forEachRow(ny, [&](uint jBegin, uint jEnd)
+					{
+						for (uint j = jBegin; j < jEnd; j++)
+						{
+							T * row = x + j * stride;
+							const T * rowSoth = row - stride;
+							const T * rowNrth = row + stride;
+							const T * rowRhs = b + j * stride;
+
+							for (uint i = 1 + ((j + colour + 1) & 1); i <= nx; i += 2)
+							{
+								row[i] = T(0.25) * (rowRhs[i] + row[i - 1] + row[i + 1] + rowSoth[i] + rowNrth[i]);
+							}
+						}
+					});
+					fillGhostCells(x, nx, ny, m_boundary);
+				}
+			}
+		}
+
+		/// Stores b - A x in the level residual and returns its rms value,
+		/// the ghost cells of x have to be up to date
+		T computeResidual(MultigridLevel<T> & level)
+		{
+			uint nx = level.numberCellsX;
+			uint ny = level.numberCellsY;
+			std::size_t stride = std::size_t(nx) + 2;
+			const T * x = level.x;
+			const T * b = level.b;
+			T * r = level.residual.data();
+
+			std::mutex mutex;
+			double sumSquares = 0.0;
+			forEachRow(ny, [&](uint jBegin, uint jEnd)
+			{
+				double partialSum = 0.0;
+				for (uint j = jBegin; j < jEnd; j++)
+				{
+					for (uint i = 1; i <= nx; i++)
+					{
+						std::size_t cter = i + j * stride;
+						T residual = b[cter] - (T(4.0) * x[cter] - x[cter - 1] - x[cter + 1] - x[cter - stride] - x[cter + stride]);
+						r[cter] = residual;
+						partialSum += double(residual) * double(residual);
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				sumSquares += partialSum;
+			});
+
+			return T(std::sqrt(sumSquares / (double(nx) * double(ny))));
+		}
+
+		void restrictResidual(const MultigridLevel<T> & fine, MultigridLevel<T> & coarse)
+		{
+			uint ncx = coarse.numberCellsX;
+			std::size_t strideFine = std::size_t(fine.numberCellsX) + 2;
+			std::size_t strideCoarse = std::size_t(ncx) + 2;
+			const T * r = fine.residual.data();
+			T * b = coarse.rhs.data();
+
+			forEachRow(coarse.numberCellsY, [&](uint jBegin, uint jEnd)
+			{
+				for (uint J = jBegin; J < jEnd; J++)
+				{
+					const T * rowBottom = r + (2 * J - 1) * strideFine;
+					const T * rowTop = rowBottom + strideFine;
+					for (uint I = 1; I <= ncx; I++)
+					{
+						b[I + J * strideCoarse] = rowBottom[2 * I - 1] + rowBottom[2 * I] + rowTop[2 * I - 1] + rowTop[2 * I];
+					}
+				}
+			});
+		}
+
+		void prolongateCorrection(const MultigridLevel<T> & coarse, MultigridLevel<T> & fine)
+		{
+			uint nfx = fine.numberCellsX;
+			std::size_t strideFine = std::size_t(nfx) + 2;
+			std::size_t strideCoarse = std::size_t(coarse.numberCellsX) + 2;
+			const T * e = coarse.x;
+			T * x = fine.x;
+
+			forEachRow(fine.numberCellsY, [&](uint jBegin, uint jEnd)
+			{
+				for (uint j = jBegin; j < jEnd; j++)
+				{
+					uint J = (j + 1) / 2;
+					std::ptrdiff_t dj = (j & 1) ? -std::ptrdiff_t(strideCoarse) : std::ptrdiff_t(strideCoarse);
+					for (uint i = 1; i <= nfx; i++)
+					{
+						uint I = (i + 1) / 2;
+						std::ptrdiff_t di = (i & 1) ? -1 : 1;
+
+						std::size_t cter = I + J * strideCoarse;
+						x[i + j * strideFine] += T(1.0 / 16.0) *
+							(T(9.0) * e[cter] + T(3.0) * (e[cter + di] + e[cter + dj]) + e[cter + di + dj]);
+					}
+				}
+			});
+		}
+
+		void coarseSolve(MultigridLevel<T> & level)
+		{
+			uint nx = level.numberCellsX;
+			uint ny = level.numberCellsY;
+			std::size_t stride = std::size_t(nx) + 2;
+
+			/// The periodic problem is singular, keep the right hand side in its range
+			if (m_boundary == PERIODIC && !level.rhs.empty())
+			{
+				T * b = level.rhs.data();
+				double mean = 0.0;
+				for (uint j = 1; j <= ny; j++)
+				{
+					for (uint i = 1; i <= nx; i++)
+					{
+						mean += b[i + j * stride];
+					}
+				}
+				mean /= double(nx) * double(ny);
+
+				for (uint j = 1; j <= ny; j++)
+				{
+					for (uint i = 1; i <= nx; i++)
+					{
+						b[i + j * stride] -= T(mean);
+					}
+				}
+			}
+
+			if (m_coarseConjugateGradient)
+			{
+				m_coarseSolver.solve(level.x, level.b, m_boundary);
+				return;
+			}
+			smooth(level, MULTIGRID_COARSE_SWEEPS);
+		}
+
+	private:
+		ThreadPool & m_threadPool;
+		std::vector<MultigridLevel<T>> m_levels;
+		boundaryType m_boundary = PERIODIC;
+		ConjugateGradient<T> m_coarseSolver;
+		bool m_coarseConjugateGradient = false;
+
+		/// Parameters
+		cycleType m_cycle = V_CYCLE;
+		uint m_maxCycles = MULTIGRID_MAX_CYCLES;
+		T m_tolerance = T(MULTIGRID_TOLERANCE);
+		uint m_preSmoothing = 2;
+		uint m_postSmoothing = 2;
+	};
+}
@@ -3,14 +3,19 @@
 #include "Fluid.h"
 #include <vector>
 
-#define TIME_INTEGRATION_INCREMENT_PARTICLE real(0.01)
+#define TIME_INTEGRATION_INCREMENT_PARTICLE 0.01
 #define NUM_TRAILING_PARTICLES 50
 
 namespace FluidSimulation
 {
+	/// Massless tracer advected by a Fluid, T is the precision of the
+	/// positions
+	template <typename T>
 	class Particle
 	{
 	public:
+		typedef glm::tvec2<T> vector2;
+
 		Particle()
 		{
 			reset();
@@ -21,45 +26,47 @@ namespace FluidSimulation
 
 		}
 		
-		vec2 fetchVelocityFluid(Fluid & fluid, uint cellParticleIDi, uint cellParticleIDj)
+		template <typename S>
+		vector2 fetchVelocityFluid(Fluid<S> & fluid, uint cellParticleIDi, uint cellParticleIDj)
 		{
-			real velocityFluidU = fluid.getVelocityU(cellParticleIDi, cellParticleIDj);
-			real velocityFluidV = fluid.getVelocityV(cellParticleIDi, cellParticleIDj);
-			return vec2(velocityFluidU, velocityFluidV);
+			T velocityFluidU = T(fluid.getVelocityU(cellParticleIDi, cellParticleIDj));
+			T velocityFluidV = T(fluid.getVelocityV(cellParticleIDi, cellParticleIDj));
+			return vector2(velocityFluidU, velocityFluidV);
 		}
 		
-		void boundaryConditions(vec2 & position, real spacing, const boundaryType boundary)
+		void boundaryConditions(vector2 & position, T spacing, const boundaryType boundary)
 		{
 			if (position.x < spacing)
 			{
-				position.x = (boundary == PERIODIC) ? real(1.0) - spacing : real(0.0);
+				position.x = (boundary == PERIODIC) ? T(1.0) - spacing : T(0.0);
 			}
 
 			if (position.y < spacing)
 			{
-				position.y = (boundary == PERIODIC) ? real(1.0) - spacing : real(0.0);
+				position.y = (boundary == PERIODIC) ? T(1.0) - spacing : T(0.0);
 			}
 
-			if (position.x > real(1.0) - spacing)
+			if (position.x > T(1.0) - spacing)
 			{
-				position.x = (boundary == PERIODIC) ? spacing : real(1.0);
+				position.x = (boundary == PERIODIC) ? spacing : T(1.0);
 			}
 
-			if (position.y > real(1.0) - spacing)
+			if (position.y > T(1.0) - spacing)
 			{
-				position.y = (boundary == PERIODIC) ? spacing : real(1.0);
+				position.y = (boundary == PERIODIC) ? spacing : T(1.0);
 			}
 		}
 		
-		void animate(real dt, Fluid & fluid, const boundaryType boundary)
+		template <typename S>
+		void animate(T dt, Fluid<S> & fluid, const boundaryType boundary)
 		{
 			uint numCells = fluid.getNumCells();
-			real spacing = real(1.0) / numCells;
+			T spacing = T(1.0) / numCells;
 			
 			/// Fetch velocity
 			uint cellParticleIDi = (uint)(m_position.x * numCells);
 			uint cellParticleIDj = (uint)(m_position.y * numCells);
-			vec2 velocityFluid = fetchVelocityFluid(fluid, cellParticleIDi, cellParticleIDj);
+			vector2 velocityFluid = fetchVelocityFluid(fluid, cellParticleIDi, cellParticleIDj);
 
 			/// Euler integration
 			m_position += (m_weight * dt * (velocityFluid));
@@ -73,7 +80,7 @@ namespace FluidSimulation
 			{
 				uint cellParticleIDi = (uint)(m_trailing[n].x * numCells);
 				uint cellParticleIDj = (uint)(m_trailing[n].y * numCells);
-				vec2 velocityFluid = fetchVelocityFluid(fluid, cellParticleIDi, cellParticleIDj);
+				vector2 velocityFluid = fetchVelocityFluid(fluid, cellParticleIDi, cellParticleIDj);
 
 				m_trailing[n + 1] = m_trailing[n] - dt * (velocityFluid);
 
@@ -85,47 +92,48 @@ namespace FluidSimulation
 		{
 			m_active = false;
 			m_trailing.resize(NUM_TRAILING_PARTICLES);
-			m_position = vec2(0.0);
+			m_position = vector2(T(0.0));
 
-			real sampleRandomNumber = (std::rand() / real(RAND_MAX));
+			T sampleRandomNumber = (std::rand() / T(RAND_MAX));
 			m_weight = sampleRandomNumber;
 		}
 
-		vec2 getPosition() const
+		vector2 getPosition() const
 		{
 			return m_position;
 		}
 
-		void setPosition(vec2 position)
+		void setPosition(vector2 position)
 		{
 			m_position = position;
 		}
 
-		real getWeight() const
+		T getWeight() const
 		{
 			return m_weight;
 		}
 
-		std::vector<vec2> getTrailing() const
+		const std::vector<vector2> & getTrailing() const
 		{
 			return m_trailing;
 		}
 
 	private:
-		std::vector<vec2> m_trailing;
-		vec2 m_position;
+		std::vector<vector2> m_trailing;
+		vector2 m_position;
 		bool m_active;
-		real m_weight;
+		T m_weight;
 	};
 
+	template <typename T>
 	class ParticleSystem
-		: public SceneObject, public TimeIntegrator, public BoundaryConditions
+		: public SceneObject, public TimeIntegrator<T>, public BoundaryConditions
 	{
 	public:
 		ParticleSystem()
 		{
-			setTimeIncrement(TIME_INTEGRATION_INCREMENT_PARTICLE);
-			setTimeStep(TIME_INTEGRATION_INCREMENT_PARTICLE);
+			this->setTimeIncrement(T(TIME_INTEGRATION_INCREMENT_PARTICLE));
+			this->setTimeStep(T(TIME_INTEGRATION_INCREMENT_PARTICLE));
 		}
 
 		~ParticleSystem()
@@ -133,11 +141,12 @@ namespace FluidSimulation
 			clear();
 		}
 
-		void update(Fluid * fluid)
+		template <typename S>
+		void update(Fluid<S> * fluid)
 		{
 			for (auto & particle : m_particles)
 			{
-				particle.animate(m_timeStep, *fluid, m_boundary);
+				particle.animate(this->m_timeStep, *fluid, m_boundary);
 			}
 		}
 
@@ -146,12 +155,12 @@ namespace FluidSimulation
 			m_particles.clear();
 		}
 
-		void addParticle(const Particle & particle)
+		void addParticle(const Particle<T> & particle)
 		{
 			m_particles.push_back(particle);
 		}
 
-		const std::vector<Particle> getParticles() const
+		const std::vector<Particle<T>> & getParticles() const
 		{
 			return m_particles;
 		}
@@ -167,6 +176,6 @@ namespace FluidSimulation
 		}
 
 	private:
-		std::vector<Particle> m_particles;
+		std::vector<Particle<T>> m_particles;
 	};
 }
\ No newline at end of file
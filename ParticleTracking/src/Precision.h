@@ -0,0 +1,330 @@
+#pragma once
+#include "Definitions.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FLUIDSIM_SIMD_X86 1
+#define FLUIDSIM_TARGET_AVX2 __attribute__((target("avx2")))
+#define FLUIDSIM_TARGET_AVX512 __attribute__((target("avx512f")))
+#define FLUIDSIM_TARGET_F16C __attribute__((target("f16c")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#include <intrin.h>
+#define FLUIDSIM_SIMD_X86 1
+#define FLUIDSIM_TARGET_AVX2
+#define FLUIDSIM_TARGET_AVX512
+#define FLUIDSIM_TARGET_F16C
+#elif defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace FluidSimulation
+{
+	/// IEEE 754 binary16 storage, 11 bits of precision and a range up to
+	/// 65504. Arithmetic happens in float, stores round to nearest even.
+	/// The conversions of single values use F16C when the compiler targets
+	/// it (the FLUIDSIM_F16C CMake option), whole rows are converted with
+	/// widenRow / narrowRow which pick F16C at run time.
+	struct float16
+	{
+		float16() = default;
+
+		float16(float value)
+			: bits(fromFloat(value))
+		{
+
+		}
+
+		operator float() const
+		{
+			return toFloat(bits);
+		}
+
+		float16 & operator+=(float value)
+		{
+			bits = fromFloat(toFloat(bits) + value);
+			return *this;
+		}
+
+		float16 & operator-=(float value)
+		{
+			bits = fromFloat(toFloat(bits) - value);
+			return *this;
+		}
+
+		/// Branch free so the conversions vectorize with the stencils
+		static uint16_t fromFloat(float value)
+		{
+#if defined(__F16C__)
+			return uint16_t(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+#else
+			uint32_t x = floatBits(value);
+			uint32_t sign = x & 0x80000000u;
+			uint32_t absolute = x ^ sign;
+
+			/// Normal results, rebias the exponent and round to nearest even
+			uint32_t normal = (absolute + 0xc8000fffu + ((absolute >> 13) & 1u)) >> 13;
+
+			/// Subnormal results, adding 0.5 aligns the mantissa so the float
+			/// adder does the rounding
+			uint32_t subnormal = floatBits(bitsFloat(absolute) + 0.5f) - 0x3f000000u;
+
+			/// Infinity and NaN, or magnitudes rounding beyond 65504
+			uint32_t special = (absolute > 0x7f800000u) ? 0x7e00u : 0x7c00u;
+
+			uint32_t result = (absolute >= 0x47800000u) ? special : ((absolute < 0x38800000u) ? subnormal : normal);
+			return uint16_t(result | (sign >> 16));
+#endif
+		}
+
+		static float toFloat(uint16_t bits)
+		{
+#if defined(__F16C__)
+			return _cvtsh_ss(bits);
+#else
+			uint32_t magnitude = uint32_t(bits & 0x7fffu) << 13;
+			uint32_t exponent = magnitude & 0x0f800000u;
+			uint32_t normal = magnitude + 0x38000000u;
+			uint32_t special = normal + 0x38000000u;
+			uint32_t subnormal = floatBits(bitsFloat(normal + 0x00800000u) - bitsFloat(0x38800000u));
+
+			uint32_t result = (exponent == 0x0f800000u) ? special : ((exponent == 0u) ? subnormal : normal);
+			return bitsFloat(result | (uint32_t(bits & 0x8000u) << 16));
+#endif
+		}
+
+		static uint32_t floatBits(float value)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			return bits;
+		}
+
+		static float bitsFloat(uint32_t bits)
+		{
+			float value;
+			std::memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+		uint16_t bits;
+	};
+
+	/// bfloat16 storage, the upper half of a float: same range, 8 bits of
+	/// precision. Stores round to nearest even.
+	struct bfloat16
+	{
+		bfloat16() = default;
+
+		bfloat16(float value)
+			: bits(fromFloat(value))
+		{
+
+		}
+
+		operator float() const
+		{
+			return toFloat(bits);
+		}
+
+		bfloat16 & operator+=(float value)
+		{
+			bits = fromFloat(toFloat(bits) + value);
+			return *this;
+		}
+
+		bfloat16 & operator-=(float value)
+		{
+			bits = fromFloat(toFloat(bits) - value);
+			return *this;
+		}
+
+		static uint16_t fromFloat(float value)
+		{
+			uint32_t x = float16::floatBits(value);
+			uint32_t rounded = (x + 0x7fffu + ((x >> 16) & 1u)) >> 16;
+			return uint16_t(((x & 0x7fffffffu) > 0x7f800000u) ? ((x >> 16) | 0x40u) : rounded);
+		}
+
+		static float toFloat(uint16_t bits)
+		{
+			return float16::bitsFloat(uint32_t(bits) << 16);
+		}
+
+		uint16_t bits;
+	};
+
+	/// Processor support of the bulk conversions, checked once
+	inline bool cpuSupportsF16C()
+	{
+#if defined(FLUIDSIM_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+		static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("f16c") != 0);
+#elif defined(FLUIDSIM_SIMD_X86)
+		static const bool supported = []()
+		{
+			int registers[4];
+			__cpuid(registers, 1);
+			bool osSavesAvx = (registers[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+			return osSavesAvx && (registers[2] & (1 << 29)) != 0;
+		}();
+#else
+		static const bool supported = false;
+#endif
+		return supported;
+	}
+
+	inline bool cpuSupportsAvx2()
+	{
+#if defined(FLUIDSIM_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+		static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+#elif defined(FLUIDSIM_SIMD_X86)
+		static const bool supported = []()
+		{
+			int registers[4];
+			__cpuid(registers, 1);
+			bool osSavesAvx = (registers[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+			__cpuidex(registers, 7, 0);
+			return osSavesAvx && (registers[1] & (1 << 5)) != 0;
+		}();
+#else
+		static const bool supported = false;
+#endif
+		return supported;
+	}
+
+#ifdef FLUIDSIM_SIMD_X86
+	/// 8 values per instruction, same rounding as float16::fromFloat
+	FLUIDSIM_TARGET_F16C inline void widenRowF16C(const float16 * x, float * y, std::size_t n)
+	{
+		std::size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			_mm256_storeu_ps(y + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i))));
+		}
+		for (; i < n; i++) y[i] = float(x[i]);
+	}
+
+	FLUIDSIM_TARGET_F16C inline void narrowRowF16C(const float * y, float16 * x, std::size_t n)
+	{
+		std::size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(x + i), _mm256_cvtps_ph(_mm256_loadu_ps(y + i), _MM_FROUND_TO_NEAREST_INT));
+		}
+		for (; i < n; i++) x[i] = float16(y[i]);
+	}
+
+	/// The shift and the rounding of bfloat16, 8 values per iteration
+	FLUIDSIM_TARGET_AVX2 inline void widenRowAvx2(const bfloat16 * x, float * y, std::size_t n)
+	{
+		std::size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256i bits = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i)));
+			_mm256_storeu_ps(y + i, _mm256_castsi256_ps(_mm256_slli_epi32(bits, 16)));
+		}
+		for (; i < n; i++) y[i] = float(x[i]);
+	}
+
+	FLUIDSIM_TARGET_AVX2 inline void narrowRowAvx2(const float * y, bfloat16 * x, std::size_t n)
+	{
+		__m256i one = _mm256_set1_epi32(1);
+		__m256i bias = _mm256_set1_epi32(0x7fff);
+		__m256i magnitude = _mm256_set1_epi32(0x7fffffff);
+		__m256i infinity = _mm256_set1_epi32(0x7f800000);
+		__m256i quietBit = _mm256_set1_epi32(0x40);
+
+		std::size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256i bits = _mm256_castps_si256(_mm256_loadu_ps(y + i));
+			__m256i upper = _mm256_srli_epi32(bits, 16);
+			__m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(bits, bias), _mm256_and_si256(upper, one)), 16);
+			__m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(bits, magnitude), infinity);
+			__m256i result = _mm256_blendv_epi8(rounded, _mm256_or_si256(upper, quietBit), nan);
+
+			/// The pack works within 128 bit lanes, the permute gathers the
+			/// low halves of both
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(result, result), 0xd8);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(x + i), _mm256_castsi256_si128(packed));
+		}
+		for (; i < n; i++) x[i] = bfloat16(y[i]);
+	}
+#endif
+
+	/// Rows of 16 bit storage to float and back, for the kernels working on a
+	/// row at a time. Same results as converting the values one by one.
+	inline void widenRow(const float16 * x, float * y, std::size_t n)
+	{
+#ifdef FLUIDSIM_SIMD_X86
+		if (cpuSupportsF16C())
+		{
+			widenRowF16C(x, y, n);
+			return;
+		}
+#endif
+		for (std::size_t i = 0; i < n; i++) y[i] = float(x[i]);
+	}
+
+	inline void narrowRow(const float * y, float16 * x, std::size_t n)
+	{
+#ifdef FLUIDSIM_SIMD_X86
+		if (cpuSupportsF16C())
+		{
+			narrowRowF16C(y, x, n);
+			return;
+		}
+#endif
+		for (std::size_t i = 0; i < n; i++) x[i] = float16(y[i]);
+	}
+
+	inline void widenRow(const bfloat16 * x, float * y, std::size_t n)
+	{
+#ifdef FLUIDSIM_SIMD_X86
+		if (cpuSupportsAvx2())
+		{
+			widenRowAvx2(x, y, n);
+			return;
+		}
+#endif
+		for (std::size_t i = 0; i < n; i++) y[i] = float(x[i]);
+	}
+
+	inline void narrowRow(const float * y, bfloat16 * x, std::size_t n)
+	{
+#ifdef FLUIDSIM_SIMD_X86
+		if (cpuSupportsAvx2())
+		{
+			narrowRowAvx2(y, x, n);
+			return;
+		}
+#endif
+		for (std::size_t i = 0; i < n; i++) x[i] = bfloat16(y[i]);
+	}
+
+	/// Type the arithmetic on a stored scalar is carried out in, the 16 bit
+	/// formats are only a storage format
+	template <typename T>
+	struct ScalarTraits
+	{
+		typedef T compute;
+	};
+
+	template <>
+	struct ScalarTraits<float16>
+	{
+		typedef float compute;
+	};
+
+	template <>
+	struct ScalarTraits<bfloat16>
+	{
+		typedef float compute;
+	};
+
+	template <typename T>
+	using Compute = typename ScalarTraits<T>::compute;
+}
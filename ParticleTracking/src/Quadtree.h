@@ -0,0 +1,477 @@
+#pragma once
+#include "BoundaryConditions.h"
+#include "Definitions.h"
+#include "Precision.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#define QUADTREE_BLOCK_SIZE 16
+#define QUADTREE_BLOCK_STRIDE (QUADTREE_BLOCK_SIZE + 2)
+#define QUADTREE_BLOCK_VALUES (QUADTREE_BLOCK_STRIDE * QUADTREE_BLOCK_STRIDE)
+#define QUADTREE_MAX_LEVELS 6
+
+namespace FluidSimulation
+{
+	/// Block of QUADTREE_BLOCK_SIZE x QUADTREE_BLOCK_SIZE cells at position
+	/// (bx, by) among the blocks of its level, every level halves the cells
+	/// of the one above. Children are ordered (0, 0), (1, 0), (0, 1), (1, 1).
+	struct QuadtreeNode
+	{
+		uint level = 0;
+		uint bx = 0;
+		uint by = 0;
+		int parent = -1;
+		int children[4] = { -1, -1, -1, -1 };
+		bool used = false;
+
+		bool isLeaf() const
+		{
+			return children[0] < 0;
+		}
+	};
+
+	/// Topology of a block structured quadtree over a base grid of
+	/// blocksX x blocksY blocks. Blocks keep their index while they exist,
+	/// freed indices are reused, so fields stored per block index stay in
+	/// place across refinement. Leaves cover the domain once; the interior
+	/// blocks keep their storage and hold restricted values when needed.
+	///
+	/// The tree is kept 2:1 balanced including corners: the leaves next to a
+	/// leaf of level l are at least of level l - 1.
+	class Quadtree
+	{
+	public:
+		void resize(uint blocksX, uint blocksY, uint numLevels)
+		{
+			m_blocksX = blocksX;
+			m_blocksY = blocksY;
+			m_numLevels = std::max(uint(1), std::min(numLevels, uint(QUADTREE_MAX_LEVELS)));
+
+			m_nodes.clear();
+			m_free.clear();
+			m_lookup.assign(m_numLevels, std::vector<int>());
+			for (uint l = 0; l < m_numLevels; l++)
+			{
+				m_lookup[l].assign(std::size_t(blocksAlongX(l)) * blocksAlongY(l), -1);
+			}
+
+			for (uint by = 0; by < blocksY; by++)
+			{
+				for (uint bx = 0; bx < blocksX; bx++)
+				{
+					createNode(0, bx, by, -1);
+				}
+			}
+			updateLeaves();
+		}
+
+		uint getNumLevels() const
+		{
+			return m_numLevels;
+		}
+
+		uint blocksAlongX(uint level) const
+		{
+			return m_blocksX << level;
+		}
+
+		uint blocksAlongY(uint level) const
+		{
+			return m_blocksY << level;
+		}
+
+		/// Block at a position of a level, -1 outside the domain or where the
+		/// level is not refined that far
+		int getBlock(uint level, int bx, int by) const
+		{
+			if (level >= m_numLevels) return -1;
+			if (bx < 0 || by < 0 || bx >= int(blocksAlongX(level)) || by >= int(blocksAlongY(level))) return -1;
+			return m_lookup[level][std::size_t(bx) + std::size_t(by) * blocksAlongX(level)];
+		}
+
+		/// Same with positions outside the domain wrapped around for PERIODIC
+		int getNeighbour(uint level, int bx, int by, boundaryType boundary) const
+		{
+			if (boundary == PERIODIC)
+			{
+				int nx = int(blocksAlongX(level));
+				int ny = int(blocksAlongY(level));
+				bx = (bx % nx + nx) % nx;
+				by = (by % ny + ny) % ny;
+			}
+			return getBlock(level, bx, by);
+		}
+
+		const QuadtreeNode & getNode(int block) const
+		{
+			return m_nodes[block];
+		}
+
+		/// Indices of the leaves, from the coarsest level to the finest
+		const std::vector<int> & getLeaves() const
+		{
+			return m_leaves;
+		}
+
+		/// Block indices are below the capacity, fields are sized for it
+		std::size_t getCapacity() const
+		{
+			return m_nodes.size();
+		}
+
+		std::size_t getNumLeaves(uint level) const
+		{
+			std::size_t count = 0;
+			for (int leaf : m_leaves) count += (m_nodes[leaf].level == level) ? 1 : 0;
+			return count;
+		}
+
+		/// Leaf holding a point of the domain given in cells of level 0
+		int locate(double x, double y) const
+		{
+			int bx = std::min(std::max(int(std::floor(x / QUADTREE_BLOCK_SIZE)), 0), int(m_blocksX) - 1);
+			int by = std::min(std::max(int(std::floor(y / QUADTREE_BLOCK_SIZE)), 0), int(m_blocksY) - 1);
+			int block = getBlock(0, bx, by);
+			while (!m_nodes[block].isLeaf())
+			{
+				const QuadtreeNode & node = m_nodes[block];
+				double scale = double(1u << (node.level + 1)) / QUADTREE_BLOCK_SIZE;
+				int cx = std::min(std::max(int(std::floor(x * scale)) - int(2 * node.bx), 0), 1);
+				int cy = std::min(std::max(int(std::floor(y * scale)) - int(2 * node.by), 0), 1);
+				block = node.children[cx + 2 * cy];
+			}
+			return block;
+		}
+
+		/// Splits a leaf in four, false on the finest level
+		bool refine(int block)
+		{
+			if (!m_nodes[block].isLeaf() || m_nodes[block].level + 1 >= m_numLevels) return false;
+
+			uint level = m_nodes[block].level + 1;
+			uint bx = 2 * m_nodes[block].bx;
+			uint by = 2 * m_nodes[block].by;
+			for (uint c = 0; c < 4; c++)
+			{
+				int child = createNode(level, bx + (c & 1), by + (c >> 1), block);
+				m_nodes[block].children[c] = child;
+			}
+			return true;
+		}
+
+		/// Merges the four leaves below a block
+		void coarsen(int block)
+		{
+			for (uint c = 0; c < 4; c++)
+			{
+				int child = m_nodes[block].children[c];
+				const QuadtreeNode & node = m_nodes[child];
+				m_lookup[node.level][std::size_t(node.bx) + std::size_t(node.by) * blocksAlongX(node.level)] = -1;
+				m_nodes[child].used = false;
+				m_free.push_back(child);
+				m_nodes[block].children[c] = -1;
+			}
+		}
+
+		/// A block whose children are all leaves
+		bool hasLeafChildren(int block) const
+		{
+			const QuadtreeNode & node = m_nodes[block];
+			if (node.isLeaf()) return false;
+			for (uint c = 0; c < 4; c++)
+			{
+				if (!m_nodes[node.children[c]].isLeaf()) return false;
+			}
+			return true;
+		}
+
+		/// Merging the children of the block keeps the balance: no block of
+		/// its level around it has children that are refined again
+		bool canCoarsen(int block, boundaryType boundary) const
+		{
+			if (!hasLeafChildren(block)) return false;
+			const QuadtreeNode & node = m_nodes[block];
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					int neighbour = getNeighbour(node.level, int(node.bx) + dx, int(node.by) + dy, boundary);
+					if (neighbour < 0 || m_nodes[neighbour].isLeaf()) continue;
+					for (uint c = 0; c < 4; c++)
+					{
+						if (!m_nodes[m_nodes[neighbour].children[c]].isLeaf()) return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		/// Leaf that has to be refined so the blocks of level - 1 around the
+		/// given leaf exist, -1 when the balance holds there
+		int findUnbalanced(int leaf, boundaryType boundary) const
+		{
+			const QuadtreeNode & node = m_nodes[leaf];
+			if (node.level < 2) return -1;
+
+			uint coarse = node.level - 1;
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					int bx = int(node.bx) + dx;
+					int by = int(node.by) + dy;
+					if (boundary == PERIODIC)
+					{
+						int nx = int(blocksAlongX(node.level));
+						int ny = int(blocksAlongY(node.level));
+						bx = (bx % nx + nx) % nx;
+						by = (by % ny + ny) % ny;
+					}
+					else if (bx < 0 || by < 0 || bx >= int(blocksAlongX(node.level)) || by >= int(blocksAlongY(node.level)))
+					{
+						continue;
+					}
+
+					if (getBlock(coarse, bx >> 1, by >> 1) >= 0) continue;
+
+					/// The leaf covering that region is at least two levels coarser
+					uint scale = 1u << node.level;
+					return locate((bx + 0.5) * QUADTREE_BLOCK_SIZE / scale, (by + 0.5) * QUADTREE_BLOCK_SIZE / scale);
+				}
+			}
+			return -1;
+		}
+
+		void updateLeaves()
+		{
+			m_leaves.clear();
+			for (std::size_t n = 0; n < m_nodes.size(); n++)
+			{
+				if (m_nodes[n].used && m_nodes[n].isLeaf()) m_leaves.push_back(int(n));
+			}
+			std::stable_sort(m_leaves.begin(), m_leaves.end(), [this](int a, int b) { return m_nodes[a].level < m_nodes[b].level; });
+		}
+
+	protected:
+		int createNode(uint level, uint bx, uint by, int parent)
+		{
+			int block;
+			if (!m_free.empty())
+			{
+				block = m_free.back();
+				m_free.pop_back();
+				m_nodes[block] = QuadtreeNode();
+			}
+			else
+			{
+				block = int(m_nodes.size());
+				m_nodes.push_back(QuadtreeNode());
+			}
+
+			QuadtreeNode & node = m_nodes[block];
+			node.level = level;
+			node.bx = bx;
+			node.by = by;
+			node.parent = parent;
+			node.used = true;
+			m_lookup[level][std::size_t(bx) + std::size_t(by) * blocksAlongX(level)] = block;
+			return block;
+		}
+
+	private:
+		uint m_blocksX = 0;
+		uint m_blocksY = 0;
+		uint m_numLevels = 1;
+
+		std::vector<QuadtreeNode> m_nodes;
+		std::vector<int> m_free;
+		std::vector<int> m_leaves;
+
+		/// Per level, the block at every position or -1
+		std::vector<std::vector<int>> m_lookup;
+	};
+
+	/// Values of one field on every block of a tree, each block with a ring
+	/// of ghost cells like the fields of Fluid. Cell (i, j), 1 <= i, j <=
+	/// QUADTREE_BLOCK_SIZE, of a block is at (i + j * QUADTREE_BLOCK_STRIDE).
+	template <typename T>
+	class QuadtreeField
+	{
+	public:
+		void resize(std::size_t capacity)
+		{
+			m_values.resize(capacity * QUADTREE_BLOCK_VALUES, T(0.0f));
+		}
+
+		T * block(int block)
+		{
+			return m_values.data() + std::size_t(block) * QUADTREE_BLOCK_VALUES;
+		}
+
+		const T * block(int block) const
+		{
+			return m_values.data() + std::size_t(block) * QUADTREE_BLOCK_VALUES;
+		}
+
+	private:
+		std::vector<T> m_values;
+	};
+
+	/// Value of cell (i, j) of a level, in global cells of that level, as the
+	/// leaves see it. Leaves of the level give their value, finer leaves the
+	/// mean of the four cells below and coarser ones a bilinear estimate
+	/// from the central slopes of the coarser level. Cells outside the
+	/// domain wrap around for PERIODIC walls and mirror with the opposite
+	/// sign for DIRICHLET ones, the conventions of fillGhostCells.
+	template <typename T>
+	Compute<T> quadtreeCellValue(const Quadtree & tree, const QuadtreeField<T> & field, uint level, int i, int j, boundaryType boundary)
+	{
+		typedef Compute<T> C;
+		int nx = int(tree.blocksAlongX(level)) * QUADTREE_BLOCK_SIZE;
+		int ny = int(tree.blocksAlongY(level)) * QUADTREE_BLOCK_SIZE;
+		if (boundary == PERIODIC)
+		{
+			i = (i % nx + nx) % nx;
+			j = (j % ny + ny) % ny;
+		}
+		else
+		{
+			bool outsideX = (i < 0 || i >= nx);
+			bool outsideY = (j < 0 || j >= ny);
+			if (outsideX && outsideY) return C(0.0);
+			if (outsideX) return -quadtreeCellValue(tree, field, level, (i < 0) ? -1 - i : 2 * nx - 1 - i, j, boundary);
+			if (outsideY) return -quadtreeCellValue(tree, field, level, i, (j < 0) ? -1 - j : 2 * ny - 1 - j, boundary);
+		}
+
+		int block = tree.getBlock(level, i / QUADTREE_BLOCK_SIZE, j / QUADTREE_BLOCK_SIZE);
+		if (block >= 0)
+		{
+			if (tree.getNode(block).isLeaf())
+			{
+				int li = i % QUADTREE_BLOCK_SIZE + 1;
+				int lj = j % QUADTREE_BLOCK_SIZE + 1;
+				return C(field.block(block)[li + lj * QUADTREE_BLOCK_STRIDE]);
+			}
+
+			C sum = C(0.0);
+			for (int c = 0; c < 4; c++)
+			{
+				sum += quadtreeCellValue(tree, field, level + 1, 2 * i + (c & 1), 2 * j + (c >> 1), boundary);
+			}
+			return C(0.25) * sum;
+		}
+
+		/// Centre of the fine cell is a quarter of a coarse cell off
+		int ci = i >> 1;
+		int cj = j >> 1;
+		C sx = (i & 1) ? C(0.25) : C(-0.25);
+		C sy = (j & 1) ? C(0.25) : C(-0.25);
+		C centre = quadtreeCellValue(tree, field, level - 1, ci, cj, boundary);
+		C slopeX = C(0.5) * (quadtreeCellValue(tree, field, level - 1, ci + 1, cj, boundary) - quadtreeCellValue(tree, field, level - 1, ci - 1, cj, boundary));
+		C slopeY = C(0.5) * (quadtreeCellValue(tree, field, level - 1, ci, cj + 1, boundary) - quadtreeCellValue(tree, field, level - 1, ci, cj - 1, boundary));
+		return centre + sx * slopeX + sy * slopeY;
+	}
+
+	/// Ghost cells of one leaf from the leaves around it. Neighbours of the
+	/// same level are copied, the others go through quadtreeCellValue.
+	template <typename T>
+	void fillQuadtreeGhostCells(const Quadtree & tree, QuadtreeField<T> & field, int leaf, boundaryType boundary)
+	{
+		const QuadtreeNode & node = tree.getNode(leaf);
+		T * x = field.block(leaf);
+		int iBase = int(node.bx) * QUADTREE_BLOCK_SIZE - 1;
+		int jBase = int(node.by) * QUADTREE_BLOCK_SIZE - 1;
+
+		for (int lj = 0; lj < QUADTREE_BLOCK_STRIDE; lj++)
+		{
+			bool ghostRow = (lj == 0 || lj == QUADTREE_BLOCK_STRIDE - 1);
+			for (int li = 0; li < QUADTREE_BLOCK_STRIDE; li += (ghostRow ? 1 : QUADTREE_BLOCK_STRIDE - 1))
+			{
+				x[li + lj * QUADTREE_BLOCK_STRIDE] = T(quadtreeCellValue(tree, field, node.level, iBase + li, jBase + lj, boundary));
+			}
+		}
+	}
+
+	/// Bilinear sample of a leaf with its ghost cells filled, at a point in
+	/// cells of level 0 inside the domain
+	template <typename T>
+	Compute<T> sampleQuadtreeLeaf(const Quadtree & tree, const QuadtreeField<T> & field, int leaf, double x, double y)
+	{
+		typedef Compute<T> C;
+		const QuadtreeNode & node = tree.getNode(leaf);
+		double scale = double(1u << node.level);
+		double px = std::min(std::max(x * scale - double(node.bx) * QUADTREE_BLOCK_SIZE + 0.5, 0.0), double(QUADTREE_BLOCK_SIZE) + 1.0);
+		double py = std::min(std::max(y * scale - double(node.by) * QUADTREE_BLOCK_SIZE + 0.5, 0.0), double(QUADTREE_BLOCK_SIZE) + 1.0);
+
+		int i0 = std::min(int(px), QUADTREE_BLOCK_SIZE);
+		int j0 = std::min(int(py), QUADTREE_BLOCK_SIZE);
+		C s1 = C(px - i0);
+		C t1 = C(py - j0);
+		C s0 = C(1.0) - s1;
+		C t0 = C(1.0) - t1;
+
+		const T * row0 = field.block(leaf) + j0 * QUADTREE_BLOCK_STRIDE;
+		const T * row1 = row0 + QUADTREE_BLOCK_STRIDE;
+		return s0 * (t0 * C(row0[i0]) + t1 * C(row1[i0])) + s1 * (t0 * C(row0[i0 + 1]) + t1 * C(row1[i0 + 1]));
+	}
+
+	/// Children of a refined block from its values, which need their ghost
+	/// cells: linear reconstruction with minmod limited slopes, so the
+	/// children keep the mean of the parent cell and add no new extrema
+	template <typename T>
+	void prolongQuadtreeBlock(const Quadtree & tree, QuadtreeField<T> & field, int parent)
+	{
+		typedef Compute<T> C;
+		auto minmod = [](C a, C b) { return (a * b <= C(0.0)) ? C(0.0) : ((std::abs(a) < std::abs(b)) ? a : b); };
+
+		const QuadtreeNode & node = tree.getNode(parent);
+		const T * x = field.block(parent);
+		for (uint c = 0; c < 4; c++)
+		{
+			T * child = field.block(node.children[c]);
+			int iOffset = (c & 1) * QUADTREE_BLOCK_SIZE / 2;
+			int jOffset = (c >> 1) * QUADTREE_BLOCK_SIZE / 2;
+			for (int j = 1; j <= QUADTREE_BLOCK_SIZE; j++)
+			{
+				for (int i = 1; i <= QUADTREE_BLOCK_SIZE; i++)
+				{
+					int pi = iOffset + (i + 1) / 2;
+					int pj = jOffset + (j + 1) / 2;
+					std::size_t cter = std::size_t(pi) + std::size_t(pj) * QUADTREE_BLOCK_STRIDE;
+					C centre = C(x[cter]);
+					C slopeX = minmod(C(x[cter + 1]) - centre, centre - C(x[cter - 1]));
+					C slopeY = minmod(C(x[cter + QUADTREE_BLOCK_STRIDE]) - centre, centre - C(x[cter - QUADTREE_BLOCK_STRIDE]));
+					C sx = (i & 1) ? C(-0.25) : C(0.25);
+					C sy = (j & 1) ? C(-0.25) : C(0.25);
+					child[i + j * QUADTREE_BLOCK_STRIDE] = T(centre + sx * slopeX + sy * slopeY);
+				}
+			}
+		}
+	}
+
+	/// Mean of the four children of every cell of a block
+	template <typename T>
+	void restrictQuadtreeBlock(const Quadtree & tree, QuadtreeField<T> & field, int parent)
+	{
+		typedef Compute<T> C;
+		const QuadtreeNode & node = tree.getNode(parent);
+		T * x = field.block(parent);
+		for (uint c = 0; c < 4; c++)
+		{
+			const T * child = field.block(node.children[c]);
+			int iOffset = (c & 1) * QUADTREE_BLOCK_SIZE / 2;
+			int jOffset = (c >> 1) * QUADTREE_BLOCK_SIZE / 2;
+			for (int j = 1; j <= QUADTREE_BLOCK_SIZE / 2; j++)
+			{
+				for (int i = 1; i <= QUADTREE_BLOCK_SIZE / 2; i++)
+				{
+					const T * fine = child + (2 * i - 1) + (2 * j - 1) * QUADTREE_BLOCK_STRIDE;
+					C sum = C(fine[0]) + C(fine[1]) + C(fine[QUADTREE_BLOCK_STRIDE]) + C(fine[QUADTREE_BLOCK_STRIDE + 1]);
+					x[(iOffset + i) + (jOffset + j) * QUADTREE_BLOCK_STRIDE] = T(C(0.25) * sum);
+				}
+			}
+		}
+	}
+}
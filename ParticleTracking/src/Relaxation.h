@@ -0,0 +1,617 @@
+#pragma once
+#include "BoundaryConditions.h"
+#include "Precision.h"
+#include "SolidMask.h"
+#include "SolverStatistics.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#define RELAXATION_TILE_DEPTH 4
+#define RELAXATION_MAX_BATCH 4
+#define RELAXATION_SWEEPS 20
+#define RELAXATION_CHECK_INTERVAL 4
+#define RELAXATION_ROW_CHUNK 256
+
+namespace FluidSimulation
+{
+	enum relaxationType
+	{
+		LEXICOGRAPHIC = 0,
+		RED_BLACK,
+		TILED
+	};
+
+	/// Sweeps of a relaxation. Without tolerance it runs maxSweeps sweeps,
+	/// with one it stops between minSweeps and maxSweeps once the rms
+	/// residual is below tolerance times the rms of the right hand side, the
+	/// residual of a zero guess. The residual b - A x is measured in a pass
+	/// of its own before the first sweep and every checkInterval sweeps, or
+	/// only after the last sweep without tolerance. An unmeasured relaxation
+	/// skips the passes and only counts its sweeps.
+	struct RelaxationCriterion
+	{
+		uint minSweeps = 1;
+		uint maxSweeps = RELAXATION_SWEEPS;
+		uint checkInterval = RELAXATION_CHECK_INTERVAL;
+		double tolerance = 0.0;
+		bool measured = true;
+
+		RelaxationCriterion() = default;
+
+		/// A fixed number of sweeps
+		explicit RelaxationCriterion(uint sweeps, bool measured = true) :
+			minSweeps(sweeps), maxSweeps(sweeps), measured(measured)
+		{
+
+		}
+	};
+
+	/// Sums of a residual pass
+	struct RelaxationResidual
+	{
+		double sumSquaresResidual = 0.0;
+		double sumSquaresSource = 0.0;
+		std::size_t numCells = 0;
+
+		void add(const RelaxationResidual & other)
+		{
+			sumSquaresResidual += other.sumSquaresResidual;
+			sumSquaresSource += other.sumSquaresSource;
+			numCells += other.numCells;
+		}
+
+		double rms() const
+		{
+			return std::sqrt(sumSquaresResidual / double(std::max(numCells, std::size_t(1))));
+		}
+
+		double rmsSource() const
+		{
+			return std::sqrt(sumSquaresSource / double(std::max(numCells, std::size_t(1))));
+		}
+	};
+
+	/// Gauss-Seidel relaxation of
+	///     c x(i, j) - a (x(i - 1, j) + x(i + 1, j) + x(i, j - 1) + x(i, j + 1)) = b(i, j)
+	/// on (nx + 2) x (ny + 2) row major fields, the kernels behind
+	/// Fluid::linearSolver. The kernels relax a batch of K fields sharing the
+	/// operator in the same sweep: the row offsets are computed once and the
+	/// K independent recurrences along a row overlap in the pipeline. Every
+	/// field gets exactly the arithmetic of a solve on its own.
+
+	/// Cells iBegin ... iEnd - 1 of row j
+	template <uint K, typename T>
+	inline void relaxRowLexicographic(T * const * x, const T * const * b, uint nx, Compute<T> a, Compute<T> c, uint j, uint iBegin, uint iEnd)
+	{
+		std::size_t stride = std::size_t(nx) + 2;
+		typedef Compute<T> C;
+		T * row[K];
+		const T * rowSoth[K];
+		const T * rowNrth[K];
+		const T * rowOld[K];
+		for (uint f = 0; f < K; f++)
+		{
+			row[f] = x[f] + j * stride;
+			rowSoth[f] = row[f] - stride;
+			rowNrth[f] = row[f] + stride;
+			rowOld[f] = b[f] + j * stride;
+		}
+
+		for (uint i = iBegin; i < iEnd; i++)
+		{
+			for (uint f = 0; f < K; f++)
+			{
+				row[f][i] = T((C(rowOld[f][i]) + a * (C(row[f][i - 1]) + C(row[f][i + 1]) + C(rowSoth[f][i]) + C(rowNrth[f][i]))) / c);
+			}
+		}
+	}
+
+	template <uint K, typename T>
+	inline void relaxRowLexicographic(T * const * x, const T * const * b, uint nx, Compute<T> a, Compute<T> c, uint j)
+	{
+		relaxRowLexicographic<K>(x, b, nx, a, c, j, 1, nx + 1);
+	}
+
+	template <uint K, typename T>
+	inline void relaxLexicographic(T * const * x, const T * const * b, uint nx, uint ny, Compute<T> a, Compute<T> c)
+	{
+		for (uint j = 1; j <= ny; j++)
+		{
+			relaxRowLexicographic<K>(x, b, nx, a, c, j);
+		}
+	}
+
+	/// Cells iBegin ... iEnd - 1 of row j with (i + j) % 2 == colour
+	template <uint K, typename T>
+	inline void relaxRowRedBlack(T * const * x, const T * const * b, uint nx, Compute<T> a, Compute<T> invc, uint j, uint iBegin, uint iEnd, uint colour)
+	{
+		std::size_t stride = std::size_t(nx) + 2;
+		typedef Compute<T> C;
+		uint iFirst = iBegin + ((iBegin + j + colour) & 1);
+		for (uint f = 0; f < K; f++)
+		{
+			T * row = x[f] + j * stride;
+			const T * rowSoth = row - stride;
+			const T * rowNrth = row + stride;
+			const T * rowOld = b[f] + j * stride;
+			for (uint i = iFirst; i < iEnd; i += 2)
+			{
+				row[i] = T((C(rowOld[i]) + a * (C(row[i - 1]) + C(row[i + 1]) + C(rowSoth[i]) + C(rowNrth[i]))) * invc);
+			}
+		}
+	}
+
+	/// Red-black rows of 16 bit fields. RELAXATION_ROW_CHUNK cells at a time
+	/// are widened to float with the bulk conversions, relaxed by the float
+	/// kernel and narrowed back. The cells of the other colour round trip
+	/// exactly, so the results are those of the value by value conversions.
+	template <uint K, typename T>
+	inline void relaxRowRedBlackWidened(T * const * x, const T * const * b, uint nx, float a, float invc, uint j, uint iBegin, uint iEnd, uint colour)
+	{
+		const uint width = RELAXATION_ROW_CHUNK;
+		std::size_t stride = std::size_t(nx) + 2;
+
+		/// Rows 0 ... 2 of a chunk wide grid, the chunk is row 1, and row 1
+		/// of the right hand side
+		float rows[3 * (RELAXATION_ROW_CHUNK + 2)];
+		float old[2 * (RELAXATION_ROW_CHUNK + 2)];
+		float * chunkRows[] = { rows };
+		const float * chunkOld[] = { old };
+		float * centre = rows + (width + 2);
+
+		for (uint f = 0; f < K; f++)
+		{
+			for (uint i0 = iBegin; i0 < iEnd; i0 += width)
+			{
+				uint n = std::min(iEnd - i0, width);
+				const T * row = x[f] + j * stride + i0;
+				widenRow(row - stride, rows + 1, n);
+				widenRow(row - 1, centre, std::size_t(n) + 2);
+				widenRow(row + stride, centre + (width + 2) + 1, n);
+				widenRow(b[f] + j * stride + i0, old + (width + 2) + 1, n);
+
+				/// Cell s of the chunk is cell i0 + s - 1 of the row
+				relaxRowRedBlack<1>(chunkRows, chunkOld, width, a, invc, 1, 1, n + 1, (colour + i0 + j) & 1);
+				narrowRow(centre + 1, x[f] + j * stride + i0, n);
+			}
+		}
+	}
+
+	template <uint K>
+	inline void relaxRowRedBlack(float16 * const * x, const float16 * const * b, uint nx, float a, float invc, uint j, uint iBegin, uint iEnd, uint colour)
+	{
+		relaxRowRedBlackWidened<K>(x, b, nx, a, invc, j, iBegin, iEnd, colour);
+	}
+
+	template <uint K>
+	inline void relaxRowRedBlack(bfloat16 * const * x, const bfloat16 * const * b, uint nx, float a, float invc, uint j, uint iBegin, uint iEnd, uint colour)
+	{
+		relaxRowRedBlackWidened<K>(x, b, nx, a, invc, j, iBegin, iEnd, colour);
+	}
+
+	/// Updates the cells with (i + j) % 2 == colour, they only depend on
+	/// cells of the other colour so the rows can be split across threads
+	template <uint K, typename T>
+	inline void relaxRedBlack(T * const * x, const T * const * b, uint nx, uint ny, Compute<T> a, Compute<T> c, uint colour, ThreadPool & threadPool)
+	{
+		typedef Compute<T> C;
+		C invc = C(1.0) / c;
+
+		threadPool.parallelFor(1, ny + 1, [&](uint jBegin, uint jEnd)
+		{
+			for (uint j = jBegin; j < jEnd; j++)
+			{
+				relaxRowRedBlack<K>(x, b, nx, a, invc, j, 1, nx + 1, colour);
+			}
+		});
+	}
+
+	/// Temporal blocking of red-black Gauss-Seidel. The colours of the
+	/// sweeps of a pass are its stages, stage s relaxes colour s % 2 and
+	/// only needs the rows around after stage s - 1. A pass moves a
+	/// wavefront over the rows: at every step stage s relaxes row step - s,
+	/// so the 2 depth + 2 rows of the wavefront stay in cache while every
+	/// row gets all the stages of the pass.
+	///
+	/// Ghost cells keep the values of the last complete sweep, as with the
+	/// sweep by sweep relaxation. The left and right ones of a row are
+	/// refreshed when the row completes a sweep, the ghost rows are kept per
+	/// sweep and copied in before the first and last rows are relaxed. With
+	/// PERIODIC walls the first row needs the last one after every sweep
+	/// before the wavefront gets there: the last 2 depth - 2 rows are
+	/// relaxed ahead on a copy, a triangle shrinking by one row per stage.
+	/// The results are those of relaxRedBlack. A pass runs on the calling
+	/// thread, relaxRedBlack spreads the rows over the pool instead.
+	template <uint K, boundaryType B, typename T>
+	inline void relaxTiled(T * const * x, const T * const * b, uint nx, uint ny, Compute<T> a, Compute<T> c, uint sweeps, uint depth)
+	{
+		typedef Compute<T> C;
+		C invc = C(1.0) / c;
+		std::size_t stride = std::size_t(nx) + 2;
+		depth = std::max(depth, uint(1));
+
+		/// The triangle has to stay clear of the first row
+		if (ny < 2 * depth + 2)
+		{
+			for (uint s = 0; s < sweeps; s++)
+			{
+				for (uint colour = 0; colour < 2; colour++)
+				{
+					for (uint j = 1; j <= ny; j++) relaxRowRedBlack<K>(x, b, nx, a, invc, j, 1, nx + 1, colour);
+				}
+				for (uint f = 0; f < K; f++) fillGhostCells<B>(x[f], nx, ny);
+			}
+			return;
+		}
+
+		/// Bottom and top ghost rows of every sweep of a pass
+		std::size_t ghostsSize = K * depth * stride;
+		std::vector<T> bottomGhosts(ghostsSize);
+		std::vector<T> topGhosts(ghostsSize);
+		auto bottomGhost = [&](uint f, uint d) { return bottomGhosts.data() + (std::size_t(f) * depth + d) * stride; };
+		auto topGhost = [&](uint f, uint d) { return topGhosts.data() + (std::size_t(f) * depth + d) * stride; };
+
+		/// Rows ny - ahead ... ny + 1 of every field for the triangle
+		uint maxAhead = 2 * depth - 2;
+		std::vector<T> triangle(K * (maxAhead + 2) * stride);
+		T * triangleRows[K];
+		const T * triangleSource[K];
+
+		for (uint sweepsDone = 0; sweepsDone < sweeps; sweepsDone += depth)
+		{
+			uint passDepth = std::min(depth, sweeps - sweepsDone);
+			uint passStages = 2 * passDepth;
+			uint ahead = (B == PERIODIC) ? passStages - 2 : 0;
+
+			/// Row j of the triangle is row ny - ahead + j of the field
+			uint triangleColour = (ny - ahead) & 1;
+			for (uint f = 0; f < K; f++)
+			{
+				std::copy(x[f], x[f] + stride, bottomGhost(f, 0));
+				std::copy(x[f] + (std::size_t(ny) + 1) * stride, x[f] + (std::size_t(ny) + 2) * stride, topGhost(f, 0));
+
+				triangleRows[f] = triangle.data() + f * (maxAhead + 2) * stride;
+				triangleSource[f] = b[f] + (std::size_t(ny) - ahead) * stride;
+				if (ahead > 0) std::copy(x[f] + (std::size_t(ny) - ahead) * stride, x[f] + (std::size_t(ny) + 2) * stride, triangleRows[f]);
+			}
+
+			for (uint step = 1; step < ny + passStages; step++)
+			{
+				/// Stage step - 1 of the triangle, rows step ... ahead
+				if (step <= ahead)
+				{
+					uint stage = step - 1;
+					for (uint f = 0; f < K; f++)
+					{
+						std::copy(topGhost(f, stage / 2), topGhost(f, stage / 2) + stride, triangleRows[f] + (std::size_t(ahead) + 1) * stride);
+					}
+					for (uint j = step; j <= ahead; j++)
+					{
+						relaxRowRedBlack<K>(triangleRows, triangleSource, nx, a, invc, j, 1, nx + 1, (stage + triangleColour) & 1);
+					}
+
+					if (stage & 1)
+					{
+						for (uint f = 0; f < K; f++)
+						{
+							for (uint j = step; j <= ahead; j++)
+							{
+								T * row = triangleRows[f] + j * stride;
+								row[0] = row[nx];
+								row[nx + 1] = row[1];
+							}
+							T * last = triangleRows[f] + std::size_t(ahead) * stride;
+							std::copy(last, last + stride, bottomGhost(f, stage / 2 + 1));
+						}
+					}
+				}
+
+				for (uint stage = 0; stage < passStages; stage++)
+				{
+					if (step < stage + 1 || (step - stage) > ny) continue;
+					uint j = step - stage;
+					uint d = stage / 2;
+
+					for (uint f = 0; f < K; f++)
+					{
+						if (j == 1) std::copy(bottomGhost(f, d), bottomGhost(f, d) + stride, x[f]);
+						if (j == ny) std::copy(topGhost(f, d), topGhost(f, d) + stride, x[f] + (std::size_t(ny) + 1) * stride);
+					}
+
+					relaxRowRedBlack<K>(x, b, nx, a, invc, j, 1, nx + 1, stage & 1);
+					if (!(stage & 1)) continue;
+
+					/// Row j completed sweep d
+					for (uint f = 0; f < K; f++)
+					{
+						T * row = x[f] + j * stride;
+						if (B == PERIODIC)
+						{
+							row[0] = row[nx];
+							row[nx + 1] = row[1];
+						}
+						else
+						{
+							row[0] = -row[1];
+							row[nx + 1] = -row[nx];
+						}
+
+						if (d + 1 >= passDepth) continue;
+						if (B == PERIODIC)
+						{
+							if (j == 1) std::copy(row, row + stride, topGhost(f, d + 1));
+						}
+						else
+						{
+							if (j == 1)
+							{
+								T * bottom = bottomGhost(f, d + 1);
+								for (uint i = 1; i <= nx; i++) bottom[i] = -row[i];
+							}
+							if (j == ny)
+							{
+								T * top = topGhost(f, d + 1);
+								for (uint i = 1; i <= nx; i++) top[i] = -row[i];
+							}
+						}
+					}
+				}
+			}
+
+			for (uint f = 0; f < K; f++)
+			{
+				fillGhostCells<B>(x[f], nx, ny);
+			}
+		}
+	}
+
+	/// Sums of b - A x over cells iBegin ... iEnd - 1 of row j, the ghost
+	/// cells hold the boundary values
+	template <uint K, typename T>
+	inline void measureRowResidual(const T * const * x, const T * const * b, uint nx, Compute<T> a, Compute<T> c, uint j, uint iBegin, uint iEnd,
+		RelaxationResidual & residual)
+	{
+		std::size_t stride = std::size_t(nx) + 2;
+		typedef Compute<T> C;
+		for (uint f = 0; f < K; f++)
+		{
+			const T * row = x[f] + j * stride;
+			const T * rowSoth = row - stride;
+			const T * rowNrth = row + stride;
+			const T * rowOld = b[f] + j * stride;
+
+			double sumSquaresResidual = 0.0;
+			double sumSquaresSource = 0.0;
+			for (uint i = iBegin; i < iEnd; i++)
+			{
+				C source = C(rowOld[i]);
+				double cellResidual = double(source - (c * C(row[i]) - a * (C(row[i - 1]) + C(row[i + 1]) + C(rowSoth[i]) + C(rowNrth[i]))));
+				sumSquaresResidual += cellResidual * cellResidual;
+				sumSquaresSource += double(source) * double(source);
+			}
+			residual.sumSquaresResidual += sumSquaresResidual;
+			residual.sumSquaresSource += sumSquaresSource;
+		}
+		residual.numCells += std::size_t(K) * (iEnd - iBegin);
+	}
+
+	/// Residual of the interior cells, or of the cells of the spans
+	template <uint K, typename T>
+	inline RelaxationResidual measureResidual(const T * const * x, const T * const * b, uint nx, uint ny, Compute<T> a, Compute<T> c,
+		const SpanList * spans, ThreadPool & threadPool)
+	{
+		RelaxationResidual residual;
+		std::mutex mutex;
+		threadPool.parallelFor(1, ny + 1, [&](uint jBegin, uint jEnd)
+		{
+			RelaxationResidual partial;
+			for (uint j = jBegin; j < jEnd; j++)
+			{
+				if (!spans)
+				{
+					measureRowResidual<K>(x, b, nx, a, c, j, 1, nx + 1, partial);
+					continue;
+				}
+				for (const CellSpan * span = spans->spansBegin(j); span != spans->spansEnd(j); span++)
+				{
+					measureRowResidual<K>(x, b, nx, a, c, j, span->iBegin, span->iEnd, partial);
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			residual.add(partial);
+		});
+		return residual;
+	}
+
+	/// Runs the sweeps of a criterion in chunks, sweeps(count) relaxes count
+	/// sweeps and measure() returns the residual of the current values.
+	/// Without tolerance the sweeps are one chunk.
+	template <typename Sweeps, typename Measure>
+	inline SolverStatistics relaxUntil(const RelaxationCriterion & criterion, Sweeps sweeps, Measure measure)
+	{
+		SolverStatistics statistics;
+		bool converging = (criterion.tolerance > 0.0);
+		if (!criterion.measured && !converging)
+		{
+			if (criterion.maxSweeps > 0) sweeps(criterion.maxSweeps);
+			statistics.iterations = criterion.maxSweeps;
+			return statistics;
+		}
+
+		RelaxationResidual initial = measure();
+		statistics.initialResidual = statistics.residual = initial.rms();
+		statistics.referenceResidual = initial.rmsSource();
+		double target = criterion.tolerance * statistics.referenceResidual;
+		uint interval = std::max(criterion.checkInterval, uint(1));
+
+		while (statistics.iterations < criterion.maxSweeps)
+		{
+			uint remaining = criterion.maxSweeps - statistics.iterations;
+			uint count = converging ? std::min(interval, remaining) : remaining;
+			sweeps(count);
+			statistics.iterations += count;
+			statistics.residual = measure().rms();
+			if (converging && statistics.iterations >= criterion.minSweeps && statistics.residual <= target) break;
+		}
+		statistics.converged = !converging || (statistics.residual <= target);
+		return statistics;
+	}
+
+	/// Full relaxation of a batch with the ghost cells refreshed after every sweep
+	template <uint K, boundaryType B, typename T>
+	inline SolverStatistics relaxBatch(relaxationType relaxation, T * const * x, const T * const * b, uint nx, uint ny, Compute<T> a, Compute<T> c,
+		const RelaxationCriterion & criterion, ThreadPool & threadPool)
+	{
+		auto measure = [&]() { return measureResidual<K>(x, b, nx, ny, a, c, nullptr, threadPool); };
+		if (relaxation == TILED)
+		{
+			return relaxUntil(criterion, [&](uint sweeps)
+			{
+				relaxTiled<K, B>(x, b, nx, ny, a, c, sweeps, RELAXATION_TILE_DEPTH);
+			}, measure);
+		}
+
+		return relaxUntil(criterion, [&](uint sweeps)
+		{
+			for (uint s = 0; s < sweeps; s++)
+			{
+				if (relaxation == RED_BLACK)
+				{
+					relaxRedBlack<K>(x, b, nx, ny, a, c, 0, threadPool);
+					relaxRedBlack<K>(x, b, nx, ny, a, c, 1, threadPool);
+				}
+				else
+				{
+					relaxLexicographic<K>(x, b, nx, ny, a, c);
+				}
+
+				for (uint f = 0; f < K; f++)
+				{
+					fillGhostCells<B>(x[f], nx, ny);
+				}
+			}
+		}, measure);
+	}
+
+	/// Relaxation of the cells of a span list only, the fluid cells or the
+	/// active tiles. With solids, the solid cells next to the flow are
+	/// refreshed as boundaries of the given types after every sweep. The
+	/// wavefront of the tiled relaxation would have to refresh them row by
+	/// row, it falls back to the red-black sweeps it blocks.
+	template <uint K, boundaryType B, typename T>
+	inline SolverStatistics relaxBatchSpans(relaxationType relaxation, T * const * x, const T * const * b, uint nx, uint ny, Compute<T> a, Compute<T> c,
+		const RelaxationCriterion & criterion, const SpanList & spans, const SolidMask * solids, const solidBoundaryType * solidBoundary,
+		ThreadPool & threadPool)
+	{
+		typedef Compute<T> C;
+		C invc = C(1.0) / c;
+
+		auto measure = [&]() { return measureResidual<K>(x, b, nx, ny, a, c, &spans, threadPool); };
+		return relaxUntil(criterion, [&](uint sweeps)
+		{
+			for (uint s = 0; s < sweeps; s++)
+			{
+				if (relaxation != LEXICOGRAPHIC)
+				{
+					for (uint colour = 0; colour < 2; colour++)
+					{
+						threadPool.parallelFor(1, ny + 1, [&](uint jBegin, uint jEnd)
+						{
+							for (uint j = jBegin; j < jEnd; j++)
+							{
+								for (const CellSpan * span = spans.spansBegin(j); span != spans.spansEnd(j); span++)
+								{
+									relaxRowRedBlack<K>(x, b, nx, a, invc, j, span->iBegin, span->iEnd, colour);
+								}
+							}
+						});
+					}
+				}
+				else
+				{
+					for (uint j = 1; j <= ny; j++)
+					{
+						for (const CellSpan * span = spans.spansBegin(j); span != spans.spansEnd(j); span++)
+						{
+							relaxRowLexicographic<K>(x, b, nx, a, c, j, span->iBegin, span->iEnd);
+						}
+					}
+				}
+
+				for (uint f = 0; f < K; f++)
+				{
+					if (solids) solids->fillSolidCells(x[f], solidBoundary[f]);
+					fillGhostCells<B>(x[f], nx, ny);
+				}
+			}
+		}, measure);
+	}
+
+	/// Relaxes any number of fields sharing the operator, in batches of up
+	/// to RELAXATION_MAX_BATCH fields. With spans only their cells are
+	/// relaxed, with a mask holding solids solidBoundary gives the wall type
+	/// of every field. Every batch stops on its own, the statistics are the
+	/// ones of the least converged.
+	template <boundaryType B, typename T>
+	inline SolverStatistics relax(relaxationType relaxation, T * const * x, const T * const * b, uint numFields, uint nx, uint ny, Compute<T> a, Compute<T> c,
+		const RelaxationCriterion & criterion, ThreadPool & threadPool, const SpanList * spans = nullptr, const SolidMask * solids = nullptr,
+		const solidBoundaryType * solidBoundary = nullptr)
+	{
+		SolverStatistics statistics;
+		if (solids && !solids->hasSolids()) solids = nullptr;
+		for (uint first = 0; first < numFields; first += RELAXATION_MAX_BATCH)
+		{
+			T * const * xBatch = x + first;
+			const T * const * bBatch = b + first;
+			uint batch = std::min(numFields - first, uint(RELAXATION_MAX_BATCH));
+			if (spans)
+			{
+				const solidBoundaryType * types = solids ? solidBoundary + first : nullptr;
+				switch (batch)
+				{
+				case 1: statistics.merge(relaxBatchSpans<1, B>(relaxation, xBatch, bBatch, nx, ny, a, c, criterion, *spans, solids, types, threadPool)); break;
+				case 2: statistics.merge(relaxBatchSpans<2, B>(relaxation, xBatch, bBatch, nx, ny, a, c, criterion, *spans, solids, types, threadPool)); break;
+				case 3: statistics.merge(relaxBatchSpans<3, B>(relaxation, xBatch, bBatch, nx, ny, a, c, criterion, *spans, solids, types, threadPool)); break;
+				default: statistics.merge(relaxBatchSpans<4, B>(relaxation, xBatch, bBatch, nx, ny, a, c, criterion, *spans, solids, types, threadPool)); break;
+				}
+				continue;
+			}
+
+			switch (batch)
+			{
+			case 1: statistics.merge(relaxBatch<1, B>(relaxation, xBatch, bBatch, nx, ny, a, c, criterion, threadPool)); break;
+			case 2: statistics.merge(relaxBatch<2, B>(relaxation, xBatch, bBatch, nx, ny, a, c, criterion, threadPool)); break;
+			case 3: statistics.merge(relaxBatch<3, B>(relaxation, xBatch, bBatch, nx, ny, a, c, criterion, threadPool)); break;
+			default: statistics.merge(relaxBatch<4, B>(relaxation, xBatch, bBatch, nx, ny, a, c, criterion, threadPool)); break;
+			}
+		}
+		return statistics;
+	}
+
+	/// A fixed number of sweeps
+	template <boundaryType B, typename T>
+	inline void relax(relaxationType relaxation, T * const * x, const T * const * b, uint numFields, uint nx, uint ny, Compute<T> a, Compute<T> c,
+		uint sweeps, ThreadPool & threadPool)
+	{
+		relax<B>(relaxation, x, b, numFields, nx, ny, a, c, RelaxationCriterion(sweeps, false), threadPool);
+	}
+
+	template <typename T>
+	inline void relax(relaxationType relaxation, T * const * x, const T * const * b, uint numFields, uint nx, uint ny, Compute<T> a, Compute<T> c,
+		uint sweeps, boundaryType boundary, ThreadPool & threadPool)
+	{
+		(boundary == PERIODIC) ? relax<PERIODIC>(relaxation, x, b, numFields, nx, ny, a, c, sweeps, threadPool) :
+			relax<DIRICHLET>(relaxation, x, b, numFields, nx, ny, a, c, sweeps, threadPool);
+	}
+
+	template <typename T>
+	inline void relax(relaxationType relaxation, T * x, const T * b, uint nx, uint ny, Compute<T> a, Compute<T> c,
+		uint sweeps, boundaryType boundary, ThreadPool & threadPool)
+	{
+		relax(relaxation, &x, &b, 1, nx, ny, a, c, sweeps, boundary, threadPool);
+	}
+}
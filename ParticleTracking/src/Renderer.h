@@ -1,8 +1,7 @@
 #pragma once
-#include "ParticleSystem.h"
+#include "SimulationThread.h"
 #include "ColorGradient.h"
 #include "Shaders.h"
-#include "Fluid.h"
 #include "GUI.h"
 
 #define POINT_WIDTH_PIXELS real(10.0)
@@ -35,7 +34,7 @@ namespace FluidSimulation
 			m_width = width;
 		}
 
-		void render(Fluid & fluid, const GUI & gui)
+		void render(const FluidSnapshot & fluid, const GUI & gui)
 		{
 			if (gui.getButtonState("VelocityField"))
 			{
@@ -62,9 +61,9 @@ namespace FluidSimulation
 			}
 		}
 
-		void render(const ParticleSystem & particles, Fluid & fluid)
+		void render(const ParticleSnapshot & particles)
 		{
-			renderParticles(particles, fluid);
+			renderParticles(particles);
 		}
 
 		void render(const GUI & gui)
@@ -162,7 +161,7 @@ namespace FluidSimulation
 		}
 
 	protected:
-		void renderVelocity(Fluid & fluid)
+		void renderVelocity(const FluidSnapshot & fluid)
 		{
 			using namespace glm;
 			glUseProgram(0);
@@ -204,7 +203,7 @@ namespace FluidSimulation
 			glLineWidth(1.0f);
 		}
 
-		void renderDensity(Fluid & fluid, ColorGradient & colormap)
+		void renderDensity(const FluidSnapshot & fluid, ColorGradient & colormap)
 		{
 			using namespace glm;
 			glUseProgram(0);
@@ -245,14 +244,12 @@ namespace FluidSimulation
 					colormap.getColorAtValue(d01, c3.r, c3.g, c3.b);
 					c3.w = real(0.5);
 
-					if (fluid.isObstacleEnabled() && fluid.isAnimated())
+					if (fluid.hasSolids())
 					{
-						real epsilon = std::numeric_limits<real>::epsilon();
-
-						if (std::abs(d00) < epsilon ||
-							std::abs(d01) < epsilon ||
-							std::abs(d10) < epsilon ||
-							std::abs(d11) < epsilon)
+						if (fluid.isSolid(i + 0, j + 0) ||
+							fluid.isSolid(i + 0, j + 1) ||
+							fluid.isSolid(i + 1, j + 0) ||
+							fluid.isSolid(i + 1, j + 1))
 						{
 							c0.xyz() = vec3(0.0);
 							c1.xyz() = vec3(0.0);
@@ -279,7 +276,7 @@ namespace FluidSimulation
 			glDisable(GL_BLEND);
 		}
 
-		void renderCenterCells(Fluid & fluid)
+		void renderCenterCells(const FluidSnapshot & fluid)
 		{
 			using namespace glm;
 			glUseProgram(0);
@@ -303,7 +300,7 @@ namespace FluidSimulation
 			glPointSize(1.0f);
 		}
 
-		void renderDomain(Fluid & fluid)
+		void renderDomain(const FluidSnapshot & fluid)
 		{
 			using namespace glm;
 			glUseProgram(0);
@@ -335,7 +332,7 @@ namespace FluidSimulation
 			glLineWidth(1.0f);
 		}
 
-		void renderGhostCells(Fluid & fluid)
+		void renderGhostCells(const FluidSnapshot & fluid)
 		{
 			using namespace glm;
 			glUseProgram(0);
@@ -414,7 +411,7 @@ namespace FluidSimulation
 			glEnd();
 		}
 
-		void renderParticles(const ParticleSystem & particles, Fluid & fluid)
+		void renderParticles(const ParticleSnapshot & particles)
 		{
 			using namespace glm;
 			glUseProgram(0);
@@ -423,9 +420,9 @@ namespace FluidSimulation
 			glBegin(GL_QUADS);
 
 			uint numParticlesTrailing = particles.getNumberTrailingParticles();
-			for (auto & particle : particles.getParticles())
+			for (uint particle = 0; particle < particles.getNumberParticles(); particle++)
 			{
-				auto particleTrailing = particle.getTrailing();
+				const vec2 * particleTrailing = particles.getTrailing(particle);
 				real pixelSizeParticle = real(0.01);
 
 				for (uint n = 0; n < numParticlesTrailing; n++)
@@ -434,7 +431,7 @@ namespace FluidSimulation
 
 					real unitColor = real(1.0) - (n / real(numParticlesTrailing - 1));
 					real alphaBlending = real(0.9) - (real(0.85) * (n / real(numParticlesTrailing - 1)));
-					real weight = particle.getWeight();
+					real weight = particles.getWeight(particle);
 
 					vec4 particleColor;
 					if (weight < real(0.25))
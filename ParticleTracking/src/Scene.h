@@ -16,48 +16,53 @@ namespace FluidSimulation
 		~Scene()
 		{
 			delete m_gui;
-			delete m_fluid;
+			delete m_simulation;
 			delete m_renderer;
-			delete m_particles;
 		}
 
 		void init()
 		{
-			m_fluid->init();
+			m_simulation->start();
+			m_snapshot = &m_simulation->acquireSnapshot();
 			m_gui->init();
 		}
 
+		/// The fluid and the particles advance on the simulation thread, a
+		/// frame only picks up the latest state they published
 		void update(real dt)
 		{
 			m_dt = dt;
 
 			bool enabledObstacle = m_gui->getButtonState("Obstacle");
-			m_fluid->setObstacle(enabledObstacle);
-
-			if (m_fluid->isAnimated())
+			if (enabledObstacle != m_enabledObstacle)
 			{
-				m_fluid->update();
+				m_enabledObstacle = enabledObstacle;
+				m_simulation->post([=](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.setObstacle(enabledObstacle); });
 			}
 
-			if (m_particles->isAnimated())
-			{
-				m_particles->update(m_fluid);
-			}
+			m_snapshot = &m_simulation->acquireSnapshot();
+			const FluidSnapshot & fluid = m_snapshot->fluid;
 
-			m_renderer->setDensityColorMap(m_fluid->getMaxDensity(), m_fluid->getMinDensity());
-			m_renderer->setSpeedColorMap(m_fluid->getMaxSpeed(), m_fluid->getMinSpeed());
+			m_renderer->setDensityColorMap(fluid.getMaxDensity(), fluid.getMinDensity());
+			m_renderer->setSpeedColorMap(fluid.getMaxSpeed(), fluid.getMinSpeed());
+		}
+
+		/// Joins the simulation thread, the scene only draws afterwards
+		void stopSimulation()
+		{
+			m_simulation->stop();
 		}
 
 		void displaySimulation()
 		{
-			m_renderer->render(*m_particles, *m_fluid);
+			m_renderer->render(m_snapshot->particles);
 
 			if (m_gui->getButtonState("Wireframe"))
 			{
 				glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 			}
 
-			m_renderer->render(*m_fluid, *m_gui);
+			m_renderer->render(m_snapshot->fluid, *m_gui);
 
 			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 		}
@@ -66,23 +71,26 @@ namespace FluidSimulation
 		{
 			m_renderer->render(*m_gui);
 
+			const FluidSnapshot & fluid = m_snapshot->fluid;
+			const ParticleSnapshot & particles = m_snapshot->particles;
 			char dynamicText[256];
 
 			if (m_gui->isEnabled())
 			{
 				m_gui->displayText("F9HideGUI", m_width - (25 * 9), m_height - 25);
 
-				std::string textParticlesAnimation = !m_particles->isAnimated() ? "2:AnimateParticles" : "2:PauseParticles";
+				std::string textParticlesAnimation = !particles.isAnimated() ? "2:AnimateParticles" : "2:PauseParticles";
 				m_gui->displayText(textParticlesAnimation.c_str(), m_width - (25 * 17), m_height - 50);
 
 				m_gui->displayText("c:ClearParticles", m_width - (25 * 16), m_height - 75);
 
-				std::string textFluidAnimation = !m_fluid->isAnimated() ? "1:AnimateFluid" : "1:PauseFluid";
+				std::string textFluidAnimation = !fluid.isAnimated() ? "1:AnimateFluid" : "1:PauseFluid";
 				m_gui->displayText(textFluidAnimation.c_str(), m_width - (25 * 14), m_height - 100);
 				
 				m_gui->displayText("p:IncreaseGrid", m_width - (25 * 14), m_height - 125);
 				m_gui->displayText("m:DecreaseGrid", m_width - (25 * 14), m_height - 150);
 				m_gui->displayText("r:ResetFluid", m_width - (25 * 13), m_height - 175);
+				m_gui->displayText("a:AdaptiveDt", m_width - (25 * 13), m_height - 200);
 			}
 			else
 			{
@@ -93,13 +101,13 @@ namespace FluidSimulation
 			{
 				m_gui->displayText("F10HideParameters", 0, m_height - 25);
 
-				sprintf(dynamicText, "NumParticles%d", m_particles->getNumberParticles());
+				sprintf(dynamicText, "NumParticles%d", particles.getNumberParticles());
 				m_gui->displayText(dynamicText, 0, m_height - 50);
 
-				sprintf(dynamicText, "NumCells%d", m_fluid->getNumCells());
+				sprintf(dynamicText, "NumCells%d", fluid.getNumCells());
 				m_gui->displayText(dynamicText, 0, m_height - 75);
 
-				if (m_fluid->getBoundaryType() == PERIODIC)
+				if (fluid.getBoundaryType() == PERIODIC)
 				{
 					m_gui->displayText("Periodic", 0, m_height - 100);
 				}
@@ -108,17 +116,27 @@ namespace FluidSimulation
 					m_gui->displayText("Dirichlet", 0, m_height - 100);
 				}
 
-				sprintf(dynamicText, "Particle dt:%.3f", m_particles->getTimeIntegrationStep());
+				sprintf(dynamicText, "Particle dt:%.3f", particles.getTimeIntegrationStep());
 				m_gui->displayText(dynamicText, 0, m_height - 125);
 
-				sprintf(dynamicText, "Fluid dt:%.3f", m_fluid->getTimeIntegrationStep());
+				if (fluid.getTimeStepping() == TIME_STEPPING_ADAPTIVE)
+				{
+					sprintf(dynamicText, "Fluid dt:%.3f/%d", fluid.getTimeIntegrationStep(), fluid.getNumSubsteps());
+				}
+				else
+				{
+					sprintf(dynamicText, "Fluid dt:%.3f", fluid.getTimeIntegrationStep());
+				}
 				m_gui->displayText(dynamicText, 0, m_height - 150);
 
-				sprintf(dynamicText, "Diffusion:%.3f", m_fluid->getDiffusion());
+				sprintf(dynamicText, "Diffusion:%.3f", fluid.getDiffusion());
 				m_gui->displayText(dynamicText, 0, m_height - 175);
 
-				sprintf(dynamicText, "Viscosity:%.3f", m_fluid->getViscosity());
+				sprintf(dynamicText, "Viscosity:%.3f", fluid.getViscosity());
 				m_gui->displayText(dynamicText, 0, m_height - 200);
+
+				sprintf(dynamicText, "Steps/sec:%.0f", m_snapshot->stepsPerSecond);
+				m_gui->displayText(dynamicText, 0, m_height - 225);
 			}
 			else
 			{
@@ -128,16 +146,16 @@ namespace FluidSimulation
 			sprintf(dynamicText, "%.5fsec", m_dt);
 			m_gui->displayText(dynamicText, m_width - (25 * 10), 0);
 
-			sprintf(dynamicText, "Maxspeed%.5fsec", m_fluid->getMaxSpeed());
+			sprintf(dynamicText, "Maxspeed%.5fsec", fluid.getMaxSpeed());
 			m_gui->displayText(dynamicText, m_width - (25 * 15), 25);
 
-			sprintf(dynamicText, "Minspeed%.5fsec", m_fluid->getMinSpeed());
+			sprintf(dynamicText, "Minspeed%.5fsec", fluid.getMinSpeed());
 			m_gui->displayText(dynamicText, m_width - (25 * 15), 50);
 
-			sprintf(dynamicText, "Maxdensity%.5fsec", m_fluid->getMaxDensity());
+			sprintf(dynamicText, "Maxdensity%.5fsec", fluid.getMaxDensity());
 			m_gui->displayText(dynamicText, m_width - (25 * 17), 75);
 
-			sprintf(dynamicText, "Mindensity%.5fsec", m_fluid->getMinDensity());
+			sprintf(dynamicText, "Mindensity%.5fsec", fluid.getMinDensity());
 			m_gui->displayText(dynamicText, m_width - (25 * 17), 100);
 		}
 
@@ -153,83 +171,91 @@ namespace FluidSimulation
 
 		void toggleFluidBoundaryCondition()
 		{
-			m_particles->switchBoundaryCondition();
-			m_fluid->switchBoundaryCondition();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> & particles)
+			{
+				particles.switchBoundaryCondition();
+				fluid.switchBoundaryCondition();
+			});
 		}
 
 		real getFluidGridSpacing()
 		{
-			return (real(1.0) / real(m_fluid->getNumCells()));
+			return (real(1.0) / real(m_snapshot->fluid.getNumCells()));
 		}
 
 		void increaseFluidGrid()
 		{
-			m_fluid->increaseGridSize();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.increaseGridSize(); });
 		}
 
 		void decreaseFluidGrid()
 		{
-			m_fluid->decreaseGridSize();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.decreaseGridSize(); });
 		}
 
 		void increaseFluidViscosity()
 		{
-			m_fluid->increaseViscosity();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.increaseViscosity(); });
 		}
 
 		void decreaseFluidViscosity()
 		{
-			m_fluid->decreaseViscosity();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.decreaseViscosity(); });
 		}
 
 		void increaseFluidDiffusion()
 		{
-			m_fluid->increaseDiffusion();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.increaseDiffusion(); });
 		}
 
 		void decreaseFluidDifussion()
 		{
-			m_fluid->decreaseDiffusion();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.decreaseDiffusion(); });
 		}
 
 		void increaseFluidTimeStep()
 		{
-			m_fluid->increaseTimeStep();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.increaseTimeStep(); });
 		}
 
 		void decreaseFluidTimeStep()
 		{
-			m_fluid->decreaseTimeStep();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.decreaseTimeStep(); });
+		}
+
+		void toggleFluidTimeStepping()
+		{
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.switchTimeStepping(); });
 		}
 
 		void increaseParticleSystemTimeStep()
 		{
-			m_particles->increaseTimeStep();
+			m_simulation->post([](Fluid<real> &, ParticleSystem<real> & particles) { particles.increaseTimeStep(); });
 		}
 
 		void decreaseParticleSystemTimeStep()
 		{
-			m_particles->decreaseTimeStep();
+			m_simulation->post([](Fluid<real> &, ParticleSystem<real> & particles) { particles.decreaseTimeStep(); });
 		}
 
 		void resetFluid()
 		{
-			m_fluid->init();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.init(); });
 		}
 
 		void clearParticleSystem()
 		{
-			m_particles->clear();
+			m_simulation->post([](Fluid<real> &, ParticleSystem<real> & particles) { particles.clear(); });
 		}
 
 		void toggleParticlesAnimation()
 		{
-			m_particles->toggleAnimation();
+			m_simulation->post([](Fluid<real> &, ParticleSystem<real> & particles) { particles.toggleAnimation(); });
 		}
 
 		void toggleFluidAnimation()
 		{
-			m_fluid->toggleAnimation();
+			m_simulation->post([](Fluid<real> & fluid, ParticleSystem<real> &) { fluid.toggleAnimation(); });
 		}
 
 		void resize(int width, int height)
@@ -250,14 +276,21 @@ namespace FluidSimulation
 			{
 				if (x < 0 || x > m_width || y < 0 || y > m_height) return;
 
-				int N = m_fluid->getNumCells();
-				int i = (int)((m_cursorposxold / (float)m_width) * N + 1);
-				int j = (int)((m_cursorposyold / (float)m_height) * N + 1);
+				/// The cell is found on the simulation thread, the grid may
+				/// change before the drag gets there
+				real oldX = m_cursorposxold / (float)m_width;
+				real oldY = m_cursorposyold / (float)m_height;
 
 				real fx = real(m_cursorposxnew - m_cursorposxold);
 				real fy = real(m_cursorposynew - m_cursorposyold);
 
-				m_fluid->addDrag(i, j, vec2(fx, fy));
+				m_simulation->post([=](Fluid<real> & fluid, ParticleSystem<real> &)
+				{
+					int N = fluid.getNumCells();
+					int i = (int)(oldX * N + 1);
+					int j = (int)(oldY * N + 1);
+					fluid.addDrag(i, j, vec2(fx, fy));
+				});
 			}
 
 			m_cursorposxold = m_cursorposxnew;
@@ -278,9 +311,9 @@ namespace FluidSimulation
 				{
 					vec2 pos((m_cursorposxold / real(m_width)), (m_cursorposyold / real(m_height)));
 
-					Particle particle;
+					Particle<real> particle;
 					particle.setPosition(pos);
-					m_particles->addParticle(particle);
+					m_simulation->post([=](Fluid<real> &, ParticleSystem<real> & particles) { particles.addParticle(particle); });
 				}
 				break;
 
@@ -326,10 +359,11 @@ namespace FluidSimulation
 		}
 
 	private:
-		ParticleSystem * m_particles = new ParticleSystem;
+		SimulationThread * m_simulation = new SimulationThread;
+		const SimulationSnapshot * m_snapshot = nullptr;
 		Renderer * m_renderer = new Renderer;
-		Fluid * m_fluid = new Fluid;
 		GUI * m_gui = new GUI;
+		bool m_enabledObstacle = false;
 
 		bool m_video = false;
         real m_dt;
@@ -0,0 +1,382 @@
+#pragma once
+#include "ParticleSystem.h"
+#include "SnapshotBuffer.h"
+#include "Fluid.h"
+#include <condition_variable>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <vector>
+
+#define SIMULATION_RATE_INTERVAL 0.5
+
+namespace FluidSimulation
+{
+	/// Copy of the fluid state for the front end, with the accessors of Fluid
+	class FluidSnapshot
+	{
+	public:
+		void capture(Fluid<real> & fluid)
+		{
+			m_numberCellsX = fluid.getNumCellsX();
+			m_numberCellsY = fluid.getNumCellsY();
+
+			std::size_t size = fluid.getFieldSize();
+			m_u.resize(size);
+			m_v.resize(size);
+			m_d.resize(size);
+			fluid.copyFields(m_u.data(), m_v.data(), m_d.data());
+
+			const SolidMask & solids = fluid.getSolidMask();
+			if (solids.hasSolids()) m_solids = solids.getCells();
+			else m_solids.clear();
+
+			m_maxDensity = fluid.getMaxDensity();
+			m_minDensity = fluid.getMinDensity();
+			m_maxSpeed = fluid.getMaxSpeed();
+			m_minSpeed = fluid.getMinSpeed();
+
+			m_boundary = fluid.getBoundaryType();
+			m_timeStepping = fluid.getTimeStepping();
+			m_timeStep = fluid.getTimeIntegrationStep();
+			m_numSubsteps = fluid.getNumSubsteps();
+			m_diffusion = fluid.getDiffusion();
+			m_viscosity = fluid.getViscosity();
+			m_enabledObstacle = fluid.isObstacleEnabled();
+			m_animated = fluid.isAnimated();
+		}
+
+		real getVelocityU(uint i, uint j) const
+		{
+			return m_u[rowLinearIndexMap(i, j)];
+		}
+
+		real getVelocityV(uint i, uint j) const
+		{
+			return m_v[rowLinearIndexMap(i, j)];
+		}
+
+		real getDensity(uint i, uint j) const
+		{
+			return m_d[rowLinearIndexMap(i, j)];
+		}
+
+		bool hasSolids() const
+		{
+			return !m_solids.empty();
+		}
+
+		bool isSolid(uint i, uint j) const
+		{
+			return !m_solids.empty() && m_solids[rowLinearIndexMap(i, j)];
+		}
+
+		uint getNumCells() const
+		{
+			return m_numberCellsX;
+		}
+
+		uint getNumCellsY() const
+		{
+			return m_numberCellsY;
+		}
+
+		real getMaxDensity() const
+		{
+			return m_maxDensity;
+		}
+
+		real getMinDensity() const
+		{
+			return m_minDensity;
+		}
+
+		real getMaxSpeed() const
+		{
+			return m_maxSpeed;
+		}
+
+		real getMinSpeed() const
+		{
+			return m_minSpeed;
+		}
+
+		boundaryType getBoundaryType() const
+		{
+			return m_boundary;
+		}
+
+		timeSteppingType getTimeStepping() const
+		{
+			return m_timeStepping;
+		}
+
+		real getTimeIntegrationStep() const
+		{
+			return m_timeStep;
+		}
+
+		uint getNumSubsteps() const
+		{
+			return m_numSubsteps;
+		}
+
+		real getDiffusion() const
+		{
+			return m_diffusion;
+		}
+
+		real getViscosity() const
+		{
+			return m_viscosity;
+		}
+
+		bool isObstacleEnabled() const
+		{
+			return m_enabledObstacle;
+		}
+
+		bool isAnimated() const
+		{
+			return m_animated;
+		}
+
+	protected:
+		std::size_t rowLinearIndexMap(uint i, uint j) const
+		{
+			return (i + (j * (std::size_t(m_numberCellsX) + 2)));
+		}
+
+	private:
+		uint m_numberCellsX = 0;
+		uint m_numberCellsY = 0;
+		std::vector<real> m_u;
+		std::vector<real> m_v;
+		std::vector<real> m_d;
+
+		/// Empty without solids
+		std::vector<uchar> m_solids;
+
+		real m_maxDensity = real(0.0);
+		real m_minDensity = real(0.0);
+		real m_maxSpeed = real(0.0);
+		real m_minSpeed = real(0.0);
+
+		boundaryType m_boundary = PERIODIC;
+		timeSteppingType m_timeStepping = TIME_STEPPING_FIXED;
+		real m_timeStep = real(0.0);
+		uint m_numSubsteps = 0;
+		real m_diffusion = real(0.0);
+		real m_viscosity = real(0.0);
+		bool m_enabledObstacle = false;
+		bool m_animated = false;
+	};
+
+	/// Trailing positions and weights of every particle, the trails are
+	/// stored one after the other
+	class ParticleSnapshot
+	{
+	public:
+		void capture(ParticleSystem<real> & particles)
+		{
+			const std::vector<Particle<real>> & particleList = particles.getParticles();
+			m_numTrailing = particles.getNumberTrailingParticles();
+			m_trailing.resize(particleList.size() * m_numTrailing);
+			m_weights.resize(particleList.size());
+
+			for (std::size_t n = 0; n < particleList.size(); n++)
+			{
+				const std::vector<vec2> & trailing = particleList[n].getTrailing();
+				std::copy(trailing.begin(), trailing.begin() + m_numTrailing, m_trailing.begin() + n * m_numTrailing);
+				m_weights[n] = particleList[n].getWeight();
+			}
+
+			m_timeStep = particles.getTimeIntegrationStep();
+			m_animated = particles.isAnimated();
+		}
+
+		uint getNumberParticles() const
+		{
+			return (uint)m_weights.size();
+		}
+
+		uint getNumberTrailingParticles() const
+		{
+			return m_numTrailing;
+		}
+
+		/// Trail of a particle, getNumberTrailingParticles positions from the
+		/// newest to the oldest
+		const vec2 * getTrailing(uint particle) const
+		{
+			return m_trailing.data() + std::size_t(particle) * m_numTrailing;
+		}
+
+		real getWeight(uint particle) const
+		{
+			return m_weights[particle];
+		}
+
+		real getTimeIntegrationStep() const
+		{
+			return m_timeStep;
+		}
+
+		bool isAnimated() const
+		{
+			return m_animated;
+		}
+
+	private:
+		uint m_numTrailing = 0;
+		std::vector<vec2> m_trailing;
+		std::vector<real> m_weights;
+		real m_timeStep = real(0.0);
+		bool m_animated = false;
+	};
+
+	struct SimulationSnapshot
+	{
+		FluidSnapshot fluid;
+		ParticleSnapshot particles;
+
+		/// Fluid updates per second of wall time
+		double stepsPerSecond = 0.0;
+	};
+
+	/// Owns the fluid and the particles and steps them on a thread of its
+	/// own, as fast as the solver goes, independently of the frame rate.
+	/// Every update is published as a snapshot the renderer reads without
+	/// locking. Changes from the front end are posted as commands and run
+	/// on the simulation thread between two updates. While nothing is
+	/// animated the thread sleeps until the next command.
+	class SimulationThread
+	{
+	public:
+		typedef std::function<void(Fluid<real> &, ParticleSystem<real> &)> command;
+
+		~SimulationThread()
+		{
+			stop();
+		}
+
+		/// Initializes the fluid and publishes its state before starting the
+		/// thread, so there is always a snapshot to draw
+		void start()
+		{
+			if (m_thread.joinable()) return;
+
+			m_fluid.init();
+			publishSnapshot(0.0);
+
+			m_stop = false;
+			m_thread = std::thread(&SimulationThread::loop, this);
+		}
+
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_wake.notify_one();
+
+			if (m_thread.joinable()) m_thread.join();
+		}
+
+		/// Commands run in the order they were posted
+		void post(command function)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_commands.push_back(std::move(function));
+			}
+			m_wake.notify_one();
+		}
+
+		/// Latest published state, valid until the next call. Only one thread
+		/// may read the snapshots.
+		const SimulationSnapshot & acquireSnapshot()
+		{
+			m_snapshots.acquire();
+			return m_snapshots.front();
+		}
+
+	protected:
+		void loop()
+		{
+			typedef std::chrono::steady_clock clock;
+
+			std::vector<command> commands;
+			clock::time_point rateStart = clock::now();
+			uint rateSteps = 0;
+			double stepsPerSecond = 0.0;
+
+			for (;;)
+			{
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait(lock, [&]() { return m_stop || !m_commands.empty() || m_fluid.isAnimated() || m_particles.isAnimated(); });
+					if (m_stop) return;
+					commands.swap(m_commands);
+				}
+
+				for (auto & function : commands)
+				{
+					function(m_fluid, m_particles);
+				}
+				commands.clear();
+
+				if (m_fluid.isAnimated())
+				{
+					m_fluid.update();
+					rateSteps++;
+				}
+
+				if (m_particles.isAnimated())
+				{
+					m_particles.update(&m_fluid);
+				}
+
+				/// The rate restarts after a pause
+				double elapsed = std::chrono::duration<double>(clock::now() - rateStart).count();
+				if (!m_fluid.isAnimated())
+				{
+					stepsPerSecond = 0.0;
+					rateSteps = 0;
+					rateStart = clock::now();
+				}
+				else if (elapsed >= SIMULATION_RATE_INTERVAL)
+				{
+					stepsPerSecond = rateSteps / elapsed;
+					rateSteps = 0;
+					rateStart = clock::now();
+				}
+
+				publishSnapshot(stepsPerSecond);
+			}
+		}
+
+		void publishSnapshot(double stepsPerSecond)
+		{
+			SimulationSnapshot & snapshot = m_snapshots.back();
+			snapshot.fluid.capture(m_fluid);
+			snapshot.particles.capture(m_particles);
+			snapshot.stepsPerSecond = stepsPerSecond;
+			m_snapshots.publish();
+		}
+
+	private:
+		Fluid<real> m_fluid;
+		ParticleSystem<real> m_particles;
+		SnapshotBuffer<SimulationSnapshot> m_snapshots;
+
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::vector<command> m_commands;
+		bool m_stop = false;
+	};
+}
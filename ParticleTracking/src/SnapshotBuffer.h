@@ -0,0 +1,56 @@
+#pragma once
+#include "Definitions.h"
+#include <atomic>
+
+#define SNAPSHOT_SLOT_MASK 3u
+#define SNAPSHOT_FRESH 4u
+
+namespace FluidSimulation
+{
+	/// Triple buffer between one writer and one reader thread. The writer
+	/// fills the back slot and publishes it, the reader takes the latest
+	/// published slot. Neither side waits for the other and no slot is ever
+	/// used by both: the writer never overwrites the slot being read, the
+	/// reader skips the snapshots it was too slow to see. The slots keep
+	/// their memory, a snapshot of the same size does not allocate.
+	template <typename S>
+	class SnapshotBuffer
+	{
+	public:
+		/// Writer side, the slot to fill next
+		S & back()
+		{
+			return m_slots[m_back];
+		}
+
+		/// Writer side, hands the back slot over and takes the one the
+		/// reader has not picked up, or the one it gave back
+		void publish()
+		{
+			uint previous = m_middle.exchange(m_back | SNAPSHOT_FRESH, std::memory_order_acq_rel);
+			m_back = previous & SNAPSHOT_SLOT_MASK;
+		}
+
+		/// Reader side, true when a newer snapshot became the front one
+		bool acquire()
+		{
+			if (!(m_middle.load(std::memory_order_relaxed) & SNAPSHOT_FRESH)) return false;
+
+			uint previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+			m_front = previous & SNAPSHOT_SLOT_MASK;
+			return true;
+		}
+
+		/// Reader side, stays valid until the next acquire
+		const S & front() const
+		{
+			return m_slots[m_front];
+		}
+
+	private:
+		S m_slots[3];
+		uint m_back = 0;
+		std::atomic<uint> m_middle{ 1 };
+		uint m_front = 2;
+	};
+}
@@ -0,0 +1,397 @@
+#pragma once
+#include "Definitions.h"
+#include "Precision.h"
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace FluidSimulation
+{
+	/// Values the solid cells next to the flow take so the stencils of the
+	/// fluid cells see a wall on the shared faces
+	enum solidBoundaryType
+	{
+		SOLID_NO_SLIP = 0,
+		SOLID_ZERO_FLUX
+	};
+
+	/// Cells iBegin ... iEnd - 1 of a row
+	struct CellSpan
+	{
+		uint iBegin;
+		uint iEnd;
+	};
+
+	/// Spans of cells to visit in the rows 1 ... ny of a grid, the spans of
+	/// a row are sorted and disjoint
+	class SpanList
+	{
+	public:
+		/// Rows are added in order, each one after a call to beginRow
+		void clear(uint ny)
+		{
+			m_spans.clear();
+			m_rowSpans.assign(std::size_t(ny) + 2, 0);
+			m_numCells = 0;
+		}
+
+		void beginRow(uint j)
+		{
+			m_rowSpans[j] = m_spans.size();
+			m_rowSpans[j + 1] = m_spans.size();
+		}
+
+		void add(uint j, CellSpan span)
+		{
+			if (span.iEnd <= span.iBegin) return;
+			m_spans.push_back(span);
+			m_rowSpans[j + 1] = m_spans.size();
+			m_numCells += span.iEnd - span.iBegin;
+		}
+
+		const CellSpan * spansBegin(uint j) const
+		{
+			return m_spans.data() + m_rowSpans[j];
+		}
+
+		const CellSpan * spansEnd(uint j) const
+		{
+			return m_spans.data() + m_rowSpans[j + 1];
+		}
+
+		std::size_t getNumCells() const
+		{
+			return m_numCells;
+		}
+
+	private:
+		std::vector<CellSpan> m_spans;
+
+		/// Row j starts at m_rowSpans[j]
+		std::vector<std::size_t> m_rowSpans;
+		std::size_t m_numCells = 0;
+	};
+
+	/// Obstacles in the coordinates of the fluid, the shorter side of the
+	/// domain has unit length. Boxes and circles are kept as shapes and an
+	/// image is stretched over the whole domain, so the geometry can be
+	/// rasterized again at any resolution.
+	class SolidGeometry
+	{
+	public:
+		void clear()
+		{
+			m_boxes.clear();
+			m_circles.clear();
+			m_imageWidth = m_imageHeight = 0;
+			m_imagePixels.clear();
+		}
+
+		bool empty() const
+		{
+			return m_boxes.empty() && m_circles.empty() && m_imagePixels.empty();
+		}
+
+		void addBox(double xMin, double yMin, double xMax, double yMax)
+		{
+			m_boxes.push_back({ std::min(xMin, xMax), std::min(yMin, yMax), std::max(xMin, xMax), std::max(yMin, yMax) });
+		}
+
+		void addCircle(double x, double y, double radius)
+		{
+			m_circles.push_back({ x, y, radius });
+		}
+
+		/// Netpbm bitmap or graymap (P1, P2, P4, P5), dark pixels are solid.
+		/// The first row of the image is the top of the domain.
+		bool loadImage(const std::string & path)
+		{
+			std::ifstream file(path, std::ios::binary);
+			if (!file) return false;
+
+			std::string magic;
+			file >> magic;
+			bool bitmap = (magic == "P1" || magic == "P4");
+			bool binary = (magic == "P4" || magic == "P5");
+			if (!bitmap && magic != "P2" && magic != "P5") return false;
+
+			uint width = 0;
+			uint height = 0;
+			uint maxValue = 1;
+			if (!readHeaderValue(file, width) || !readHeaderValue(file, height)) return false;
+			if (!bitmap && !readHeaderValue(file, maxValue)) return false;
+			if (width == 0 || height == 0 || maxValue == 0 || maxValue > 65535) return false;
+
+			/// A single whitespace separates the header from binary data
+			if (binary) file.get();
+
+			std::vector<uchar> pixels(std::size_t(width) * height);
+			for (uint y = 0; y < height; y++)
+			{
+				std::vector<uchar> packed(binary && bitmap ? (width + 7) / 8 : 0);
+				if (!packed.empty() && !file.read(reinterpret_cast<char *>(packed.data()), packed.size())) return false;
+
+				for (uint x = 0; x < width; x++)
+				{
+					bool solid;
+					if (binary && bitmap)
+					{
+						solid = (packed[x / 8] >> (7 - x % 8)) & 1;
+					}
+					else if (binary)
+					{
+						uint value = uint(file.get());
+						if (maxValue > 255) value = (value << 8) | uint(file.get());
+						solid = 2 * value < maxValue;
+					}
+					else
+					{
+						uint value;
+						if (!(file >> value)) return false;
+						solid = bitmap ? (value != 0) : (2 * value < maxValue);
+					}
+					if (!file) return false;
+					pixels[x + std::size_t(height - 1 - y) * width] = solid ? 1 : 0;
+				}
+			}
+
+			m_imageWidth = width;
+			m_imageHeight = height;
+			m_imagePixels.swap(pixels);
+			return true;
+		}
+
+		/// Whether a point of a domain of the given size is inside a solid
+		bool isSolid(double x, double y, double width, double height) const
+		{
+			for (const Box & box : m_boxes)
+			{
+				if (x >= box.xMin && x <= box.xMax && y >= box.yMin && y <= box.yMax) return true;
+			}
+			for (const Circle & circle : m_circles)
+			{
+				double dx = x - circle.x;
+				double dy = y - circle.y;
+				if (dx * dx + dy * dy <= circle.radius * circle.radius) return true;
+			}
+			if (!m_imagePixels.empty())
+			{
+				uint px = std::min(uint(x / width * m_imageWidth), m_imageWidth - 1);
+				uint py = std::min(uint(y / height * m_imageHeight), m_imageHeight - 1);
+				if (m_imagePixels[px + std::size_t(py) * m_imageWidth]) return true;
+			}
+			return false;
+		}
+
+	protected:
+		/// Header values may be preceded by comments
+		static bool readHeaderValue(std::ifstream & file, uint & value)
+		{
+			file >> std::ws;
+			while (file.peek() == '#')
+			{
+				std::string comment;
+				std::getline(file, comment);
+				file >> std::ws;
+			}
+			return bool(file >> value);
+		}
+
+	private:
+		struct Box
+		{
+			double xMin, yMin, xMax, yMax;
+		};
+
+		struct Circle
+		{
+			double x, y, radius;
+		};
+
+		std::vector<Box> m_boxes;
+		std::vector<Circle> m_circles;
+
+		/// Bottom row first, 1 for solid
+		uint m_imageWidth = 0;
+		uint m_imageHeight = 0;
+		std::vector<uchar> m_imagePixels;
+	};
+
+	/// Solid or fluid state of the cells of a (nx + 2) x (ny + 2) row major
+	/// field, the ghost cells are fluid. After the cells change, update
+	/// splits every row in spans of fluid cells so the sweeps only visit
+	/// the flow, and lists the solid cells next to it. Those hold the
+	/// boundary values the stencils of the flow read, every other solid
+	/// cell stays zero and is never touched.
+	class SolidMask
+	{
+	public:
+		/// All fluid
+		void resize(uint nx, uint ny)
+		{
+			m_numberCellsX = nx;
+			m_numberCellsY = ny;
+			m_cells.assign((std::size_t(nx) + 2) * (std::size_t(ny) + 2), 0);
+			update();
+		}
+
+		/// Solid at the cell centres of the geometry, h is 1 / min(nx, ny)
+		void rasterize(const SolidGeometry & geometry, uint nx, uint ny)
+		{
+			resize(nx, ny);
+			if (geometry.empty()) return;
+
+			double spacing = 1.0 / std::min(nx, ny);
+			for (uint j = 1; j <= ny; j++)
+			{
+				double y = (j - 0.5) * spacing;
+				for (uint i = 1; i <= nx; i++)
+				{
+					double x = (i - 0.5) * spacing;
+					if (geometry.isSolid(x, y, nx * spacing, ny * spacing)) m_cells[index(i, j)] = 1;
+				}
+			}
+			update();
+		}
+
+		/// Cells [iBegin, iEnd) x [jBegin, jEnd) become solid, call update after
+		void addCells(uint iBegin, uint iEnd, uint jBegin, uint jEnd)
+		{
+			iBegin = std::max(iBegin, uint(1));
+			jBegin = std::max(jBegin, uint(1));
+			iEnd = std::min(iEnd, m_numberCellsX + 1);
+			jEnd = std::min(jEnd, m_numberCellsY + 1);
+			for (uint j = jBegin; j < jEnd; j++)
+			{
+				for (uint i = iBegin; i < iEnd; i++) m_cells[index(i, j)] = 1;
+			}
+		}
+
+		void update()
+		{
+			m_spans.clear(m_numberCellsY);
+			m_boundaryCells.clear();
+			m_numSolidCells = 0;
+
+			for (uint j = 1; j <= m_numberCellsY; j++)
+			{
+				m_spans.beginRow(j);
+				uint i = 1;
+				while (i <= m_numberCellsX)
+				{
+					if (m_cells[index(i, j)])
+					{
+						m_numSolidCells++;
+						addBoundaryCell(i, j);
+						i++;
+						continue;
+					}
+
+					CellSpan span = { i, i };
+					while (span.iEnd <= m_numberCellsX && !m_cells[index(span.iEnd, j)]) span.iEnd++;
+					m_spans.add(j, span);
+					i = span.iEnd;
+				}
+			}
+		}
+
+		bool hasSolids() const
+		{
+			return m_numSolidCells > 0;
+		}
+
+		std::size_t getNumSolidCells() const
+		{
+			return m_numSolidCells;
+		}
+
+		bool isSolid(uint i, uint j) const
+		{
+			return m_cells[index(i, j)] != 0;
+		}
+
+		/// One byte per cell, ghost cells included
+		const std::vector<uchar> & getCells() const
+		{
+			return m_cells;
+		}
+
+		/// Fluid cells of every row
+		const SpanList & getSpans() const
+		{
+			return m_spans;
+		}
+
+		/// Solid cells next to the flow take the mean of their fluid
+		/// neighbours, negated for no-slip. Against a straight wall this
+		/// mirrors the fluid cell like the ghost cells of DIRICHLET walls.
+		template <typename T>
+		void fillSolidCells(T * x, solidBoundaryType type) const
+		{
+			typedef Compute<T> C;
+			for (const BoundaryCell & cell : m_boundaryCells)
+			{
+				C sum = C(0.0);
+				for (uint n = 0; n < cell.numNeighbours; n++) sum += C(x[cell.neighbours[n]]);
+				C value = sum / C(cell.numNeighbours);
+				x[cell.cter] = T((type == SOLID_NO_SLIP) ? -value : value);
+			}
+		}
+
+		/// Zeroes every solid cell, for fields written before the mask
+		template <typename T>
+		void clearSolidCells(T * x) const
+		{
+			for (std::size_t cter = 0; cter < m_cells.size(); cter++)
+			{
+				if (m_cells[cter]) x[cter] = T(0.0f);
+			}
+		}
+
+	protected:
+		std::size_t index(uint i, uint j) const
+		{
+			return i + j * (std::size_t(m_numberCellsX) + 2);
+		}
+
+		/// Only interior fluid cells count as neighbours
+		void addBoundaryCell(uint i, uint j)
+		{
+			BoundaryCell cell;
+			cell.cter = index(i, j);
+			cell.numNeighbours = 0;
+
+			std::size_t candidates[4];
+			bool inside[4] = { i > 1, i < m_numberCellsX, j > 1, j < m_numberCellsY };
+			candidates[0] = index(i - 1, j);
+			candidates[1] = index(i + 1, j);
+			candidates[2] = index(i, j - 1);
+			candidates[3] = index(i, j + 1);
+			for (uint n = 0; n < 4; n++)
+			{
+				if (inside[n] && !m_cells[candidates[n]]) cell.neighbours[cell.numNeighbours++] = candidates[n];
+			}
+
+			if (cell.numNeighbours > 0) m_boundaryCells.push_back(cell);
+		}
+
+	private:
+		struct BoundaryCell
+		{
+			std::size_t cter;
+			std::size_t neighbours[4];
+			uint numNeighbours;
+		};
+
+		uint m_numberCellsX = 0;
+		uint m_numberCellsY = 0;
+		std::vector<uchar> m_cells;
+		std::size_t m_numSolidCells = 0;
+
+		SpanList m_spans;
+
+		std::vector<BoundaryCell> m_boundaryCells;
+	};
+}
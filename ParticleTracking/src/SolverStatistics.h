@@ -0,0 +1,41 @@
+#pragma once
+#include "Definitions.h"
+#include <algorithm>
+
+namespace FluidSimulation
+{
+	/// Cost and accuracy of the last call to an iterative solver. Residuals
+	/// are root mean square values over the interior cells, kept in double
+	/// whatever the precision of the solver.
+	struct SolverStatistics
+	{
+		uint iterations = 0;
+		double initialResidual = 0.0;
+		double residual = 0.0;
+
+		/// Residual of a zero initial guess when the solve started from a
+		/// better one, zero otherwise
+		double referenceResidual = 0.0;
+
+		/// False when a solve with a tolerance stopped at its iteration limit
+		bool converged = true;
+
+		/// Relative to the zero guess, so solves with different initial
+		/// guesses compare
+		double relativeResidual() const
+		{
+			double reference = (referenceResidual > 0.0) ? referenceResidual : initialResidual;
+			return (reference > 0.0) ? (residual / reference) : 0.0;
+		}
+
+		/// Keeps the least converged of two solves and the larger iteration count
+		void merge(const SolverStatistics & other)
+		{
+			uint maxIterations = std::max(iterations, other.iterations);
+			bool bothConverged = converged && other.converged;
+			if (iterations == 0 || other.relativeResidual() > relativeResidual()) *this = other;
+			iterations = maxIterations;
+			converged = bothConverged;
+		}
+	};
+}
@@ -0,0 +1,326 @@
+#pragma once
+#include "BoundaryConditions.h"
+#include "SolverStatistics.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+#define SPECTRAL_PARALLEL_CELLS 64
+
+namespace FluidSimulation
+{
+	/// In place radix-2 complex FFT of a fixed power of two length
+	template <typename T>
+	class FourierTransform
+	{
+	public:
+		typedef std::complex<T> complex;
+
+		void resize(uint length)
+		{
+			m_length = length;
+			m_twiddles.resize(length / 2);
+			for (uint k = 0; k < length / 2; k++)
+			{
+				double angle = -2.0 * M_PI * double(k) / double(length);
+				m_twiddles[k] = complex(T(std::cos(angle)), T(std::sin(angle)));
+			}
+
+			m_bitReversed.resize(length);
+			uint numBits = 0;
+			while ((1u << numBits) < length) numBits++;
+			for (uint k = 0; k < length; k++)
+			{
+				uint reversed = 0;
+				for (uint bit = 0; bit < numBits; bit++)
+				{
+					reversed |= ((k >> bit) & 1u) << (numBits - 1 - bit);
+				}
+				m_bitReversed[k] = reversed;
+			}
+		}
+
+		uint getLength() const
+		{
+			return m_length;
+		}
+
+		/// Unnormalized, the inverse transform does not divide by the length
+		void transform(complex * data, bool inverse) const
+		{
+			for (uint k = 0; k < m_length; k++)
+			{
+				uint reversed = m_bitReversed[k];
+				if (k < reversed) std::swap(data[k], data[reversed]);
+			}
+
+			for (uint size = 2; size <= m_length; size *= 2)
+			{
+				uint half = size / 2;
+				uint twiddleStride = m_length / size;
+				for (uint start = 0; start < m_length; start += size)
+				{
+					for (uint k = 0; k < half; k++)
+					{
+						complex twiddle = m_twiddles[k * twiddleStride];
+						if (inverse) twiddle = std::conj(twiddle);
+
+						complex even = data[start + k];
+						complex odd = twiddle * data[start + k + half];
+						data[start + k] = even + odd;
+						data[start + k + half] = even - odd;
+					}
+				}
+			}
+		}
+
+	private:
+		uint m_length = 0;
+		std::vector<complex> m_twiddles;
+		std::vector<uint> m_bitReversed;
+	};
+
+	/// Real to complex FFT of an even length N through a complex FFT of N / 2,
+	/// only the non negative frequencies 0 ... N / 2 are stored
+	template <typename T>
+	class RealFourierTransform
+	{
+	public:
+		typedef std::complex<T> complex;
+
+		void resize(uint length)
+		{
+			m_length = length;
+			m_half.resize(length / 2);
+			m_twiddles.resize(length / 2 + 1);
+			for (uint k = 0; k <= length / 2; k++)
+			{
+				double angle = -2.0 * M_PI * double(k) / double(length);
+				m_twiddles[k] = complex(T(std::cos(angle)), T(std::sin(angle)));
+			}
+		}
+
+		/// scratch needs N / 2 entries, spectrum N / 2 + 1
+		void forward(const T * x, complex * spectrum, complex * scratch) const
+		{
+			uint half = m_length / 2;
+			for (uint k = 0; k < half; k++)
+			{
+				scratch[k] = complex(x[2 * k], x[2 * k + 1]);
+			}
+			m_half.transform(scratch, false);
+
+			for (uint k = 0; k <= half; k++)
+			{
+				complex zk = scratch[k % half];
+				complex zc = std::conj(scratch[(half - k) % half]);
+				complex even = T(0.5) * (zk + zc);
+				complex odd = complex(T(0.0), T(-0.5)) * (zk - zc);
+				spectrum[k] = even + m_twiddles[k] * odd;
+			}
+		}
+
+		/// Exact inverse of forward, already divided by N / 2
+		void inverse(const complex * spectrum, T * x, complex * scratch) const
+		{
+			uint half = m_length / 2;
+			for (uint k = 0; k < half; k++)
+			{
+				complex xk = spectrum[k];
+				complex xc = std::conj(spectrum[half - k]);
+				complex even = T(0.5) * (xk + xc);
+				complex odd = T(0.5) * (xk - xc) * std::conj(m_twiddles[k]);
+				scratch[k] = even + complex(T(0.0), T(1.0)) * odd;
+			}
+			m_half.transform(scratch, true);
+
+			T scale = T(1.0) / T(half);
+			for (uint k = 0; k < half; k++)
+			{
+				x[2 * k] = scale * scratch[k].real();
+				x[2 * k + 1] = scale * scratch[k].imag();
+			}
+		}
+
+	private:
+		uint m_length = 0;
+		FourierTransform<T> m_half;
+		std::vector<complex> m_twiddles;
+	};
+
+	/// Direct solver for the constant coefficient problems of a PERIODIC
+	/// fluid, the grid is diagonalized with a T to complex 2D FFT and each
+	/// mode is divided by the eigenvalue of the operator. Both sides have to
+	/// be powers of two, callers check isSupported and fall back to the
+	/// iterative solvers otherwise. Direct solves report one iteration.
+	template <typename T>
+	class SpectralSolver
+	{
+	public:
+		typedef std::complex<T> complex;
+
+		SpectralSolver(ThreadPool & threadPool)
+			: m_threadPool(threadPool)
+		{
+
+		}
+
+		void resize(uint numberCellsX, uint numberCellsY)
+		{
+			m_numberCellsX = numberCellsX;
+			m_numberCellsY = numberCellsY;
+			m_supported = isPowerOfTwo(numberCellsX) && isPowerOfTwo(numberCellsY);
+			if (!m_supported)
+			{
+				m_spectrum.clear();
+				return;
+			}
+
+			m_rowTransform.resize(numberCellsX);
+			m_columnTransform.resize(numberCellsY);
+			m_spectrum.assign((std::size_t(numberCellsX) / 2 + 1) * numberCellsY, complex());
+
+			computeWaves(numberCellsX, m_cosinesX, m_sinesX);
+			computeWaves(numberCellsY, m_cosinesY, m_sinesY);
+		}
+
+		bool isSupported() const
+		{
+			return m_supported;
+		}
+
+		/// Solves c x - a (x(i - 1, j) + x(i + 1, j) + x(i, j - 1) + x(i, j + 1)) = b,
+		/// the operator of Fluid::linearSolver
+		SolverStatistics solveHelmholtz(T * x, const T * b, T a, T c)
+		{
+			return solve(x, b, [&](uint k, uint l) -> T
+			{
+				T eigenvalue = c - T(2.0) * a * (m_cosinesX[k] + m_cosinesY[l]);
+				return (std::abs(eigenvalue) > std::numeric_limits<T>::epsilon()) ? (T(1.0) / eigenvalue) : T(0.0);
+			});
+		}
+
+		/// Pressure of Fluid::project. The divergence and the gradient are
+		/// central differences, their composition has symbol sin^2 + sin^2,
+		/// dividing by it leaves the projected velocity exactly free of
+		/// central divergence. Modes without a gradient are dropped.
+		SolverStatistics solveProjection(T * x, const T * b)
+		{
+			return solve(x, b, [&](uint k, uint l) -> T
+			{
+				T eigenvalue = m_sinesX[k] * m_sinesX[k] + m_sinesY[l] * m_sinesY[l];
+				return (eigenvalue > std::numeric_limits<T>::epsilon()) ? (T(1.0) / eigenvalue) : T(0.0);
+			});
+		}
+
+	protected:
+		static bool isPowerOfTwo(uint n)
+		{
+			return (n >= 4) && ((n & (n - 1)) == 0);
+		}
+
+		static void computeWaves(uint n, std::vector<T> & cosines, std::vector<T> & sines)
+		{
+			cosines.resize(n);
+			sines.resize(n);
+			for (uint k = 0; k < n; k++)
+			{
+				double angle = 2.0 * M_PI * double(k) / double(n);
+				cosines[k] = T(std::cos(angle));
+				sines[k] = T(std::sin(angle));
+			}
+		}
+
+		template <typename Function>
+		void forEach(uint begin, uint end, const Function & function)
+		{
+			if (std::min(m_numberCellsX, m_numberCellsY) >= SPECTRAL_PARALLEL_CELLS)
+			{
+				m_threadPool.parallelFor(begin, end, function);
+			}
+			else
+			{
+				function(begin, end);
+			}
+		}
+
+		template <typename InverseSymbol>
+		SolverStatistics solve(T * x, const T * b, const InverseSymbol & inverseSymbol)
+		{
+			SolverStatistics statistics;
+			if (!m_supported) return statistics;
+
+			uint nx = m_numberCellsX;
+			uint ny = m_numberCellsY;
+			uint half = nx / 2;
+			std::size_t stride = std::size_t(nx) + 2;
+			complex * spectrum = m_spectrum.data();
+
+			/// Rows, frequency k is stored as column k of length ny
+			forEach(1, ny + 1, [&](uint jBegin, uint jEnd)
+			{
+				std::vector<complex> row(half + 1);
+				std::vector<complex> scratch(half);
+				for (uint j = jBegin; j < jEnd; j++)
+				{
+					m_rowTransform.forward(b + j * stride + 1, row.data(), scratch.data());
+					for (uint k = 0; k <= half; k++)
+					{
+						spectrum[k * std::size_t(ny) + (j - 1)] = row[k];
+					}
+				}
+			});
+
+			/// Columns, divide by the eigenvalues and transform back
+			T scale = T(1.0) / T(ny);
+			forEach(0, half + 1, [&](uint kBegin, uint kEnd)
+			{
+				for (uint k = kBegin; k < kEnd; k++)
+				{
+					complex * column = spectrum + k * std::size_t(ny);
+					m_columnTransform.transform(column, false);
+					for (uint l = 0; l < ny; l++)
+					{
+						column[l] *= scale * inverseSymbol(k, l);
+					}
+					m_columnTransform.transform(column, true);
+				}
+			});
+
+			forEach(1, ny + 1, [&](uint jBegin, uint jEnd)
+			{
+				std::vector<complex> row(half + 1);
+				std::vector<complex> scratch(half);
+				for (uint j = jBegin; j < jEnd; j++)
+				{
+					for (uint k = 0; k <= half; k++)
+					{
+						row[k] = spectrum[k * std::size_t(ny) + (j - 1)];
+					}
+					m_rowTransform.inverse(row.data(), x + j * stride + 1, scratch.data());
+				}
+			});
+
+			fillGhostCells(x, nx, ny, PERIODIC);
+			statistics.iterations = 1;
+			return statistics;
+		}
+
+	private:
+		ThreadPool & m_threadPool;
+		uint m_numberCellsX = 0;
+		uint m_numberCellsY = 0;
+		bool m_supported = false;
+
+		RealFourierTransform<T> m_rowTransform;
+		FourierTransform<T> m_columnTransform;
+		std::vector<complex> m_spectrum;
+
+		/// cos / sin of 2 pi k / nx and 2 pi l / ny
+		std::vector<T> m_cosinesX;
+		std::vector<T> m_sinesX;
+		std::vector<T> m_cosinesY;
+		std::vector<T> m_sinesY;
+	};
+}
@@ -0,0 +1,371 @@
+#pragma once
+#include "Definitions.h"
+#include <condition_variable>
+#include <initializer_list>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+namespace FluidSimulation
+{
+	class ThreadPool;
+
+	/// Unit of work of the pool, the object has to outlive its execution
+	class Task
+	{
+	public:
+		virtual void run() = 0;
+
+	protected:
+		~Task() {}
+	};
+
+	/// Stages of a computation and the order between them, executed by
+	/// ThreadPool::run. Stages without a path between them in the graph may
+	/// run at the same time, each one may itself call parallelFor.
+	class TaskGraph
+	{
+	public:
+		/// Dependencies are indices returned by earlier calls, so the order
+		/// of insertion is always a valid sequential order
+		uint addTask(std::function<void()> function, std::initializer_list<uint> dependencies = {})
+		{
+			uint index = uint(m_nodes.size());
+			m_nodes.emplace_back();
+			Node & node = m_nodes.back();
+			node.function = std::move(function);
+			node.graph = this;
+			for (uint dependency : dependencies)
+			{
+				m_nodes[dependency].successors.push_back(index);
+				node.numDependencies++;
+			}
+			return index;
+		}
+
+		uint getNumTasks() const
+		{
+			return uint(m_nodes.size());
+		}
+
+		void clear()
+		{
+			m_nodes.clear();
+		}
+
+	private:
+		friend class ThreadPool;
+
+		struct Node : public Task
+		{
+			void run() override;
+
+			std::function<void()> function;
+			std::vector<uint> successors;
+			uint numDependencies = 0;
+			std::atomic<uint> remainingDependencies{ 0 };
+			TaskGraph * graph = nullptr;
+		};
+
+		/// A deque keeps the nodes in place while the graph grows
+		std::deque<Node> m_nodes;
+		std::atomic<uint> m_pendingTasks{ 0 };
+		ThreadPool * m_threadPool = nullptr;
+	};
+
+	/// Work stealing pool. Every thread owns a queue, it pushes and pops its
+	/// own work at the back and idle threads steal from the front of the
+	/// others. Threads waiting for their work to finish keep executing
+	/// queued tasks, so parallelFor may be nested inside tasks and graphs
+	/// and concurrent stages fill each other's gaps. Threads outside the
+	/// pool share the first queue. A pool of one thread runs everything
+	/// inline without any synchronization.
+	class ThreadPool
+	{
+	public:
+		ThreadPool(uint numThreads = std::thread::hardware_concurrency())
+		{
+			resize(numThreads);
+		}
+
+		~ThreadPool()
+		{
+			stopWorkers();
+		}
+
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool & operator=(const ThreadPool &) = delete;
+
+		/// The pool has to be idle
+		void resize(uint numThreads)
+		{
+			stopWorkers();
+
+			m_numThreads = std::max(numThreads, uint(1));
+			m_stop = false;
+			m_queues.clear();
+			for (uint n = 0; n < m_numThreads; n++)
+			{
+				m_queues.emplace_back(new TaskQueue);
+			}
+			for (uint n = 1; n < m_numThreads; n++)
+			{
+				m_workers.push_back(std::thread(&ThreadPool::workerLoop, this, n));
+			}
+		}
+
+		uint getNumThreads() const
+		{
+			return m_numThreads;
+		}
+
+		/// Calls function(first, last) on disjoint sub-ranges covering [begin, end)
+		/// and returns once every chunk is done. The chunks do not depend on
+		/// the scheduling, the calling thread works on the first one.
+		template <typename Function>
+		void parallelFor(uint begin, uint end, const Function & function)
+		{
+			if (end <= begin) return;
+
+			uint numChunks = std::min(m_numThreads, end - begin);
+			if (numChunks == 1)
+			{
+				function(begin, end);
+				return;
+			}
+
+			std::atomic<uint> pendingChunks(numChunks - 1);
+			std::vector<RangeTask<Function>> chunks(numChunks);
+			uint length = end - begin;
+			for (uint chunk = 0; chunk < numChunks; chunk++)
+			{
+				chunks[chunk].function = &function;
+				chunks[chunk].first = begin + (uint)((unsigned long long)length * chunk / numChunks);
+				chunks[chunk].last = begin + (uint)((unsigned long long)length * (chunk + 1) / numChunks);
+				chunks[chunk].pending = &pendingChunks;
+				chunks[chunk].threadPool = this;
+			}
+
+			uint queue = currentQueue();
+			for (uint chunk = numChunks - 1; chunk > 0; chunk--)
+			{
+				push(queue, &chunks[chunk]);
+			}
+
+			function(chunks[0].first, chunks[0].last);
+			helpUntilDone(pendingChunks);
+		}
+
+		/// Runs every task of the graph once its dependencies are done and
+		/// returns when all of them are. One thread runs them in insertion order.
+		void run(TaskGraph & graph)
+		{
+			if (graph.m_nodes.empty()) return;
+
+			if (m_numThreads == 1)
+			{
+				for (auto & node : graph.m_nodes)
+				{
+					node.function();
+				}
+				return;
+			}
+
+			graph.m_threadPool = this;
+			graph.m_pendingTasks.store(graph.getNumTasks());
+			for (auto & node : graph.m_nodes)
+			{
+				node.remainingDependencies.store(node.numDependencies);
+			}
+
+			/// Pushed last to first, the calling thread pops the first root
+			uint queue = currentQueue();
+			for (auto node = graph.m_nodes.rbegin(); node != graph.m_nodes.rend(); ++node)
+			{
+				if (node->numDependencies == 0) push(queue, &*node);
+			}
+			helpUntilDone(graph.m_pendingTasks);
+		}
+
+	protected:
+		friend struct TaskGraph::Node;
+
+		struct TaskQueue
+		{
+			std::mutex mutex;
+			std::deque<Task *> tasks;
+		};
+
+		template <typename Function>
+		struct RangeTask : public Task
+		{
+			void run() override
+			{
+				(*function)(first, last);
+				threadPool->finish(*pending);
+			}
+
+			const Function * function = nullptr;
+			uint first = 0;
+			uint last = 0;
+			std::atomic<uint> * pending = nullptr;
+			ThreadPool * threadPool = nullptr;
+		};
+
+		/// Queue of the calling thread, threads of other pools use the first one
+		uint currentQueue() const
+		{
+			const WorkerIdentity & identity = currentWorker();
+			return (identity.threadPool == this) ? identity.queue : 0;
+		}
+
+		struct WorkerIdentity
+		{
+			const ThreadPool * threadPool = nullptr;
+			uint queue = 0;
+		};
+
+		static WorkerIdentity & currentWorker()
+		{
+			static thread_local WorkerIdentity identity;
+			return identity;
+		}
+
+		void push(uint queue, Task * task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_queues[queue]->mutex);
+				m_queues[queue]->tasks.push_back(task);
+			}
+			m_numQueued.fetch_add(1);
+			wakeThreads(false);
+		}
+
+		/// Own queue from the back first, then the others from the front
+		Task * findTask(uint queue)
+		{
+			if (m_numQueued.load() == 0) return nullptr;
+
+			for (uint n = 0; n < m_numThreads; n++)
+			{
+				uint victim = (queue + n) % m_numThreads;
+				TaskQueue & taskQueue = *m_queues[victim];
+				std::lock_guard<std::mutex> lock(taskQueue.mutex);
+				if (taskQueue.tasks.empty()) continue;
+
+				Task * task = nullptr;
+				if (n == 0)
+				{
+					task = taskQueue.tasks.back();
+					taskQueue.tasks.pop_back();
+				}
+				else
+				{
+					task = taskQueue.tasks.front();
+					taskQueue.tasks.pop_front();
+				}
+				m_numQueued.fetch_sub(1);
+				return task;
+			}
+			return nullptr;
+		}
+
+		/// Counts a finished task of a group, the last one wakes the waiter
+		void finish(std::atomic<uint> & pending)
+		{
+			if (pending.fetch_sub(1) == 1) wakeThreads(true);
+		}
+
+		/// Locking the mutex orders the notification after the change the
+		/// sleeping threads test in their predicate
+		void wakeThreads(bool all)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_sleepMutex);
+			}
+			if (all) m_wake.notify_all();
+			else m_wake.notify_one();
+		}
+
+		void helpUntilDone(const std::atomic<uint> & pending)
+		{
+			uint queue = currentQueue();
+			while (pending.load() != 0)
+			{
+				Task * task = findTask(queue);
+				if (task)
+				{
+					task->run();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(m_sleepMutex);
+				m_wake.wait(lock, [&]() { return pending.load() == 0 || m_numQueued.load() != 0; });
+			}
+		}
+
+		void workerLoop(uint queue)
+		{
+			currentWorker().threadPool = this;
+			currentWorker().queue = queue;
+			for (;;)
+			{
+				Task * task = findTask(queue);
+				if (task)
+				{
+					task->run();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(m_sleepMutex);
+				m_wake.wait(lock, [&]() { return m_stop || m_numQueued.load() != 0; });
+				if (m_stop) return;
+			}
+		}
+
+		void stopWorkers()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_sleepMutex);
+				m_stop = true;
+			}
+			m_wake.notify_all();
+
+			for (auto & worker : m_workers)
+			{
+				worker.join();
+			}
+			m_workers.clear();
+		}
+
+	private:
+		std::vector<std::thread> m_workers;
+		std::vector<std::unique_ptr<TaskQueue>> m_queues;
+		uint m_numThreads = 1;
+
+		std::mutex m_sleepMutex;
+		std::condition_variable m_wake;
+		std::atomic<uint> m_numQueued{ 0 };
+		bool m_stop = false;
+	};
+
+	/// Releases the successors whose last dependency this was
+	inline void TaskGraph::Node::run()
+	{
+		function();
+
+		ThreadPool & threadPool = *graph->m_threadPool;
+		uint queue = threadPool.currentQueue();
+		for (uint successor : successors)
+		{
+			Node & node = graph->m_nodes[successor];
+			if (node.remainingDependencies.fetch_sub(1) == 1) threadPool.push(queue, &node);
+		}
+		threadPool.finish(graph->m_pendingTasks);
+	}
+}
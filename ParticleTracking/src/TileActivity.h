@@ -0,0 +1,258 @@
+#pragma once
+#include "Definitions.h"
+#include "Precision.h"
+#include "SolidMask.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#define TILE_SIZE 16
+
+namespace FluidSimulation
+{
+	/// Activity of TILE_SIZE x TILE_SIZE tiles of the interior of a group of
+	/// (nx + 2) x (ny + 2) fields, like the velocity components. Every step
+	/// measures the largest magnitude in each tile, the tiles above the
+	/// threshold and the ones within reach of them are active. The passes
+	/// writing the fields only visit the active tiles and the others hold
+	/// zero.
+	///
+	/// Each buffer of the group keeps which tiles are known to be zero, so
+	/// quiet tiles are cleared once when they go quiet and are neither read
+	/// nor written afterwards. The storage stays dense: with the lazily
+	/// mapped fields of FieldArena, memory never written is never backed.
+	class TileActivity
+	{
+	public:
+		void resize(uint nx, uint ny, uint numBuffers)
+		{
+			m_numberCellsX = nx;
+			m_numberCellsY = ny;
+			m_tilesX = (nx + TILE_SIZE - 1) / TILE_SIZE;
+			m_tilesY = (ny + TILE_SIZE - 1) / TILE_SIZE;
+
+			std::size_t numTiles = std::size_t(m_tilesX) * m_tilesY;
+			m_bound.assign(numTiles, 0.0);
+			m_active.assign(numTiles, 1);
+			m_dilated.assign(numTiles, 0);
+			m_zero.assign(numBuffers, std::vector<uchar>(numTiles, 0));
+			m_numActive = numTiles;
+		}
+
+		/// Every tile of a buffer may be non-zero, after writes outside the passes
+		void touchAll(uint buffer)
+		{
+			std::fill(m_zero[buffer].begin(), m_zero[buffer].end(), uchar(0));
+		}
+
+		/// Ghost cells and cells outside the grid belong to no tile
+		void touch(uint buffer, uint i, uint j)
+		{
+			if (buffer >= m_zero.size()) return;
+			if (i < 1 || i > m_numberCellsX || j < 1 || j > m_numberCellsY) return;
+			m_zero[buffer][tileIndex(i, j)] = 0;
+		}
+
+		/// Largest magnitude of the fields in every tile, tiles known to be
+		/// zero in the buffer are skipped
+		template <typename T>
+		void measure(const T * const * x, uint numFields, uint buffer, ThreadPool & threadPool)
+		{
+			typedef Compute<T> C;
+			std::size_t stride = std::size_t(m_numberCellsX) + 2;
+			threadPool.parallelFor(0, m_tilesY, [&](uint tyBegin, uint tyEnd)
+			{
+				for (uint ty = tyBegin; ty < tyEnd; ty++)
+				{
+					for (uint tx = 0; tx < m_tilesX; tx++)
+					{
+						std::size_t tile = tx + std::size_t(ty) * m_tilesX;
+						C bound = C(0.0);
+						if (!m_zero[buffer][tile])
+						{
+							uint iBegin, iEnd, jBegin, jEnd;
+							tileCells(tx, ty, iBegin, iEnd, jBegin, jEnd);
+							for (uint f = 0; f < numFields; f++)
+							{
+								for (uint j = jBegin; j < jEnd; j++)
+								{
+									const T * row = x[f] + j * stride;
+									for (uint i = iBegin; i < iEnd; i++) bound = std::max(bound, C(std::abs(C(row[i]))));
+								}
+							}
+						}
+						m_bound[tile] = double(bound);
+					}
+				}
+			});
+		}
+
+		/// Largest magnitude of the last measure
+		double getMaxBound() const
+		{
+			return m_bound.empty() ? 0.0 : *std::max_element(m_bound.begin(), m_bound.end());
+		}
+
+		/// Tiles above the threshold and the ones within radius tiles of them
+		/// become active, the radius wraps around PERIODIC walls
+		void activate(double threshold, uint radius, bool periodic)
+		{
+			for (std::size_t tile = 0; tile < m_bound.size(); tile++)
+			{
+				m_active[tile] = (m_bound[tile] > threshold) ? 1 : 0;
+			}
+
+			/// Separable dilation, along x into m_dilated and along y back
+			for (uint ty = 0; ty < m_tilesY; ty++)
+			{
+				for (uint tx = 0; tx < m_tilesX; tx++)
+				{
+					m_dilated[tx + std::size_t(ty) * m_tilesX] = anyInReach(tx, m_tilesX, radius, periodic, [&](uint t) { return m_active[t + std::size_t(ty) * m_tilesX]; });
+				}
+			}
+			m_numActive = 0;
+			for (uint ty = 0; ty < m_tilesY; ty++)
+			{
+				for (uint tx = 0; tx < m_tilesX; tx++)
+				{
+					uchar active = anyInReach(ty, m_tilesY, radius, periodic, [&](uint t) { return m_dilated[tx + std::size_t(t) * m_tilesX]; });
+					m_active[tx + std::size_t(ty) * m_tilesX] = active;
+					m_numActive += active;
+				}
+			}
+		}
+
+		/// Cells of the active tiles within the given spans, the fluid cells
+		void buildSpans(const SpanList & fluid)
+		{
+			m_spans.clear(m_numberCellsY);
+			for (uint j = 1; j <= m_numberCellsY; j++)
+			{
+				m_spans.beginRow(j);
+				const uchar * active = m_active.data() + std::size_t((j - 1) / TILE_SIZE) * m_tilesX;
+
+				const CellSpan * span = fluid.spansBegin(j);
+				uint tx = 0;
+				while (tx < m_tilesX && span != fluid.spansEnd(j))
+				{
+					if (!active[tx]) { tx++; continue; }
+
+					/// Run of active tiles
+					uint txEnd = tx;
+					while (txEnd < m_tilesX && active[txEnd]) txEnd++;
+					uint runBegin = 1 + tx * TILE_SIZE;
+					uint runEnd = std::min(1 + txEnd * TILE_SIZE, m_numberCellsX + 1);
+
+					while (span != fluid.spansEnd(j) && span->iBegin < runEnd)
+					{
+						m_spans.add(j, { std::max(span->iBegin, runBegin), std::min(span->iEnd, runEnd) });
+						if (span->iEnd > runEnd) break;
+						span++;
+					}
+					tx = txEnd;
+				}
+			}
+		}
+
+		/// Cells of the active tiles
+		const SpanList & getSpans() const
+		{
+			return m_spans;
+		}
+
+		double getActiveFraction() const
+		{
+			return m_active.empty() ? 0.0 : double(m_numActive) / double(m_active.size());
+		}
+
+		/// Before the passes writing the fields of a buffer: zeroes their
+		/// inactive tiles not known to be zero yet and marks the active ones
+		/// as written
+		template <typename T>
+		void prepareBuffer(T * const * x, uint numFields, uint buffer)
+		{
+			std::vector<uchar> & zero = m_zero[buffer];
+			for (std::size_t tile = 0; tile < m_active.size(); tile++)
+			{
+				if (m_active[tile])
+				{
+					zero[tile] = 0;
+				}
+				else if (!zero[tile])
+				{
+					for (uint f = 0; f < numFields; f++) clearTile(x[f], tile);
+					zero[tile] = 1;
+				}
+			}
+		}
+
+		/// Zeroes every inactive tile, for scratch fields nothing is known about
+		template <typename T>
+		void clearInactive(T * x) const
+		{
+			for (std::size_t tile = 0; tile < m_active.size(); tile++)
+			{
+				if (!m_active[tile]) clearTile(x, tile);
+			}
+		}
+
+	protected:
+		std::size_t tileIndex(uint i, uint j) const
+		{
+			return (i - 1) / TILE_SIZE + std::size_t((j - 1) / TILE_SIZE) * m_tilesX;
+		}
+
+		/// Interior cells [iBegin, iEnd) x [jBegin, jEnd) of a tile, the last
+		/// tiles of a row or column may be partial
+		void tileCells(uint tx, uint ty, uint & iBegin, uint & iEnd, uint & jBegin, uint & jEnd) const
+		{
+			iBegin = 1 + tx * TILE_SIZE;
+			jBegin = 1 + ty * TILE_SIZE;
+			iEnd = std::min(iBegin + TILE_SIZE, m_numberCellsX + 1);
+			jEnd = std::min(jBegin + TILE_SIZE, m_numberCellsY + 1);
+		}
+
+		template <typename T>
+		void clearTile(T * x, std::size_t tile) const
+		{
+			std::size_t stride = std::size_t(m_numberCellsX) + 2;
+			uint iBegin, iEnd, jBegin, jEnd;
+			tileCells(uint(tile % m_tilesX), uint(tile / m_tilesX), iBegin, iEnd, jBegin, jEnd);
+			for (uint j = jBegin; j < jEnd; j++)
+			{
+				std::fill(x + j * stride + iBegin, x + j * stride + iEnd, T(0.0f));
+			}
+		}
+
+		template <typename Function>
+		static uchar anyInReach(uint t, uint numTiles, uint radius, bool periodic, const Function & isSet)
+		{
+			for (uint offset = 0; offset <= radius && offset < numTiles; offset++)
+			{
+				if (t + offset < numTiles) { if (isSet(t + offset)) return 1; }
+				else if (periodic && isSet(t + offset - numTiles)) return 1;
+
+				if (t >= offset) { if (isSet(t - offset)) return 1; }
+				else if (periodic && isSet(t + numTiles - offset)) return 1;
+			}
+			return 0;
+		}
+
+	private:
+		uint m_numberCellsX = 0;
+		uint m_numberCellsY = 0;
+		uint m_tilesX = 0;
+		uint m_tilesY = 0;
+
+		std::vector<double> m_bound;
+		std::vector<uchar> m_active;
+		std::vector<uchar> m_dilated;
+		std::size_t m_numActive = 0;
+		SpanList m_spans;
+
+		/// Per buffer, tiles known to hold zero
+		std::vector<std::vector<uchar>> m_zero;
+	};
+}
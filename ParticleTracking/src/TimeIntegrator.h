@@ -1,13 +1,15 @@
 #pragma once
+#include "Definitions.h"
 
 namespace FluidSimulation
 {
+	template <typename T = real>
 	class TimeIntegrator
 	{
 	public:
 		virtual ~TimeIntegrator(){}
 
-		real getTimeIntegrationStep() const
+		T getTimeIntegrationStep() const
 		{
 			return m_timeStep;
 		}
@@ -15,7 +17,7 @@ namespace FluidSimulation
 		void increaseTimeStep()
 		{
 			m_timeStep += m_timeIncrement;
-			if (m_timeStep > real(1.0)) { m_timeStep = real(1.0); return; }
+			if (m_timeStep > T(1.0)) { m_timeStep = T(1.0); return; }
 		}
 
 		void decreaseTimeStep()
@@ -24,18 +26,18 @@ namespace FluidSimulation
 			if (m_timeStep < m_timeIncrement) { m_timeStep = m_timeIncrement; return; }
 		}
 
-		void setTimeIncrement(real increment)
+		void setTimeIncrement(T increment)
 		{
 			m_timeIncrement = increment;
 		}
 
-		void setTimeStep(real step)
+		void setTimeStep(T step)
 		{
 			m_timeStep = step;
 		}
 
 	protected:
-		real m_timeIncrement;
-		real m_timeStep;
+		T m_timeIncrement;
+		T m_timeStep;
 	};
 }
\ No newline at end of file
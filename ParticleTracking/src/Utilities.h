@@ -4,12 +4,12 @@
 
 namespace FluidSimulation
 {
-	std::ostream& operator<<(std::ostream & os, const vec2 & v)
+	inline std::ostream& operator<<(std::ostream & os, const vec2 & v)
 	{
 		return (os << v.x << ' ' << v.y);
 	}
 
-	std::ostream& operator<<(std::ostream & os, const vec3 & v)
+	inline std::ostream& operator<<(std::ostream & os, const vec3 & v)
 	{
 		return (os << v.x << ' ' << v.y << ' ' << v.z);
 	}
@@ -20,4 +20,25 @@ namespace FluidSimulation
 		if (value > max) max = value;
 		if (value < min) min = value;
 	}
+
+	/// Running minimum and maximum, NaNs are ignored like in findMinMaxValue.
+	/// Ranges of disjoint parts merge into the range of the whole in any
+	/// order, so partial ranges of threads give the serial result.
+	template <typename T>
+	struct ValueRange
+	{
+		T minimum = std::numeric_limits<T>::infinity();
+		T maximum = -std::numeric_limits<T>::infinity();
+
+		void include(T value)
+		{
+			findMinMaxValue(value, maximum, minimum);
+		}
+
+		void merge(const ValueRange & range)
+		{
+			if (range.maximum > maximum) maximum = range.maximum;
+			if (range.minimum < minimum) minimum = range.minimum;
+		}
+	};
 }
\ No newline at end of file